@@ -0,0 +1,583 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		Alloc.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Allocation tracking, virtual memory and scratch stacks.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+#include "Platform/Alloc.h"
+#include "Platform/Sync.h"
+#include "Platform/Atomic.h"
+#include <stdio.h>
+
+#ifdef _WIN32
+#define ALLOC_TLS __declspec(thread)
+#else
+#define ALLOC_TLS __thread
+#endif
+
+#define SHARD_BITS			6		// The allocation table is split into 1 << SHARD_BITS shards
+#define NUM_SHARDS			( 1 << SHARD_BITS )
+#define SHARD_MIN_SIZE		256
+#define MAX_TAGS			256		// Tags beyond this are counted under the last slot
+#define SCRATCH_RESERVE		( 8 * 1024 * 1024 )	// Address space reserved per thread
+#define SCRATCH_COMMIT_CHUNK	( 64 * 1024 )
+#define SCRATCH_ALIGN		16
+
+// Every live allocation has a record in an open addressing hash table keyed
+// by the pointer. The table is split into shards so that threads allocating
+// at the same time rarely contend for the same lock. Shards are picked by the
+// top bits of the hash and slots within a shard by the bottom bits.
+typedef struct {
+	void*			ptr;
+	size_t			size;
+	const char*		file;
+	uint32			line;
+	uint16			thread;
+	uint16			tag;
+} alloc_record_t;
+
+typedef struct {
+	sysmutex_t		lock;
+	alloc_record_t*	records;
+	uint32			mask;			// Table size - 1, zero before the first insert
+	uint32			count;
+} alloc_shard_t;
+
+typedef struct {
+	const char* volatile	name;
+	volatile uint64			live_bytes;
+	volatile uint64			live_allocs;
+	volatile uint64			total_allocs;
+} alloc_tag_t;
+
+static alloc_shard_t			shards[NUM_SHARDS];
+static alloc_tag_t				tags[MAX_TAGS];
+
+static volatile uint64			live_bytes			= 0;
+static volatile uint64			live_allocs			= 0;
+static volatile uint64			peak_bytes			= 0;
+static volatile uint64			total_allocs		= 0;
+static volatile uint64			total_bytes			= 0;
+static uint64					frame_start_allocs	= 0;
+static uint64					frame_start_bytes	= 0;
+static uint64					frame_allocs		= 0;
+static uint64					frame_bytes			= 0;
+
+typedef struct {
+	uint8*			base;
+	size_t			position;
+	size_t			committed;
+	size_t			limit;			// Usable size, the guard page follows
+} scratch_stack_t;
+
+static ALLOC_TLS scratch_stack_t	scratch				= { NULL, 0, 0, 0 };
+
+static volatile uint32			thread_counter		= 0;
+static volatile uint32			report_registered	= 0;
+static ALLOC_TLS uint32			thread_id			= 0;
+static ALLOC_TLS const char*	thread_tag			= NULL;
+
+static MYLLY_INLINE uint32 alloc_hash( void* ptr )
+{
+	uint64 h = (uint64)(size_t)ptr;
+
+	// Allocations are aligned, mix the upper bits down
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+
+	return (uint32)h;
+}
+
+static uint16 alloc_get_tag( const char* name )
+{
+	uint32 i, start;
+	void* expected;
+
+	// Tag names are compared by pointer, literals for the same tag are merged
+	// by the compiler within a module.
+	start = alloc_hash( (void*)name ) % ( MAX_TAGS - 1 );
+
+	for ( i = 0; i < MAX_TAGS - 1; ++i )
+	{
+		alloc_tag_t* tag = &tags[( start + i ) % ( MAX_TAGS - 1 )];
+
+		if ( tag->name == name ) return (uint16)( tag - tags );
+
+		if ( tag->name == NULL )
+		{
+			expected = NULL;
+
+			if ( atomic_cas_ptr( (void* volatile*)&tag->name, &expected, (void*)name, MEMORY_ORDER_ACQ_REL ) ||
+				 expected == name )
+				return (uint16)( tag - tags );
+		}
+	}
+
+	tags[MAX_TAGS - 1].name = "(other)";
+	return MAX_TAGS - 1;
+}
+
+static void alloc_shard_grow( alloc_shard_t* shard )
+{
+	alloc_record_t *old, *record;
+	uint32 i, j, old_size, size;
+
+	old = shard->records;
+	old_size = old ? shard->mask + 1 : 0;
+	size = old ? old_size * 2 : SHARD_MIN_SIZE;
+
+	shard->records = (alloc_record_t*)calloc( size, sizeof(alloc_record_t) );
+	if ( shard->records == NULL ) { exit( EXIT_FAILURE ); }
+
+	shard->mask = size - 1;
+
+	for ( i = 0; i < old_size; ++i )
+	{
+		if ( old[i].ptr == NULL ) continue;
+
+		for ( j = alloc_hash( old[i].ptr ) & shard->mask; shard->records[j].ptr != NULL; j = ( j + 1 ) & shard->mask ) {}
+		record = &shard->records[j];
+		*record = old[i];
+	}
+
+	free( old );
+}
+
+static void alloc_shard_remove( alloc_shard_t* shard, uint32 index )
+{
+	uint32 i, j, home;
+
+	// Backward shift deletion keeps the probe sequences intact without tombstones
+	i = index;
+
+	for ( j = ( i + 1 ) & shard->mask; shard->records[j].ptr != NULL; j = ( j + 1 ) & shard->mask )
+	{
+		home = alloc_hash( shard->records[j].ptr ) & shard->mask;
+
+		// Move the record back if its home slot is not between the hole and its position
+		if ( ( ( j - home ) & shard->mask ) >= ( ( j - i ) & shard->mask ) )
+		{
+			shard->records[i] = shard->records[j];
+			i = j;
+		}
+	}
+
+	shard->records[i].ptr = NULL;
+	shard->count--;
+}
+
+static void alloc_untrack( const alloc_record_t* record )
+{
+	alloc_tag_t* tag = &tags[record->tag];
+
+	atomic_fetch_add_64( &live_bytes, (uint64)0 - record->size, MEMORY_ORDER_RELAXED );
+	atomic_fetch_add_64( &live_allocs, (uint64)-1, MEMORY_ORDER_RELAXED );
+	atomic_fetch_add_64( &tag->live_bytes, (uint64)0 - record->size, MEMORY_ORDER_RELAXED );
+	atomic_fetch_add_64( &tag->live_allocs, (uint64)-1, MEMORY_ORDER_RELAXED );
+}
+
+static void alloc_report_at_exit( void )
+{
+	mem_report_leaks();
+}
+
+void* mem_alloc_tracked( size_t size, bool clean, const char* file, uint32 line )
+{
+	alloc_shard_t* shard;
+	alloc_record_t* record;
+	alloc_tag_t* tag;
+	uint64 live, peak;
+	uint32 hash, i;
+	uint16 tag_index;
+	void* ptr;
+
+	ptr = clean ? calloc( 1, size ) : malloc( size );
+
+	assert( ptr != NULL );
+	if ( !ptr ) { exit( EXIT_FAILURE ); }
+
+	if ( thread_id == 0 )
+	{
+		thread_id = atomic_fetch_add_32( &thread_counter, 1, MEMORY_ORDER_RELAXED ) + 1;
+
+		if ( atomic_exchange_32( &report_registered, 1, MEMORY_ORDER_RELAXED ) == 0 )
+			atexit( alloc_report_at_exit );
+	}
+
+	hash = alloc_hash( ptr );
+	shard = &shards[hash >> ( 32 - SHARD_BITS )];
+
+	mutex_lock( &shard->lock );
+
+	if ( shard->mask == 0 || ( shard->count + 1 ) * 4 > ( shard->mask + 1 ) * 3 )
+		alloc_shard_grow( shard );
+
+	for ( i = hash & shard->mask; shard->records[i].ptr != NULL; i = ( i + 1 ) & shard->mask )
+	{
+		if ( shard->records[i].ptr == ptr )
+		{
+			// Stale record of a block released without the tracker
+			alloc_untrack( &shard->records[i] );
+			shard->count--;
+			break;
+		}
+	}
+
+	record = &shard->records[i];
+	record->ptr = ptr;
+	record->size = size;
+	record->file = file;
+	record->line = line;
+	record->thread = (uint16)thread_id;
+	record->tag = tag_index = alloc_get_tag( thread_tag ? thread_tag : file );
+
+	shard->count++;
+
+	mutex_unlock( &shard->lock );
+
+	tag = &tags[tag_index];
+	atomic_fetch_add_64( &tag->live_bytes, size, MEMORY_ORDER_RELAXED );
+	atomic_fetch_add_64( &tag->live_allocs, 1, MEMORY_ORDER_RELAXED );
+	atomic_fetch_add_64( &tag->total_allocs, 1, MEMORY_ORDER_RELAXED );
+
+	atomic_fetch_add_64( &total_allocs, 1, MEMORY_ORDER_RELAXED );
+	atomic_fetch_add_64( &total_bytes, size, MEMORY_ORDER_RELAXED );
+	atomic_fetch_add_64( &live_allocs, 1, MEMORY_ORDER_RELAXED );
+	live = atomic_fetch_add_64( &live_bytes, size, MEMORY_ORDER_RELAXED ) + size;
+
+	peak = atomic_load_64( &peak_bytes, MEMORY_ORDER_RELAXED );
+	while ( live > peak && !atomic_cas_64( &peak_bytes, &peak, live, MEMORY_ORDER_RELAXED ) ) {}
+
+	return ptr;
+}
+
+void mem_free_tracked( void* ptr )
+{
+	alloc_shard_t* shard;
+	uint32 hash, i;
+
+	if ( ptr == NULL ) return;
+
+	hash = alloc_hash( ptr );
+	shard = &shards[hash >> ( 32 - SHARD_BITS )];
+
+	mutex_lock( &shard->lock );
+
+	if ( shard->mask != 0 )
+	{
+		for ( i = hash & shard->mask; shard->records[i].ptr != NULL; i = ( i + 1 ) & shard->mask )
+		{
+			if ( shard->records[i].ptr == ptr )
+			{
+				alloc_untrack( &shard->records[i] );
+				alloc_shard_remove( shard, i );
+				break;
+			}
+		}
+	}
+
+	mutex_unlock( &shard->lock );
+
+	// Blocks allocated without the tracker are released as they are
+	free( ptr );
+}
+
+const char* mem_set_tag( const char* tag )
+{
+	const char* prev = thread_tag;
+
+	thread_tag = tag;
+	return prev;
+}
+
+void mem_tracking_frame( void )
+{
+	uint64 allocs = atomic_load_64( &total_allocs, MEMORY_ORDER_RELAXED );
+	uint64 bytes = atomic_load_64( &total_bytes, MEMORY_ORDER_RELAXED );
+
+	frame_allocs = allocs - frame_start_allocs;
+	frame_bytes = bytes - frame_start_bytes;
+
+	frame_start_allocs = allocs;
+	frame_start_bytes = bytes;
+}
+
+void mem_get_stats( mem_stats_t* stats )
+{
+	if ( stats == NULL ) return;
+
+	stats->live_bytes = atomic_load_64( &live_bytes, MEMORY_ORDER_RELAXED );
+	stats->live_allocs = atomic_load_64( &live_allocs, MEMORY_ORDER_RELAXED );
+	stats->peak_bytes = atomic_load_64( &peak_bytes, MEMORY_ORDER_RELAXED );
+	stats->total_allocs = atomic_load_64( &total_allocs, MEMORY_ORDER_RELAXED );
+	stats->total_bytes = atomic_load_64( &total_bytes, MEMORY_ORDER_RELAXED );
+	stats->frame_allocs = frame_allocs;
+	stats->frame_bytes = frame_bytes;
+}
+
+uint32 mem_get_tag_stats( mem_tag_stats_t* stats, uint32 max_tags )
+{
+	uint32 i, count = 0;
+
+	for ( i = 0; i < MAX_TAGS && count < max_tags; ++i )
+	{
+		if ( tags[i].name == NULL ) continue;
+
+		stats[count].tag = tags[i].name;
+		stats[count].live_bytes = atomic_load_64( &tags[i].live_bytes, MEMORY_ORDER_RELAXED );
+		stats[count].live_allocs = atomic_load_64( &tags[i].live_allocs, MEMORY_ORDER_RELAXED );
+		stats[count].total_allocs = atomic_load_64( &tags[i].total_allocs, MEMORY_ORDER_RELAXED );
+		count++;
+	}
+
+	return count;
+}
+
+uint32 mem_report_leaks( void )
+{
+	alloc_shard_t* shard;
+	alloc_record_t* record;
+	uint64 bytes = 0;
+	uint32 i, j, leaks = 0;
+
+	for ( i = 0; i < NUM_SHARDS; ++i )
+	{
+		shard = &shards[i];
+		mutex_lock( &shard->lock );
+
+		for ( j = 0; shard->mask != 0 && j <= shard->mask; ++j )
+		{
+			record = &shard->records[j];
+			if ( record->ptr == NULL ) continue;
+
+			fprintf( stderr, "%s(%u): leaked %llu bytes at %p [%s, thread %u]\n",
+					 record->file, record->line, (unsigned long long)record->size,
+					 record->ptr, tags[record->tag].name, record->thread );
+
+			bytes += record->size;
+			leaks++;
+		}
+
+		mutex_unlock( &shard->lock );
+	}
+
+	if ( leaks )
+		fprintf( stderr, "%u allocations leaked, %llu bytes total\n", leaks, (unsigned long long)bytes );
+
+	return leaks;
+}
+
+#ifdef _WIN32
+
+//////////////////////////////////////////////////////////////////////////
+// Win32 virtual memory
+//////////////////////////////////////////////////////////////////////////
+
+size_t mem_page_size( void )
+{
+	static size_t page_size = 0;
+	SYSTEM_INFO info;
+
+	if ( page_size == 0 )
+	{
+		GetSystemInfo( &info );
+		page_size = info.dwPageSize;
+	}
+
+	return page_size;
+}
+
+void* mem_reserve( size_t size )
+{
+	return VirtualAlloc( NULL, size, MEM_RESERVE, PAGE_NOACCESS );
+}
+
+bool mem_commit( void* ptr, size_t size )
+{
+	return VirtualAlloc( ptr, size, MEM_COMMIT, PAGE_READWRITE ) != NULL;
+}
+
+void mem_decommit( void* ptr, size_t size )
+{
+	VirtualFree( ptr, size, MEM_DECOMMIT );
+}
+
+void mem_release( void* ptr, size_t size )
+{
+	UNREFERENCED_PARAM( size );
+	VirtualFree( ptr, 0, MEM_RELEASE );
+}
+
+static void WINAPI scratch_thread_exit( void* base )
+{
+	if ( base ) mem_release( base, 0 );
+}
+
+static void scratch_register_thread( void* base )
+{
+	static volatile uint32 index = FLS_OUT_OF_INDEXES;
+	uint32 expected = FLS_OUT_OF_INDEXES, key;
+
+	// The fiber local slot callback releases the stack when the thread exits
+	if ( atomic_load_32( &index, MEMORY_ORDER_ACQUIRE ) == FLS_OUT_OF_INDEXES )
+	{
+		key = FlsAlloc( scratch_thread_exit );
+		if ( !atomic_cas_32( &index, &expected, key, MEMORY_ORDER_ACQ_REL ) ) FlsFree( key );
+	}
+
+	FlsSetValue( index, base );
+}
+
+bool mem_hint_huge_pages( void* ptr, size_t size )
+{
+	// Large pages need SeLockMemoryPrivilege and must be requested when the
+	// memory is allocated, there is no transparent equivalent.
+	UNREFERENCED_PARAM( ptr );
+	UNREFERENCED_PARAM( size );
+	return false;
+}
+
+#else
+
+//////////////////////////////////////////////////////////////////////////
+// POSIX virtual memory
+//////////////////////////////////////////////////////////////////////////
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+size_t mem_page_size( void )
+{
+	static size_t page_size = 0;
+
+	if ( page_size == 0 ) page_size = (size_t)sysconf( _SC_PAGESIZE );
+	return page_size;
+}
+
+void* mem_reserve( size_t size )
+{
+	void* ptr = mmap( NULL, size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0 );
+	return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+bool mem_commit( void* ptr, size_t size )
+{
+	return mprotect( ptr, size, PROT_READ|PROT_WRITE ) == 0;
+}
+
+void mem_decommit( void* ptr, size_t size )
+{
+	// Drop the pages first so the memory is returned even if the range stays mapped
+	madvise( ptr, size, MADV_DONTNEED );
+	mprotect( ptr, size, PROT_NONE );
+}
+
+void mem_release( void* ptr, size_t size )
+{
+	munmap( ptr, size );
+}
+
+static pthread_key_t	scratch_key;
+static pthread_once_t	scratch_once	= PTHREAD_ONCE_INIT;
+
+static void scratch_thread_exit( void* base )
+{
+	mem_release( base, SCRATCH_RESERVE );
+}
+
+static void scratch_create_key( void )
+{
+	pthread_key_create( &scratch_key, scratch_thread_exit );
+}
+
+static void scratch_register_thread( void* base )
+{
+	// The key destructor releases the stack when the thread exits
+	pthread_once( &scratch_once, scratch_create_key );
+	pthread_setspecific( scratch_key, base );
+}
+
+bool mem_hint_huge_pages( void* ptr, size_t size )
+{
+#ifdef MADV_HUGEPAGE
+	// Huge pages only cover whole 2MB aligned blocks within the range
+	return madvise( ptr, size, MADV_HUGEPAGE ) == 0;
+#else
+	UNREFERENCED_PARAM( ptr );
+	UNREFERENCED_PARAM( size );
+	return false;
+#endif
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Scratch stack
+//////////////////////////////////////////////////////////////////////////
+
+void* mem_scratch_push( size_t size )
+{
+	size_t start, end, commit;
+
+	if ( scratch.base == NULL )
+	{
+		// First use on this thread. The last page of the reservation is never
+		// committed and acts as a guard against writes past the end.
+		scratch.base = (uint8*)mem_reserve( SCRATCH_RESERVE );
+		if ( scratch.base == NULL ) { exit( EXIT_FAILURE ); }
+
+		scratch.limit = SCRATCH_RESERVE - mem_page_size();
+		scratch_register_thread( scratch.base );
+	}
+
+	start = ( scratch.position + SCRATCH_ALIGN - 1 ) & ~(size_t)( SCRATCH_ALIGN - 1 );
+	end = start + size;
+
+	if ( end > scratch.limit || end < start )
+	{
+		assert( !"Scratch stack overflow" );
+		exit( EXIT_FAILURE );
+	}
+
+	if ( end > scratch.committed )
+	{
+		commit = ( end + SCRATCH_COMMIT_CHUNK - 1 ) & ~(size_t)( SCRATCH_COMMIT_CHUNK - 1 );
+		if ( commit > scratch.limit ) commit = scratch.limit;
+
+		if ( !mem_commit( scratch.base + scratch.committed, commit - scratch.committed ) ) { exit( EXIT_FAILURE ); }
+		scratch.committed = commit;
+	}
+
+	scratch.position = end;
+	return scratch.base + start;
+}
+
+void mem_scratch_pop( void* ptr )
+{
+	uint8* p = (uint8*)ptr;
+
+	if ( p == NULL ) return;
+
+	assert( p >= scratch.base && p <= scratch.base + scratch.position );
+	scratch.position = (size_t)( p - scratch.base );
+}
+
+size_t mem_scratch_used( void )
+{
+	return scratch.position;
+}
@@ -19,6 +19,67 @@
 #include <string.h>
 #include "stdtypes.h"
 
+// Defining MYLLY_ALLOC_TRACKING routes mem_alloc and mem_free through the
+// tracker in Alloc.c, which records the size, call site, tag and thread of
+// every live allocation. Without it the functions below are plain wrappers
+// for malloc and free.
+//
+// mem_reserve reserves address space without backing it with memory. Pages
+// must be committed before they are touched, and can be decommitted to return
+// the memory to the system while keeping the address range. Sizes and
+// addresses passed to the page functions should be multiples of mem_page_size.
+
+typedef struct {
+	uint64		live_bytes;		// Bytes currently allocated
+	uint64		live_allocs;	// Number of live allocations
+	uint64		peak_bytes;		// Highest live_bytes seen
+	uint64		total_allocs;	// Allocations since startup
+	uint64		total_bytes;	// Bytes allocated since startup
+	uint64		frame_allocs;	// Allocations during the previous frame
+	uint64		frame_bytes;	// Bytes allocated during the previous frame
+} mem_stats_t;
+
+typedef struct {
+	const char*	tag;			// Tag or source file of the allocations
+	uint64		live_bytes;
+	uint64		live_allocs;
+	uint64		total_allocs;
+} mem_tag_stats_t;
+
+__BEGIN_DECLS
+
+MYLLY_API void*			mem_alloc_tracked		( size_t size, bool clean, const char* file, uint32 line );
+MYLLY_API void			mem_free_tracked		( void* ptr );
+
+MYLLY_API const char*	mem_set_tag				( const char* tag );
+MYLLY_API void			mem_tracking_frame		( void );
+MYLLY_API void			mem_get_stats			( mem_stats_t* stats );
+MYLLY_API uint32		mem_get_tag_stats		( mem_tag_stats_t* stats, uint32 max_tags );
+MYLLY_API uint32		mem_report_leaks		( void );
+
+MYLLY_API size_t		mem_page_size			( void );
+MYLLY_API void*			mem_reserve				( size_t size );
+MYLLY_API bool			mem_commit				( void* ptr, size_t size );
+MYLLY_API void			mem_decommit			( void* ptr, size_t size );
+MYLLY_API void			mem_release				( void* ptr, size_t size );
+MYLLY_API bool			mem_hint_huge_pages		( void* ptr, size_t size );
+
+// Per-thread scratch stack with a guard page. Blocks must be popped in
+// reverse order, popping a block also frees every block pushed after it.
+MYLLY_API void*			mem_scratch_push		( size_t size );
+MYLLY_API void			mem_scratch_pop			( void* ptr );
+MYLLY_API size_t		mem_scratch_used		( void );
+
+__END_DECLS
+
+#ifdef MYLLY_ALLOC_TRACKING
+
+#define mem_alloc( size )		mem_alloc_tracked( size, false, __FILE__, __LINE__ )
+#define mem_alloc_clean( size )	mem_alloc_tracked( size, true, __FILE__, __LINE__ )
+#define mem_free( ptr )			mem_free_tracked( ptr )
+
+#else
+
 static void*	mem_alloc		( size_t size );
 static void*	mem_alloc_clean	( size_t size );
 static void		mem_free		( void* ptr );
@@ -49,6 +110,41 @@ static MYLLY_INLINE void mem_free( void* ptr )
 	free( ptr );
 }
 
+#endif /* MYLLY_ALLOC_TRACKING */
+
+// Aligned allocations are not tracked, alignment must be a power of two.
+// Memory returned by mem_alloc_aligned must be released with mem_free_aligned.
+
+static void*	mem_alloc_aligned	( size_t size, size_t alignment );
+static void		mem_free_aligned	( void* ptr );
+
+static MYLLY_INLINE void* mem_alloc_aligned( size_t size, size_t alignment )
+{
+	void* ptr;
+
+	if ( alignment < sizeof(void*) ) alignment = sizeof(void*);
+
+#ifdef _WIN32
+	ptr = _aligned_malloc( size, alignment );
+#else
+	if ( posix_memalign( &ptr, alignment, size ) != 0 ) ptr = NULL;
+#endif
+
+	assert( ptr != NULL );
+	if ( !ptr ) { exit( EXIT_FAILURE ); }
+
+	return ptr;
+}
+
+static MYLLY_INLINE void mem_free_aligned( void* ptr )
+{
+#ifdef _WIN32
+	_aligned_free( ptr );
+#else
+	free( ptr );
+#endif
+}
+
 #ifdef _WIN32
 
 #define mem_stack_alloc( ptr, size ) \
@@ -0,0 +1,75 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		Arena.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Linear allocators for short-lived and per-frame memory.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+#include "Platform/Arena.h"
+#include "Platform/Alloc.h"
+
+#define ARENA_COMMIT_CHUNK	( 64 * 1024 )	// Commit granularity
+
+bool arena_init( arena_t* arena, size_t reserve )
+{
+	memset( arena, 0, sizeof(*arena) );
+
+	reserve = ( reserve + ARENA_COMMIT_CHUNK - 1 ) & ~(size_t)( ARENA_COMMIT_CHUNK - 1 );
+	if ( reserve == 0 ) return false;
+
+	arena->base = (uint8*)mem_reserve( reserve );
+	if ( arena->base == NULL ) return false;
+
+	arena->reserved = reserve;
+	return true;
+}
+
+void arena_release( arena_t* arena )
+{
+	if ( arena->base ) mem_release( arena->base, arena->reserved );
+	memset( arena, 0, sizeof(*arena) );
+}
+
+bool arena_commit( arena_t* arena, size_t size )
+{
+	size_t commit;
+
+	if ( size <= arena->committed ) return true;
+
+	if ( size > arena->reserved ) return false;
+
+	// Grow in whole chunks to keep the number of commits down
+	commit = ( size + ARENA_COMMIT_CHUNK - 1 ) & ~(size_t)( ARENA_COMMIT_CHUNK - 1 );
+	if ( commit > arena->reserved ) commit = arena->reserved;
+
+	if ( !mem_commit( arena->base + arena->committed, commit - arena->committed ) )
+		return false;
+
+	arena->committed = commit;
+	return true;
+}
+
+bool frame_arena_init( frame_arena_t* arena, size_t reserve )
+{
+	arena->frame = 0;
+
+	if ( !arena_init( &arena->arenas[0], reserve ) ) return false;
+
+	if ( !arena_init( &arena->arenas[1], reserve ) )
+	{
+		arena_release( &arena->arenas[0] );
+		return false;
+	}
+
+	return true;
+}
+
+void frame_arena_release( frame_arena_t* arena )
+{
+	arena_release( &arena->arenas[0] );
+	arena_release( &arena->arenas[1] );
+}
@@ -0,0 +1,113 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		Arena.h
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Linear allocators for short-lived and per-frame memory.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+#pragma once
+#ifndef __LIB_PLATFORM_ARENA_H
+#define __LIB_PLATFORM_ARENA_H
+
+#include <string.h>
+#include "stdtypes.h"
+
+// An arena reserves a range of address space up front and commits it in
+// chunks as allocations reach it, so a large reservation costs nothing until
+// it's used. Allocation is a pointer bump. Memory is never freed
+// individually: rewind the arena to a mark or reset it as a whole.
+//
+// A frame arena holds two arenas and alternates between them every frame,
+// so memory allocated during the previous frame stays valid for one frame.
+
+#define ARENA_DEFAULT_ALIGN		16
+
+typedef struct {
+	uint8*		base;
+	size_t		position;
+	size_t		committed;
+	size_t		reserved;
+	size_t		peak;
+} arena_t;
+
+typedef struct {
+	arena_t		arenas[2];
+	uint32		frame;
+} frame_arena_t;
+
+__BEGIN_DECLS
+
+MYLLY_API bool		arena_init				( arena_t* arena, size_t reserve );
+MYLLY_API void		arena_release			( arena_t* arena );
+MYLLY_API bool		arena_commit			( arena_t* arena, size_t size );
+
+MYLLY_API bool		frame_arena_init		( frame_arena_t* arena, size_t reserve );
+MYLLY_API void		frame_arena_release		( frame_arena_t* arena );
+
+__END_DECLS
+
+// Allocates size bytes with the given alignment (a power of two, or 0 for
+// ARENA_DEFAULT_ALIGN). Returns NULL if the reservation is exhausted.
+static MYLLY_INLINE void* arena_alloc( arena_t* arena, size_t size, size_t alignment )
+{
+	size_t start, end;
+
+	if ( alignment == 0 ) alignment = ARENA_DEFAULT_ALIGN;
+
+	start = ( arena->position + alignment - 1 ) & ~( alignment - 1 );
+
+	// Compare against the space left so a huge size can't wrap around
+	if ( start < arena->position || start > arena->reserved || size > arena->reserved - start )
+		return NULL;
+
+	end = start + size;
+
+	if ( end > arena->committed && !arena_commit( arena, end ) )
+		return NULL;
+
+	arena->position = end;
+	if ( end > arena->peak ) arena->peak = end;
+
+	return arena->base + start;
+}
+
+static MYLLY_INLINE void* arena_alloc_clean( arena_t* arena, size_t size, size_t alignment )
+{
+	void* ptr = arena_alloc( arena, size, alignment );
+
+	if ( ptr ) memset( ptr, 0, size );
+	return ptr;
+}
+
+static MYLLY_INLINE size_t arena_mark( arena_t* arena )
+{
+	return arena->position;
+}
+
+static MYLLY_INLINE void arena_rewind( arena_t* arena, size_t mark )
+{
+	if ( mark < arena->position ) arena->position = mark;
+}
+
+static MYLLY_INLINE void arena_reset( arena_t* arena )
+{
+	arena->position = 0;
+}
+
+// Starts a new frame. Everything allocated two frames ago is released.
+static MYLLY_INLINE void frame_arena_begin( frame_arena_t* arena )
+{
+	arena->frame++;
+	arena_reset( &arena->arenas[arena->frame & 1] );
+}
+
+static MYLLY_INLINE void* frame_alloc( frame_arena_t* arena, size_t size, size_t alignment )
+{
+	return arena_alloc( &arena->arenas[arena->frame & 1], size, alignment );
+}
+
+#endif /* __LIB_PLATFORM_ARENA_H */
@@ -0,0 +1,318 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		Atomic.h
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Atomic operations and memory fences.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+#pragma once
+#ifndef __LIB_PLATFORM_ATOMIC_H
+#define __LIB_PLATFORM_ATOMIC_H
+
+#include "stdtypes.h"
+
+// Atomic operations on plain (volatile) 32-bit, 64-bit and pointer values.
+// The memory orders follow the C11 memory model. Compare-and-swap is strong
+// and updates *expected with the current value on failure, like
+// atomic_compare_exchange_strong_explicit.
+//
+// GCC and Clang map directly to the __atomic builtins. MSVC maps to the
+// Interlocked family, where every read-modify-write is a full barrier.
+
+typedef enum {
+	MEMORY_ORDER_RELAXED,
+	MEMORY_ORDER_CONSUME,
+	MEMORY_ORDER_ACQUIRE,
+	MEMORY_ORDER_RELEASE,
+	MEMORY_ORDER_ACQ_REL,
+	MEMORY_ORDER_SEQ_CST,
+} MEMORY_ORDER;
+
+#ifdef _MSC_VER
+
+//////////////////////////////////////////////////////////////////////////
+// MSVC implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include <intrin.h>
+
+#if defined(_M_IX86) || defined(_M_X64)
+	// x86 loads have acquire and stores release semantics, only the compiler
+	// needs to be kept from reordering.
+	#define __ATOMIC_ORDER_BARRIER( order ) \
+		if ( order != MEMORY_ORDER_RELAXED ) _ReadWriteBarrier()
+#else
+	#define __ATOMIC_ORDER_BARRIER( order ) \
+		if ( order != MEMORY_ORDER_RELAXED ) MemoryBarrier()
+#endif
+
+static MYLLY_INLINE uint32 atomic_load_32( volatile uint32* ptr, MEMORY_ORDER order )
+{
+	uint32 value = *ptr;
+	__ATOMIC_ORDER_BARRIER( order );
+	return value;
+}
+
+static MYLLY_INLINE uint64 atomic_load_64( volatile uint64* ptr, MEMORY_ORDER order )
+{
+	uint64 value;
+
+#ifdef _M_IX86
+	// 64-bit reads aren't atomic on 32-bit x86
+	value = (uint64)InterlockedCompareExchange64( (volatile LONG64*)ptr, 0, 0 );
+#else
+	value = *ptr;
+#endif
+
+	__ATOMIC_ORDER_BARRIER( order );
+	return value;
+}
+
+static MYLLY_INLINE void* atomic_load_ptr( void* volatile* ptr, MEMORY_ORDER order )
+{
+	void* value = *ptr;
+	__ATOMIC_ORDER_BARRIER( order );
+	return value;
+}
+
+static MYLLY_INLINE void atomic_store_32( volatile uint32* ptr, uint32 value, MEMORY_ORDER order )
+{
+	if ( order == MEMORY_ORDER_SEQ_CST ) { InterlockedExchange( (volatile LONG*)ptr, (LONG)value ); return; }
+
+	__ATOMIC_ORDER_BARRIER( order );
+	*ptr = value;
+}
+
+static MYLLY_INLINE void atomic_store_64( volatile uint64* ptr, uint64 value, MEMORY_ORDER order )
+{
+#ifdef _M_IX86
+	UNREFERENCED_PARAM( order );
+	InterlockedExchange64( (volatile LONG64*)ptr, (LONG64)value );
+#else
+	if ( order == MEMORY_ORDER_SEQ_CST ) { InterlockedExchange64( (volatile LONG64*)ptr, (LONG64)value ); return; }
+
+	__ATOMIC_ORDER_BARRIER( order );
+	*ptr = value;
+#endif
+}
+
+static MYLLY_INLINE void atomic_store_ptr( void* volatile* ptr, void* value, MEMORY_ORDER order )
+{
+	if ( order == MEMORY_ORDER_SEQ_CST ) { InterlockedExchangePointer( ptr, value ); return; }
+
+	__ATOMIC_ORDER_BARRIER( order );
+	*ptr = value;
+}
+
+static MYLLY_INLINE uint32 atomic_exchange_32( volatile uint32* ptr, uint32 value, MEMORY_ORDER order )
+{
+	UNREFERENCED_PARAM( order );
+	return (uint32)InterlockedExchange( (volatile LONG*)ptr, (LONG)value );
+}
+
+static MYLLY_INLINE uint64 atomic_exchange_64( volatile uint64* ptr, uint64 value, MEMORY_ORDER order )
+{
+	UNREFERENCED_PARAM( order );
+	return (uint64)InterlockedExchange64( (volatile LONG64*)ptr, (LONG64)value );
+}
+
+static MYLLY_INLINE void* atomic_exchange_ptr( void* volatile* ptr, void* value, MEMORY_ORDER order )
+{
+	UNREFERENCED_PARAM( order );
+	return InterlockedExchangePointer( ptr, value );
+}
+
+static MYLLY_INLINE bool atomic_cas_32( volatile uint32* ptr, uint32* expected, uint32 desired, MEMORY_ORDER order )
+{
+	uint32 prev = (uint32)InterlockedCompareExchange( (volatile LONG*)ptr, (LONG)desired, (LONG)*expected );
+
+	UNREFERENCED_PARAM( order );
+
+	if ( prev == *expected ) return true;
+
+	*expected = prev;
+	return false;
+}
+
+static MYLLY_INLINE bool atomic_cas_64( volatile uint64* ptr, uint64* expected, uint64 desired, MEMORY_ORDER order )
+{
+	uint64 prev = (uint64)InterlockedCompareExchange64( (volatile LONG64*)ptr, (LONG64)desired, (LONG64)*expected );
+
+	UNREFERENCED_PARAM( order );
+
+	if ( prev == *expected ) return true;
+
+	*expected = prev;
+	return false;
+}
+
+static MYLLY_INLINE bool atomic_cas_ptr( void* volatile* ptr, void** expected, void* desired, MEMORY_ORDER order )
+{
+	void* prev = InterlockedCompareExchangePointer( ptr, desired, *expected );
+
+	UNREFERENCED_PARAM( order );
+
+	if ( prev == *expected ) return true;
+
+	*expected = prev;
+	return false;
+}
+
+static MYLLY_INLINE uint32 atomic_fetch_add_32( volatile uint32* ptr, uint32 value, MEMORY_ORDER order )
+{
+	UNREFERENCED_PARAM( order );
+	return (uint32)InterlockedExchangeAdd( (volatile LONG*)ptr, (LONG)value );
+}
+
+static MYLLY_INLINE uint64 atomic_fetch_add_64( volatile uint64* ptr, uint64 value, MEMORY_ORDER order )
+{
+	UNREFERENCED_PARAM( order );
+	return (uint64)InterlockedExchangeAdd64( (volatile LONG64*)ptr, (LONG64)value );
+}
+
+static MYLLY_INLINE uint32 atomic_fetch_or_32( volatile uint32* ptr, uint32 value, MEMORY_ORDER order )
+{
+	UNREFERENCED_PARAM( order );
+	return (uint32)InterlockedOr( (volatile LONG*)ptr, (LONG)value );
+}
+
+static MYLLY_INLINE uint32 atomic_fetch_and_32( volatile uint32* ptr, uint32 value, MEMORY_ORDER order )
+{
+	UNREFERENCED_PARAM( order );
+	return (uint32)InterlockedAnd( (volatile LONG*)ptr, (LONG)value );
+}
+
+static MYLLY_INLINE void atomic_fence( MEMORY_ORDER order )
+{
+	if ( order == MEMORY_ORDER_SEQ_CST ) MemoryBarrier();
+	else __ATOMIC_ORDER_BARRIER( order );
+}
+
+static MYLLY_INLINE void cpu_pause( void )
+{
+	YieldProcessor();
+}
+
+#undef __ATOMIC_ORDER_BARRIER
+
+#else
+
+//////////////////////////////////////////////////////////////////////////
+// GCC/Clang implementation
+//////////////////////////////////////////////////////////////////////////
+
+// MEMORY_ORDER values match the __ATOMIC_* constants
+#define __MYLLY_ORDER( order )	( (int)(order) )
+
+// Failure ordering of a compare-and-swap may not be release or stronger than
+// the success ordering.
+#define __MYLLY_FAIL_ORDER( order ) \
+	( (order) == MEMORY_ORDER_RELEASE ? __ATOMIC_RELAXED : \
+	  (order) == MEMORY_ORDER_ACQ_REL ? __ATOMIC_ACQUIRE : (int)(order) )
+
+static MYLLY_INLINE uint32 atomic_load_32( volatile uint32* ptr, MEMORY_ORDER order )
+{
+	return __atomic_load_n( ptr, __MYLLY_ORDER( order ) );
+}
+
+static MYLLY_INLINE uint64 atomic_load_64( volatile uint64* ptr, MEMORY_ORDER order )
+{
+	return __atomic_load_n( ptr, __MYLLY_ORDER( order ) );
+}
+
+static MYLLY_INLINE void* atomic_load_ptr( void* volatile* ptr, MEMORY_ORDER order )
+{
+	return __atomic_load_n( ptr, __MYLLY_ORDER( order ) );
+}
+
+static MYLLY_INLINE void atomic_store_32( volatile uint32* ptr, uint32 value, MEMORY_ORDER order )
+{
+	__atomic_store_n( ptr, value, __MYLLY_ORDER( order ) );
+}
+
+static MYLLY_INLINE void atomic_store_64( volatile uint64* ptr, uint64 value, MEMORY_ORDER order )
+{
+	__atomic_store_n( ptr, value, __MYLLY_ORDER( order ) );
+}
+
+static MYLLY_INLINE void atomic_store_ptr( void* volatile* ptr, void* value, MEMORY_ORDER order )
+{
+	__atomic_store_n( ptr, value, __MYLLY_ORDER( order ) );
+}
+
+static MYLLY_INLINE uint32 atomic_exchange_32( volatile uint32* ptr, uint32 value, MEMORY_ORDER order )
+{
+	return __atomic_exchange_n( ptr, value, __MYLLY_ORDER( order ) );
+}
+
+static MYLLY_INLINE uint64 atomic_exchange_64( volatile uint64* ptr, uint64 value, MEMORY_ORDER order )
+{
+	return __atomic_exchange_n( ptr, value, __MYLLY_ORDER( order ) );
+}
+
+static MYLLY_INLINE void* atomic_exchange_ptr( void* volatile* ptr, void* value, MEMORY_ORDER order )
+{
+	return __atomic_exchange_n( ptr, value, __MYLLY_ORDER( order ) );
+}
+
+static MYLLY_INLINE bool atomic_cas_32( volatile uint32* ptr, uint32* expected, uint32 desired, MEMORY_ORDER order )
+{
+	return __atomic_compare_exchange_n( ptr, expected, desired, false, __MYLLY_ORDER( order ), __MYLLY_FAIL_ORDER( order ) );
+}
+
+static MYLLY_INLINE bool atomic_cas_64( volatile uint64* ptr, uint64* expected, uint64 desired, MEMORY_ORDER order )
+{
+	return __atomic_compare_exchange_n( ptr, expected, desired, false, __MYLLY_ORDER( order ), __MYLLY_FAIL_ORDER( order ) );
+}
+
+static MYLLY_INLINE bool atomic_cas_ptr( void* volatile* ptr, void** expected, void* desired, MEMORY_ORDER order )
+{
+	return __atomic_compare_exchange_n( ptr, expected, desired, false, __MYLLY_ORDER( order ), __MYLLY_FAIL_ORDER( order ) );
+}
+
+static MYLLY_INLINE uint32 atomic_fetch_add_32( volatile uint32* ptr, uint32 value, MEMORY_ORDER order )
+{
+	return __atomic_fetch_add( ptr, value, __MYLLY_ORDER( order ) );
+}
+
+static MYLLY_INLINE uint64 atomic_fetch_add_64( volatile uint64* ptr, uint64 value, MEMORY_ORDER order )
+{
+	return __atomic_fetch_add( ptr, value, __MYLLY_ORDER( order ) );
+}
+
+static MYLLY_INLINE uint32 atomic_fetch_or_32( volatile uint32* ptr, uint32 value, MEMORY_ORDER order )
+{
+	return __atomic_fetch_or( ptr, value, __MYLLY_ORDER( order ) );
+}
+
+static MYLLY_INLINE uint32 atomic_fetch_and_32( volatile uint32* ptr, uint32 value, MEMORY_ORDER order )
+{
+	return __atomic_fetch_and( ptr, value, __MYLLY_ORDER( order ) );
+}
+
+static MYLLY_INLINE void atomic_fence( MEMORY_ORDER order )
+{
+	__atomic_thread_fence( __MYLLY_ORDER( order ) );
+}
+
+static MYLLY_INLINE void cpu_pause( void )
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__( "yield" ::: "memory" );
+#else
+	__asm__ __volatile__( "" ::: "memory" );
+#endif
+}
+
+#undef __MYLLY_ORDER
+#undef __MYLLY_FAIL_ORDER
+
+#endif /* _MSC_VER */
+
+#endif /* __LIB_PLATFORM_ATOMIC_H */
@@ -0,0 +1,109 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		BenchArena.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Benchmark of the frame arena against mem_alloc.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+// Not part of the library. Build from the directory containing Platform/,
+// add -DMYLLY_ALLOC_TRACKING to compare against the tracked allocator:
+// gcc -O2 -I. Platform/Benchmarks/BenchArena.c Platform/Arena.c Platform/Alloc.c
+//     Platform/Sync.c Platform/Timer.c -lpthread -o bench_arena
+
+#include "Platform/Arena.h"
+#include "Platform/Alloc.h"
+#include "Platform/Timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define FRAME_COUNT			1000
+#define ALLOCS_PER_FRAME	10000		// Short-lived objects per frame
+#define MAX_ALLOC_SIZE		256
+#define ARENA_RESERVE		( 64 * 1024 * 1024 )
+
+static void*	pointers[ALLOCS_PER_FRAME];
+static uint32	sizes[ALLOCS_PER_FRAME];
+
+// Touches the memory so neither allocator gets away with handing out pages
+// that are never used.
+static MYLLY_INLINE void touch( void* ptr, uint32 size )
+{
+	uint8* p = (uint8*)ptr;
+
+	p[0] = (uint8)size;
+	p[size - 1] = (uint8)size;
+}
+
+static uint64 bench_mem_alloc( void )
+{
+	uint64 start = get_time_ns();
+	uint32 frame, i;
+
+	for ( frame = 0; frame < FRAME_COUNT; ++frame )
+	{
+		for ( i = 0; i < ALLOCS_PER_FRAME; ++i )
+		{
+			pointers[i] = mem_alloc( sizes[i] );
+			touch( pointers[i], sizes[i] );
+		}
+
+		for ( i = 0; i < ALLOCS_PER_FRAME; ++i )
+			mem_free( pointers[i] );
+	}
+
+	return get_time_ns() - start;
+}
+
+static uint64 bench_frame_arena( void )
+{
+	frame_arena_t arena;
+	uint64 start, time;
+	uint32 frame, i;
+
+	if ( !frame_arena_init( &arena, ARENA_RESERVE ) ) exit( EXIT_FAILURE );
+
+	start = get_time_ns();
+
+	for ( frame = 0; frame < FRAME_COUNT; ++frame )
+	{
+		frame_arena_begin( &arena );
+
+		for ( i = 0; i < ALLOCS_PER_FRAME; ++i )
+		{
+			pointers[i] = frame_alloc( &arena, sizes[i], 0 );
+			touch( pointers[i], sizes[i] );
+		}
+	}
+
+	time = get_time_ns() - start;
+	frame_arena_release( &arena );
+
+	return time;
+}
+
+static void report( const char* name, uint64 time )
+{
+	printf( "%-12s %10.3f ms %8.2f ns/alloc\n", name, time / 1e6,
+			(double)time / ( (double)FRAME_COUNT * ALLOCS_PER_FRAME ) );
+}
+
+int main( void )
+{
+	uint32 i;
+
+	srand( 1 );
+
+	for ( i = 0; i < ALLOCS_PER_FRAME; ++i )
+		sizes[i] = 1 + (uint32)rand() % MAX_ALLOC_SIZE;
+
+	printf( "%u frames of %u allocations up to %u bytes\n", FRAME_COUNT, ALLOCS_PER_FRAME, MAX_ALLOC_SIZE );
+
+	report( "mem_alloc", bench_mem_alloc() );
+	report( "frame arena", bench_frame_arena() );
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		BenchBackend.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Startup and per-frame latency of the Xlib and XCB backends.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+// Not part of the library. Only uses the portable Window.h API, so the same
+// program is built once per backend and the two are run under Xvfb, e.g.
+// Xvfb :99 & DISPLAY=:99 ./bench_xlib && DISPLAY=:99 ./bench_xcb
+// Build from the directory containing Platform/:
+// gcc -O2 -I. Platform/Benchmarks/BenchBackend.c Platform/Window.c Platform/Queue.c
+//     Platform/Timer.c Platform/Alloc.c Platform/Sync.c -lX11 -lXext -lpthread -o bench_xlib
+// gcc -O2 -DMYLLY_USE_XCB -I. Platform/Benchmarks/BenchBackend.c Platform/Window.c
+//     Platform/WindowXcb.c Platform/Queue.c Platform/Timer.c Platform/Alloc.c
+//     Platform/Sync.c -lxcb -lpthread -o bench_xcb
+
+#include "Platform/Window.h"
+#include "Platform/Timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef MYLLY_USE_XCB
+#define BACKEND_NAME	"XCB"
+#else
+#define BACKEND_NAME	"Xlib"
+#endif
+
+#define WINDOW_COUNT	8			// Windows created for the startup measurement
+#define FRAME_COUNT		1000
+#define WINDOW_SIZE		256
+
+static bool message_callback( void* packet )
+{
+	UNREFERENCED_PARAM( packet );
+	return true;
+}
+
+static void pump( syswindow_t* window )
+{
+	wait_for_events( 0 );
+	process_window_messages( window, NULL );
+}
+
+static void wait_visible( syswindow_t* window )
+{
+	while ( !is_window_visible( window ) )
+	{
+		wait_for_events( 100 );
+		process_window_messages( window, NULL );
+	}
+}
+
+int main( void )
+{
+	syswindow_t* windows[WINDOW_COUNT];
+	window_rect_t rect;
+	uint64 start, first, startup, frames;
+	uint32 i, trips_before, trips;
+	uint32 *pixels, pitch;
+	uint16 width, height;
+	int16 x, y;
+
+	// The first window opens the display connection and looks up the atoms
+	start = get_time_ns();
+	windows[0] = create_system_window( 0, 0, WINDOW_SIZE, WINDOW_SIZE, "Backend benchmark", true, message_callback );
+
+	if ( windows[0] == NULL )
+	{
+		printf( "No X display\n" );
+		return EXIT_FAILURE;
+	}
+
+	wait_visible( windows[0] );
+	first = get_time_ns() - start;
+
+	start = get_time_ns();
+
+	for ( i = 1; i < WINDOW_COUNT; ++i )
+		windows[i] = create_system_window( (int32)i * 16, (int32)i * 16, WINDOW_SIZE, WINDOW_SIZE, "Backend benchmark", true, message_callback );
+
+	for ( i = 1; i < WINDOW_COUNT; ++i )
+		if ( windows[i] ) wait_visible( windows[i] );
+
+	startup = get_time_ns() - start;
+
+	// A frame queries the geometry, draws into the framebuffer and presents
+	// a damaged rectangle, as a typical application would
+	trips_before = get_window_round_trips( windows[0] );
+	start = get_time_ns();
+
+	for ( i = 0; i < FRAME_COUNT; ++i )
+	{
+		get_window_size( windows[0], &width, &height );
+		get_window_pos( windows[0], &x, &y );
+		window_pos_to_screen( windows[0], &x, &y );
+
+		pixels = get_window_framebuffer( windows[0], &width, &height, &pitch );
+		if ( pixels ) pixels[( i % height ) * pitch + i % width] = 0x00FFFFFF;
+
+		rect.x = (int16)( i % width );
+		rect.y = (int16)( i % height );
+		rect.w = 1;
+		rect.h = 1;
+
+		invalidate_window_rect( windows[0], &rect );
+		pump( windows[0] );
+
+		present_window_framebuffer( windows[0], &rect, 1 );
+	}
+
+	frames = get_time_ns() - start;
+	trips = get_window_round_trips( windows[0] ) - trips_before;
+
+	printf( "%-4s first window %8.3f ms, %u more %8.3f ms, frame %8.1f us, %.2f round trips/frame\n",
+			BACKEND_NAME, first / 1e6, WINDOW_COUNT - 1, startup / 1e6,
+			frames / 1e3 / FRAME_COUNT, (double)trips / FRAME_COUNT );
+
+	for ( i = 0; i < WINDOW_COUNT; ++i )
+		if ( windows[i] ) destroy_system_window( windows[i] );
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		BenchEvents.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Synthetic event flood through the batched X11 event pump.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+// Not part of the library, Xlib backend only. Needs an X server without a
+// window manager, e.g. Xvfb :99 & DISPLAY=:99 ./bench_events
+// Build from the directory containing Platform/:
+// gcc -O2 -I. Platform/Benchmarks/BenchEvents.c Platform/Window.c Platform/Queue.c
+//     Platform/Timer.c Platform/Alloc.c Platform/Sync.c -lX11 -lXext -lpthread -o bench_events
+
+#include "Platform/Window.h"
+#include "Platform/Timer.h"
+#include <X11/Xutil.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WINDOW_SIZE			512
+#define FRAME_COUNT			100
+#define MOTION_PER_FRAME	500		// Pointer warps across the window per frame
+#define EXPOSE_PER_FRAME	50		// Small windows mapped and unmapped over ours
+
+static Display*		flooder;		// Second connection generating the events
+static Window		cover;			// Override-redirect window which exposes ours
+static Atom			done_atom;
+static bool			frame_done;
+static uint64		callbacks;		// Calls to the event handler
+static uint64		events;			// Translated events delivered to it
+
+static bool message_callback( void* packet )
+{
+	XEvent* event = (XEvent*)packet;
+
+	if ( event->type == ClientMessage && event->xclient.message_type == done_atom )
+		frame_done = true;
+
+	return true;
+}
+
+static void event_callback( const platform_event_t* list, uint32 count, void* data )
+{
+	UNREFERENCED_PARAM( list );
+	UNREFERENCED_PARAM( data );
+
+	callbacks++;
+	events += count;
+}
+
+static void flood_frame( syswindow_t* window, Window target, uint32 frame )
+{
+	XEvent sentinel;
+	int16 x, y;
+	uint32 i;
+
+	get_window_pos( window, &x, &y );
+
+	for ( i = 0; i < MOTION_PER_FRAME; ++i )
+	{
+		XWarpPointer( flooder, None, DefaultRootWindow( flooder ), 0, 0, 0, 0,
+					  x + (int)( ( i * 7 + frame ) % WINDOW_SIZE ), y + (int)( ( i * 13 ) % WINDOW_SIZE ) );
+	}
+
+	// Unmapping the cover exposes the part of our window it was on
+	for ( i = 0; i < EXPOSE_PER_FRAME; ++i )
+	{
+		XMoveWindow( flooder, cover, x + (int)( ( i * 37 + frame ) % ( WINDOW_SIZE - 32 ) ), y + (int)( ( i * 53 ) % ( WINDOW_SIZE - 32 ) ) );
+		XMapWindow( flooder, cover );
+		XUnmapWindow( flooder, cover );
+	}
+
+	// Everything before the sentinel is queued for us once it arrives
+	memset( &sentinel, 0, sizeof(sentinel) );
+	sentinel.xclient.type = ClientMessage;
+	sentinel.xclient.window = target;
+	sentinel.xclient.message_type = done_atom;
+	sentinel.xclient.format = 32;
+
+	XSendEvent( flooder, target, False, NoEventMask, &sentinel );
+	XSync( flooder, False );
+}
+
+static void run( syswindow_t* window, Window target, bool coalesce )
+{
+	uint64 pump_time = 0, start;
+	uint32 frame;
+
+	set_window_event_coalescing( window, coalesce );
+	callbacks = 0;
+	events = 0;
+
+	for ( frame = 0; frame < FRAME_COUNT; ++frame )
+	{
+		flood_frame( window, target, frame );
+
+		frame_done = false;
+		start = get_time_ns();
+
+		while ( !frame_done )
+		{
+			wait_for_events( 1000 );
+			process_window_messages( window, NULL );
+		}
+
+		pump_time += get_time_ns() - start;
+	}
+
+	printf( "coalescing %-3s %8.1f us/frame, %6.1f events and %5.1f callbacks per frame\n",
+			coalesce ? "on" : "off", pump_time / 1e3 / FRAME_COUNT,
+			(double)events / FRAME_COUNT, (double)callbacks / FRAME_COUNT );
+}
+
+int main( void )
+{
+	XSetWindowAttributes attr;
+	syswindow_t* window;
+	Window target;
+
+	window = create_system_window( 0, 0, WINDOW_SIZE, WINDOW_SIZE, "Event flood", false, message_callback );
+	flooder = XOpenDisplay( NULL );
+
+	if ( window == NULL || flooder == NULL )
+	{
+		printf( "No X display\n" );
+		return EXIT_FAILURE;
+	}
+
+	target = window->window;
+	set_window_event_handler( window, event_callback, NULL );
+
+	while ( !is_window_visible( window ) )
+	{
+		wait_for_events( 100 );
+		process_window_messages( window, NULL );
+	}
+
+	attr.override_redirect = True;
+	cover = XCreateWindow( flooder, DefaultRootWindow( flooder ), 0, 0, 32, 32, 0, CopyFromParent,
+						   InputOutput, CopyFromParent, CWOverrideRedirect, &attr );
+	done_atom = XInternAtom( flooder, "BENCH_FRAME_DONE", False );
+
+	printf( "%u frames of %u pointer motions and %u exposes\n", FRAME_COUNT, MOTION_PER_FRAME, EXPOSE_PER_FRAME );
+
+	run( window, target, false );
+	run( window, target, true );
+
+	XDestroyWindow( flooder, cover );
+	XCloseDisplay( flooder );
+	destroy_system_window( window );
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		BenchJobs.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Benchmark of the job system against a thread per task.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+// Not part of the library. Build from the directory containing Platform/:
+// gcc -O2 -I. Platform/Benchmarks/BenchJobs.c Platform/Jobs.c Platform/Thread.c
+//     Platform/Sync.c Platform/Timer.c Platform/Alloc.c -lpthread -o bench_jobs
+
+#include "Platform/Jobs.h"
+#include "Platform/Thread.h"
+#include "Platform/Timer.h"
+#include "Platform/Atomic.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TASK_COUNT		2000		// Tasks per round
+#define TASK_WORK		2000		// Iterations of busy work per task
+#define ROUNDS			5
+
+static volatile uint64 checksum = 0;
+
+static void do_work( uint32 task )
+{
+	uint32 i, x = task;
+
+	// Cheap xorshift loop standing in for real work
+	for ( i = 0; i < TASK_WORK; ++i )
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+	}
+
+	atomic_fetch_add_64( &checksum, x, MEMORY_ORDER_RELAXED );
+}
+
+static _THREAD_FUNC( task_thread )
+{
+	do_work( (uint32)(size_t)args );
+	return 0;
+}
+
+static void task_job( job_t* job, void* data )
+{
+	UNREFERENCED_PARAM( job );
+	do_work( (uint32)(size_t)data );
+}
+
+static void empty_job( job_t* job, void* data )
+{
+	UNREFERENCED_PARAM( job );
+	UNREFERENCED_PARAM( data );
+}
+
+static void task_range( uint32 start, uint32 end, void* data )
+{
+	UNREFERENCED_PARAM( data );
+
+	for ( ; start < end; ++start )
+		do_work( start );
+}
+
+static uint64 run_threads( void )
+{
+	systhread_t* threads[TASK_COUNT];
+	uint64 start = get_time_ns();
+	uint32 i;
+
+	for ( i = 0; i < TASK_COUNT; ++i )
+		threads[i] = thread_create_ex( task_thread, (void*)(size_t)i, NULL );
+
+	for ( i = 0; i < TASK_COUNT; ++i )
+		if ( threads[i] ) thread_join( threads[i] );
+
+	return get_time_ns() - start;
+}
+
+static uint64 run_jobs( void )
+{
+	job_t *root, *job;
+	uint64 start = get_time_ns();
+	uint32 i;
+
+	root = job_create( empty_job, NULL );
+
+	for ( i = 0; i < TASK_COUNT; ++i )
+	{
+		job = job_create_child( root, task_job, (void*)(size_t)i );
+
+		if ( job != NULL ) job_run( job );
+		else do_work( i );
+	}
+
+	job_run( root );
+	job_wait( root );
+
+	return get_time_ns() - start;
+}
+
+static uint64 run_parallel_for( void )
+{
+	uint64 start = get_time_ns();
+
+	parallel_for( TASK_COUNT, 16, task_range, NULL );
+
+	return get_time_ns() - start;
+}
+
+static void report( const char* name, uint64 (*func)( void ), uint64 expected )
+{
+	uint64 best = ~0ULL, time;
+	uint32 i;
+
+	for ( i = 0; i < ROUNDS; ++i )
+	{
+		checksum = 0;
+		time = func();
+
+		if ( checksum != expected )
+		{
+			printf( "%s: wrong checksum\n", name );
+			exit( EXIT_FAILURE );
+		}
+
+		if ( time < best ) best = time;
+	}
+
+	printf( "%-20s %10.3f ms %10.1f ns/task\n", name, best / 1e6, (double)best / TASK_COUNT );
+}
+
+int main( void )
+{
+	uint64 expected;
+
+	if ( !jobs_init( 0 ) ) return EXIT_FAILURE;
+
+	printf( "%u tasks, %u workers, best of %u rounds\n", TASK_COUNT, jobs_get_worker_count(), ROUNDS );
+
+	checksum = 0;
+	task_range( 0, TASK_COUNT, NULL );
+	expected = checksum;
+
+	report( "thread per task", run_threads, expected );
+	report( "job per task", run_jobs, expected );
+	report( "parallel_for", run_parallel_for, expected );
+
+	jobs_shutdown();
+	return EXIT_SUCCESS;
+}
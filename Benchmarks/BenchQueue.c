@@ -0,0 +1,239 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		BenchQueue.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Throughput and latency benchmark of the SPSC and MPMC queues.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+// Not part of the library. Build from the directory containing Platform/:
+// gcc -O2 -I. Platform/Benchmarks/BenchQueue.c Platform/Queue.c Platform/Sync.c
+//     Platform/Thread.c Platform/Timer.c Platform/Alloc.c -lpthread -o bench_queue
+
+#include "Platform/Queue.h"
+#include "Platform/Sync.h"
+#include "Platform/Thread.h"
+#include "Platform/Timer.h"
+#include "Platform/Atomic.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define QUEUE_CAPACITY		1024
+#define THROUGHPUT_ITEMS	1000000		// Items pushed per producer
+#define LATENCY_ROUNDS		20000		// Round trips for the latency test
+#define MAX_THREADS			4			// Producers and consumers each
+
+static spsc_queue_t*		spsc;
+static spsc_queue_t*		spsc_reply;
+static mpmc_queue_t*		mpmc;
+static volatile uint64		received;
+static volatile uint64		sum;
+
+//////////////////////////////////////////////////////////////////////////
+// Throughput
+//////////////////////////////////////////////////////////////////////////
+
+static _THREAD_FUNC( spsc_consumer )
+{
+	uint64 item, total = 0;
+	uint32 i;
+
+	UNREFERENCED_PARAM( args );
+
+	for ( i = 0; i < THROUGHPUT_ITEMS; ++i )
+	{
+		spsc_queue_pop_wait( spsc, &item, SYNC_INFINITE );
+		total += item;
+	}
+
+	sum = total;
+	return 0;
+}
+
+static _THREAD_FUNC( mpmc_producer )
+{
+	uint64 item;
+	uint32 i;
+
+	UNREFERENCED_PARAM( args );
+
+	for ( i = 0; i < THROUGHPUT_ITEMS; ++i )
+	{
+		item = i;
+		mpmc_queue_push_wait( mpmc, &item, SYNC_INFINITE );
+	}
+
+	return 0;
+}
+
+static _THREAD_FUNC( mpmc_consumer )
+{
+	uint64 item, total = 0, count = 0;
+
+	UNREFERENCED_PARAM( args );
+
+	// A sentinel of ~0 tells the consumer to stop
+	for ( ;; )
+	{
+		mpmc_queue_pop_wait( mpmc, &item, SYNC_INFINITE );
+		if ( item == ~0ULL ) break;
+
+		total += item;
+		count++;
+	}
+
+	atomic_fetch_add_64( &sum, total, MEMORY_ORDER_RELAXED );
+	atomic_fetch_add_64( &received, count, MEMORY_ORDER_RELAXED );
+
+	return 0;
+}
+
+static void bench_spsc_throughput( void )
+{
+	systhread_t* consumer;
+	uint64 start, time, item;
+	uint32 i;
+
+	start = get_time_ns();
+	consumer = thread_create_ex( spsc_consumer, NULL, NULL );
+
+	for ( i = 0; i < THROUGHPUT_ITEMS; ++i )
+	{
+		item = i;
+		spsc_queue_push_wait( spsc, &item, SYNC_INFINITE );
+	}
+
+	thread_join( consumer );
+	time = get_time_ns() - start;
+
+	if ( sum != (uint64)THROUGHPUT_ITEMS * ( THROUGHPUT_ITEMS - 1 ) / 2 )
+	{
+		printf( "spsc: items lost\n" );
+		exit( EXIT_FAILURE );
+	}
+
+	printf( "spsc throughput  1P/1C %8.2f Mitems/s\n", THROUGHPUT_ITEMS * 1e3 / time );
+}
+
+static void bench_mpmc_throughput( uint32 producer_count, uint32 consumer_count )
+{
+	systhread_t *producers[MAX_THREADS], *consumers[MAX_THREADS];
+	uint64 start, time, item = ~0ULL;
+	uint64 total = (uint64)THROUGHPUT_ITEMS * producer_count;
+	uint32 i;
+
+	sum = 0;
+	received = 0;
+	start = get_time_ns();
+
+	for ( i = 0; i < consumer_count; ++i )
+		consumers[i] = thread_create_ex( mpmc_consumer, NULL, NULL );
+
+	for ( i = 0; i < producer_count; ++i )
+		producers[i] = thread_create_ex( mpmc_producer, NULL, NULL );
+
+	for ( i = 0; i < producer_count; ++i )
+		thread_join( producers[i] );
+
+	for ( i = 0; i < consumer_count; ++i )
+		mpmc_queue_push_wait( mpmc, &item, SYNC_INFINITE );
+
+	for ( i = 0; i < consumer_count; ++i )
+		thread_join( consumers[i] );
+
+	time = get_time_ns() - start;
+
+	if ( received != total || sum != producer_count * ( (uint64)THROUGHPUT_ITEMS * ( THROUGHPUT_ITEMS - 1 ) / 2 ) )
+	{
+		printf( "mpmc: items lost\n" );
+		exit( EXIT_FAILURE );
+	}
+
+	printf( "mpmc throughput %uP/%uC %8.2f Mitems/s\n", producer_count, consumer_count, total * 1e3 / time );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Latency
+//////////////////////////////////////////////////////////////////////////
+
+static _THREAD_FUNC( echo_thread )
+{
+	uint64 item;
+	uint32 i;
+
+	UNREFERENCED_PARAM( args );
+
+	for ( i = 0; i < LATENCY_ROUNDS; ++i )
+	{
+		spsc_queue_pop_wait( spsc, &item, SYNC_INFINITE );
+		spsc_queue_push_wait( spsc_reply, &item, SYNC_INFINITE );
+	}
+
+	return 0;
+}
+
+static int compare_u64( const void* a, const void* b )
+{
+	uint64 x = *(const uint64*)a, y = *(const uint64*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void bench_latency( void )
+{
+	static uint64 samples[LATENCY_ROUNDS];
+	systhread_t* echo;
+	uint64 item, start;
+	uint32 i;
+
+	echo = thread_create_ex( echo_thread, NULL, NULL );
+
+	// Round trips through a pair of queues, each side parks when it's empty
+	for ( i = 0; i < LATENCY_ROUNDS; ++i )
+	{
+		start = get_time_ns();
+		item = i;
+
+		spsc_queue_push_wait( spsc, &item, SYNC_INFINITE );
+		spsc_queue_pop_wait( spsc_reply, &item, SYNC_INFINITE );
+
+		samples[i] = get_time_ns() - start;
+	}
+
+	thread_join( echo );
+	qsort( samples, LATENCY_ROUNDS, sizeof(samples[0]), compare_u64 );
+
+	printf( "spsc round trip  p50 %llu ns, p99 %llu ns, max %llu ns\n",
+			(unsigned long long)samples[LATENCY_ROUNDS / 2],
+			(unsigned long long)samples[LATENCY_ROUNDS * 99 / 100],
+			(unsigned long long)samples[LATENCY_ROUNDS - 1] );
+}
+
+int main( void )
+{
+	uint32 producers, consumers;
+
+	spsc = spsc_queue_create( QUEUE_CAPACITY, sizeof(uint64) );
+	spsc_reply = spsc_queue_create( QUEUE_CAPACITY, sizeof(uint64) );
+	mpmc = mpmc_queue_create( QUEUE_CAPACITY, sizeof(uint64) );
+
+	if ( spsc == NULL || spsc_reply == NULL || mpmc == NULL ) return EXIT_FAILURE;
+
+	bench_spsc_throughput();
+
+	for ( producers = 1; producers <= MAX_THREADS; producers *= 2 )
+	{
+		for ( consumers = 1; consumers <= MAX_THREADS; consumers *= 2 )
+			bench_mpmc_throughput( producers, consumers );
+	}
+
+	bench_latency();
+
+	spsc_queue_destroy( spsc );
+	spsc_queue_destroy( spsc_reply );
+	mpmc_queue_destroy( mpmc );
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		BenchSync.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Contention benchmark of Sync.h against pthreads.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+// Not part of the library, POSIX only. Build from the directory containing Platform/:
+// gcc -O2 -I. Platform/Benchmarks/BenchSync.c Platform/Sync.c Platform/Thread.c
+//     Platform/Timer.c -lpthread -o bench_sync
+
+#include "Platform/Sync.h"
+#include "Platform/Thread.h"
+#include "Platform/Timer.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LOCK_ITERATIONS		200000		// Lock/unlock pairs per thread
+#define PINGPONG_ROUNDS		20000		// Hand-offs between two threads
+#define MAX_THREADS			8
+
+typedef enum {
+	LOCK_MUTEX,
+	LOCK_PTHREAD_MUTEX,
+	LOCK_RWLOCK_READ,
+	LOCK_PTHREAD_RWLOCK_READ,
+} LOCK_TYPE;
+
+static const char* lock_names[] = {
+	"mutex",
+	"pthread_mutex",
+	"rwlock (90% reads)",
+	"pthread_rwlock (90% reads)",
+};
+
+static sysmutex_t			mutex;
+static sysrwlock_t			rwlock;
+static pthread_mutex_t		pmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t		prwlock = PTHREAD_RWLOCK_INITIALIZER;
+static LOCK_TYPE			lock_type;
+static volatile uint64		counter;
+
+static _THREAD_FUNC( lock_thread )
+{
+	uint32 i;
+
+	UNREFERENCED_PARAM( args );
+
+	for ( i = 0; i < LOCK_ITERATIONS; ++i )
+	{
+		switch ( lock_type )
+		{
+		case LOCK_MUTEX:
+			mutex_lock( &mutex );
+			counter++;
+			mutex_unlock( &mutex );
+			break;
+
+		case LOCK_PTHREAD_MUTEX:
+			pthread_mutex_lock( &pmutex );
+			counter++;
+			pthread_mutex_unlock( &pmutex );
+			break;
+
+		case LOCK_RWLOCK_READ:
+			if ( i % 10 == 0 ) { rwlock_write_lock( &rwlock ); counter++; rwlock_write_unlock( &rwlock ); }
+			else { rwlock_read_lock( &rwlock ); (void)counter; rwlock_read_unlock( &rwlock ); }
+			break;
+
+		case LOCK_PTHREAD_RWLOCK_READ:
+			if ( i % 10 == 0 ) { pthread_rwlock_wrlock( &prwlock ); counter++; pthread_rwlock_unlock( &prwlock ); }
+			else { pthread_rwlock_rdlock( &prwlock ); (void)counter; pthread_rwlock_unlock( &prwlock ); }
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static void bench_lock( LOCK_TYPE type, uint32 thread_count )
+{
+	systhread_t* threads[MAX_THREADS];
+	uint64 start, time;
+	uint32 i;
+
+	lock_type = type;
+	counter = 0;
+	start = get_time_ns();
+
+	for ( i = 0; i < thread_count; ++i )
+		threads[i] = thread_create_ex( lock_thread, NULL, NULL );
+
+	for ( i = 0; i < thread_count; ++i )
+		thread_join( threads[i] );
+
+	time = get_time_ns() - start;
+
+	// Every thread increments under the lock, or on every tenth op for the rwlocks
+	if ( counter != (uint64)thread_count * ( type <= LOCK_PTHREAD_MUTEX ? LOCK_ITERATIONS : LOCK_ITERATIONS / 10 ) )
+	{
+		printf( "%s: lost updates\n", lock_names[type] );
+		exit( EXIT_FAILURE );
+	}
+
+	printf( "%-28s %u threads %8.1f ns/op\n", lock_names[type], thread_count,
+			(double)time / ( (double)LOCK_ITERATIONS * thread_count ) );
+}
+
+// Two threads take turns through a condition variable, which measures the
+// cost of parking and waking a thread.
+static sysmutex_t			pp_mutex;
+static syscond_t			pp_cond;
+static pthread_cond_t		pp_pcond = PTHREAD_COND_INITIALIZER;
+static volatile uint32		pp_turn;
+static bool					pp_pthread;
+
+static void pingpong_step( uint32 self )
+{
+	if ( pp_pthread )
+	{
+		pthread_mutex_lock( &pmutex );
+		while ( pp_turn != self ) pthread_cond_wait( &pp_pcond, &pmutex );
+		pp_turn = !self;
+		pthread_cond_signal( &pp_pcond );
+		pthread_mutex_unlock( &pmutex );
+	}
+	else
+	{
+		mutex_lock( &pp_mutex );
+		while ( pp_turn != self ) cond_wait( &pp_cond, &pp_mutex, SYNC_INFINITE );
+		pp_turn = !self;
+		cond_signal( &pp_cond );
+		mutex_unlock( &pp_mutex );
+	}
+}
+
+static _THREAD_FUNC( pingpong_thread )
+{
+	uint32 i;
+
+	UNREFERENCED_PARAM( args );
+
+	for ( i = 0; i < PINGPONG_ROUNDS; ++i )
+		pingpong_step( 1 );
+
+	return 0;
+}
+
+static void bench_pingpong( bool pthread )
+{
+	systhread_t* thread;
+	uint64 start, time;
+	uint32 i;
+
+	pp_pthread = pthread;
+	pp_turn = 0;
+	start = get_time_ns();
+
+	thread = thread_create_ex( pingpong_thread, NULL, NULL );
+
+	for ( i = 0; i < PINGPONG_ROUNDS; ++i )
+		pingpong_step( 0 );
+
+	thread_join( thread );
+	time = get_time_ns() - start;
+
+	printf( "%-28s %8.1f ns/hand-off\n", pthread ? "pthread_cond ping-pong" : "cond ping-pong",
+			(double)time / ( 2.0 * PINGPONG_ROUNDS ) );
+}
+
+int main( void )
+{
+	uint32 threads, type;
+
+	mutex_init( &mutex );
+	rwlock_init( &rwlock );
+	mutex_init( &pp_mutex );
+	cond_init( &pp_cond );
+
+	for ( type = LOCK_MUTEX; type <= LOCK_PTHREAD_RWLOCK_READ; ++type )
+	{
+		for ( threads = 1; threads <= MAX_THREADS; threads *= 2 )
+			bench_lock( (LOCK_TYPE)type, threads );
+	}
+
+	bench_pingpong( false );
+	bench_pingpong( true );
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,471 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		Jobs.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Work-stealing job system.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+#include "Platform/Jobs.h"
+#include "Platform/Thread.h"
+#include "Platform/Sync.h"
+#include "Platform/Atomic.h"
+#include "Platform/Alloc.h"
+
+#ifdef _WIN32
+
+//////////////////////////////////////////////////////////////////////////
+// Win32 implementation
+//////////////////////////////////////////////////////////////////////////
+
+#define JOBS_TLS __declspec(thread)
+
+static void cpu_yield( void )			{ SwitchToThread(); }
+
+#else
+
+//////////////////////////////////////////////////////////////////////////
+// POSIX implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include <sched.h>
+
+#define JOBS_TLS __thread
+
+static void cpu_yield( void )			{ sched_yield(); }
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Common implementation
+//////////////////////////////////////////////////////////////////////////
+
+#define MAX_WORKERS			64
+#define DEQUE_SIZE			JOB_POOL_SIZE
+#define DEQUE_MASK			( DEQUE_SIZE - 1 )
+#define SPIN_COUNT			64
+
+typedef struct {
+	parallel_for_func_t	func;
+	void*				data;
+	uint32				start;
+	uint32				end;
+	uint32				batch;
+} parallel_for_t;
+
+struct job_s
+{
+	job_func_t		func;
+	job_t*			parent;
+	void*			data;
+	volatile uint32	unfinished;		// This job plus its unfinished children
+	parallel_for_t	range;			// Storage for parallel_for subranges
+};
+
+// Chase-Lev deque. The owning thread pushes and pops at the bottom, other
+// threads steal from the top.
+typedef struct {
+	volatile uint64	top;
+	uint8			padding1[64 - sizeof(uint64)];
+	volatile uint64	bottom;
+	uint8			padding2[64 - sizeof(uint64)];
+	job_t*			jobs[DEQUE_SIZE];
+} job_deque_t;
+
+typedef struct {
+	job_deque_t		deque;
+	systhread_t*	thread;
+	job_t*			pool;
+	uint32			pool_index;
+	uint32			index;
+	uint32			random;
+} job_worker_t;
+
+static job_worker_t*			workers			= NULL;
+static sysmutex_t				idle_lock;
+static syscond_t				idle_cond;
+static uint32					worker_count	= 0;
+static volatile uint32			sleeping		= 0;
+static volatile uint32			quitting		= false;
+static JOBS_TLS job_worker_t*	current_worker	= NULL;
+
+static bool deque_push( job_deque_t* deque, job_t* job )
+{
+	int64 bottom, top;
+
+	bottom = (int64)atomic_load_64( &deque->bottom, MEMORY_ORDER_RELAXED );
+	top = (int64)atomic_load_64( &deque->top, MEMORY_ORDER_ACQUIRE );
+
+	if ( bottom - top >= DEQUE_SIZE ) return false;
+
+	deque->jobs[bottom & DEQUE_MASK] = job;
+
+	atomic_fence( MEMORY_ORDER_RELEASE );
+	atomic_store_64( &deque->bottom, (uint64)( bottom + 1 ), MEMORY_ORDER_RELAXED );
+
+	return true;
+}
+
+static job_t* deque_pop( job_deque_t* deque )
+{
+	int64 bottom, top;
+	uint64 expected;
+	job_t* job;
+
+	bottom = (int64)atomic_load_64( &deque->bottom, MEMORY_ORDER_RELAXED ) - 1;
+	atomic_store_64( &deque->bottom, (uint64)bottom, MEMORY_ORDER_RELAXED );
+
+	atomic_fence( MEMORY_ORDER_SEQ_CST );
+	top = (int64)atomic_load_64( &deque->top, MEMORY_ORDER_RELAXED );
+
+	if ( top > bottom )
+	{
+		// Empty
+		atomic_store_64( &deque->bottom, (uint64)( bottom + 1 ), MEMORY_ORDER_RELAXED );
+		return NULL;
+	}
+
+	job = deque->jobs[bottom & DEQUE_MASK];
+
+	if ( top == bottom )
+	{
+		// Last job, race against thieves for it
+		expected = (uint64)top;
+
+		if ( !atomic_cas_64( &deque->top, &expected, (uint64)( top + 1 ), MEMORY_ORDER_SEQ_CST ) ) job = NULL;
+		atomic_store_64( &deque->bottom, (uint64)( bottom + 1 ), MEMORY_ORDER_RELAXED );
+	}
+
+	return job;
+}
+
+static job_t* deque_steal( job_deque_t* deque )
+{
+	int64 bottom, top;
+	uint64 expected;
+	job_t* job;
+
+	top = (int64)atomic_load_64( &deque->top, MEMORY_ORDER_ACQUIRE );
+	atomic_fence( MEMORY_ORDER_SEQ_CST );
+	bottom = (int64)atomic_load_64( &deque->bottom, MEMORY_ORDER_ACQUIRE );
+
+	if ( top >= bottom ) return NULL;
+
+	job = deque->jobs[top & DEQUE_MASK];
+
+	expected = (uint64)top;
+	if ( !atomic_cas_64( &deque->top, &expected, (uint64)( top + 1 ), MEMORY_ORDER_SEQ_CST ) ) return NULL;
+
+	return job;
+}
+
+static job_t* get_job( job_worker_t* worker )
+{
+	job_t* job;
+	uint32 i, victim;
+
+	job = deque_pop( &worker->deque );
+	if ( job != NULL ) return job;
+
+	// Own queue is empty, try to steal from a random victim
+	for ( i = 0; i < worker_count; ++i )
+	{
+		worker->random ^= worker->random << 13;
+		worker->random ^= worker->random >> 17;
+		worker->random ^= worker->random << 5;
+
+		victim = worker->random % worker_count;
+		if ( victim == worker->index ) continue;
+
+		job = deque_steal( &workers[victim].deque );
+		if ( job != NULL ) return job;
+	}
+
+	return NULL;
+}
+
+static bool work_available( void )
+{
+	uint32 i;
+
+	for ( i = 0; i < worker_count; ++i )
+	{
+		if ( (int64)atomic_load_64( &workers[i].deque.top, MEMORY_ORDER_ACQUIRE ) <
+			 (int64)atomic_load_64( &workers[i].deque.bottom, MEMORY_ORDER_ACQUIRE ) )
+			return true;
+	}
+
+	return false;
+}
+
+static void job_finish( job_t* job )
+{
+	job_t* parent;
+
+	while ( job != NULL )
+	{
+		// Once finished the slot may be reused, read the parent before that
+		parent = job->parent;
+
+		if ( atomic_fetch_add_32( &job->unfinished, (uint32)-1, MEMORY_ORDER_ACQ_REL ) != 1 ) break;
+
+		// The last child finishing completes the parent as well
+		job = parent;
+	}
+}
+
+static void job_execute( job_t* job )
+{
+	job->func( job, job->data );
+	job_finish( job );
+}
+
+static _THREAD_FUNC( worker_thread )
+{
+	job_worker_t* worker = (job_worker_t*)args;
+	uint32 spins = 0;
+	job_t* job;
+
+	current_worker = worker;
+
+	while ( !atomic_load_32( &quitting, MEMORY_ORDER_ACQUIRE ) )
+	{
+		job = get_job( worker );
+
+		if ( job != NULL )
+		{
+			job_execute( job );
+			spins = 0;
+			continue;
+		}
+
+		if ( ++spins < SPIN_COUNT )
+		{
+			cpu_yield();
+			continue;
+		}
+
+		// Nothing to do for a while, park until new work is submitted. The
+		// sleeper count is published before checking the deques one last time,
+		// job_run does the opposite so a wakeup can't be missed.
+		mutex_lock( &idle_lock );
+		atomic_fetch_add_32( &sleeping, 1, MEMORY_ORDER_SEQ_CST );
+
+		if ( !atomic_load_32( &quitting, MEMORY_ORDER_ACQUIRE ) && !work_available() )
+			cond_wait( &idle_cond, &idle_lock, SYNC_INFINITE );
+
+		atomic_fetch_add_32( &sleeping, (uint32)-1, MEMORY_ORDER_SEQ_CST );
+		mutex_unlock( &idle_lock );
+
+		spins = 0;
+	}
+
+	return 0;
+}
+
+bool jobs_init( uint32 count )
+{
+	thread_attr_t attr;
+	uint32 i, cpus;
+
+	if ( workers != NULL ) return true;
+
+	cpus = get_cpu_count();
+	if ( count == 0 ) count = cpus;
+	if ( count > MAX_WORKERS ) count = MAX_WORKERS;
+
+	// Worker 0 is the calling thread, it only executes jobs while waiting
+	workers = (job_worker_t*)mem_alloc_clean( count * sizeof(job_worker_t) );
+	worker_count = count;
+	quitting = false;
+
+	mutex_init( &idle_lock );
+	cond_init( &idle_cond );
+
+	for ( i = 0; i < count; ++i )
+	{
+		workers[i].pool = (job_t*)mem_alloc_clean( JOB_POOL_SIZE * sizeof(job_t) );
+		workers[i].index = i;
+		workers[i].random = 2463534242u + i * 7919;
+	}
+
+	current_worker = &workers[0];
+
+	memset( &attr, 0, sizeof(attr) );
+	attr.name = "Job worker";
+	attr.priority = THREAD_PRIO_NORMAL;
+
+	for ( i = 1; i < count; ++i )
+	{
+		// Pin each worker to its own core
+		attr.affinity = ( i % cpus ) < 64 ? 1ULL << ( i % cpus ) : 0;
+		workers[i].thread = thread_create_ex( worker_thread, &workers[i], &attr );
+	}
+
+	return true;
+}
+
+void jobs_shutdown( void )
+{
+	uint32 i;
+
+	if ( workers == NULL ) return;
+
+	mutex_lock( &idle_lock );
+	atomic_store_32( &quitting, true, MEMORY_ORDER_RELEASE );
+	cond_broadcast( &idle_cond );
+	mutex_unlock( &idle_lock );
+
+	for ( i = 1; i < worker_count; ++i )
+		thread_join( workers[i].thread );
+
+	for ( i = 0; i < worker_count; ++i )
+		mem_free( workers[i].pool );
+
+	mem_free( workers );
+
+	workers = NULL;
+	worker_count = 0;
+	current_worker = NULL;
+}
+
+uint32 jobs_get_worker_count( void )
+{
+	return worker_count;
+}
+
+job_t* job_create( job_func_t func, void* data )
+{
+	return job_create_child( NULL, func, data );
+}
+
+job_t* job_create_child( job_t* parent, job_func_t func, void* data )
+{
+	job_worker_t* worker = current_worker;
+	job_t* job;
+
+	assert( worker != NULL );
+	if ( worker == NULL ) return NULL;
+
+	job = &worker->pool[worker->pool_index & ( JOB_POOL_SIZE - 1 )];
+
+	// The ring has wrapped around to a job still in flight. Waiting for it
+	// could deadlock if it's an ancestor of the caller, so the caller runs
+	// the work inline instead.
+	if ( atomic_load_32( &job->unfinished, MEMORY_ORDER_ACQUIRE ) != 0 ) return NULL;
+
+	worker->pool_index++;
+
+	if ( parent != NULL ) atomic_fetch_add_32( &parent->unfinished, 1, MEMORY_ORDER_RELAXED );
+
+	job->func = func;
+	job->parent = parent;
+	job->unfinished = 1;
+	job->data = data;
+
+	return job;
+}
+
+void job_run( job_t* job )
+{
+	job_worker_t* worker = current_worker;
+
+	if ( job == NULL ) return;
+
+	assert( worker != NULL );
+
+	if ( worker == NULL || !deque_push( &worker->deque, job ) )
+	{
+		// The deque is full, run the job inline instead
+		job_execute( job );
+		return;
+	}
+
+	atomic_fence( MEMORY_ORDER_SEQ_CST );
+
+	if ( atomic_load_32( &sleeping, MEMORY_ORDER_RELAXED ) > 0 )
+	{
+		mutex_lock( &idle_lock );
+		cond_signal( &idle_cond );
+		mutex_unlock( &idle_lock );
+	}
+}
+
+void job_wait( job_t* job )
+{
+	job_worker_t* worker = current_worker;
+	job_t* other;
+
+	if ( job == NULL ) return;
+
+	// Help out with other jobs while the job is unfinished
+	while ( atomic_load_32( &job->unfinished, MEMORY_ORDER_ACQUIRE ) != 0 )
+	{
+		other = worker ? get_job( worker ) : NULL;
+
+		if ( other != NULL )
+			job_execute( other );
+		else
+			cpu_yield();
+	}
+}
+
+bool job_is_finished( job_t* job )
+{
+	return job == NULL || atomic_load_32( &job->unfinished, MEMORY_ORDER_ACQUIRE ) == 0;
+}
+
+static void parallel_for_job( job_t* job, void* data )
+{
+	parallel_for_t* range = (parallel_for_t*)data;
+	job_t* child;
+	uint32 middle;
+
+	// Split the range recursively so idle workers steal large chunks
+	// instead of individual batches.
+	while ( range->end - range->start > range->batch )
+	{
+		middle = range->start + ( range->end - range->start ) / 2;
+
+		child = job_create_child( job, parallel_for_job, NULL );
+		if ( child == NULL ) break;
+
+		child->range = *range;
+		child->range.start = middle;
+		child->data = &child->range;
+
+		range->end = middle;
+		job_run( child );
+	}
+
+	range->func( range->start, range->end, range->data );
+}
+
+void parallel_for( uint32 count, uint32 batch, parallel_for_func_t func, void* data )
+{
+	parallel_for_t range;
+	job_t* root;
+
+	if ( count == 0 || func == NULL ) return;
+	if ( batch == 0 ) batch = 1;
+
+	range.func = func;
+	range.data = data;
+	range.start = 0;
+	range.end = count;
+	range.batch = batch;
+
+	root = job_create( parallel_for_job, &range );
+
+	if ( root == NULL )
+	{
+		func( 0, count, data );
+		return;
+	}
+
+	job_run( root );
+	job_wait( root );
+}
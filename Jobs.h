@@ -0,0 +1,47 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		Jobs.h
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Work-stealing job system.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+#pragma once
+#ifndef __LIB_PLATFORM_JOBS_H
+#define __LIB_PLATFORM_JOBS_H
+
+#include "stdtypes.h"
+
+// Jobs are allocated from a per-thread ring of JOB_POOL_SIZE entries and are
+// recycled without being freed once they have finished. When a thread has
+// that many jobs in flight job_create returns NULL and the work should be run
+// inline. Jobs may only be created and run from the thread which called
+// jobs_init or from inside other jobs.
+
+#define JOB_POOL_SIZE	4096
+
+typedef struct job_s job_t;
+
+typedef void ( *job_func_t )( job_t* job, void* data );
+typedef void ( *parallel_for_func_t )( uint32 start, uint32 end, void* data );
+
+__BEGIN_DECLS
+
+MYLLY_API bool		jobs_init				( uint32 workers );
+MYLLY_API void		jobs_shutdown			( void );
+MYLLY_API uint32	jobs_get_worker_count	( void );
+
+MYLLY_API job_t*	job_create				( job_func_t func, void* data );
+MYLLY_API job_t*	job_create_child		( job_t* parent, job_func_t func, void* data );
+MYLLY_API void		job_run					( job_t* job );
+MYLLY_API void		job_wait				( job_t* job );
+MYLLY_API bool		job_is_finished			( job_t* job );
+
+MYLLY_API void		parallel_for			( uint32 count, uint32 batch, parallel_for_func_t func, void* data );
+
+__END_DECLS
+
+#endif /* __LIB_PLATFORM_JOBS_H */
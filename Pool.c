@@ -0,0 +1,345 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		Pool.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Fixed-size object pool allocator.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+#include "Platform/Pool.h"
+#include "Platform/Sync.h"
+#include "Platform/Atomic.h"
+#include "Platform/Alloc.h"
+
+#ifdef _WIN32
+#define POOL_TLS __declspec(thread)
+#else
+#define POOL_TLS __thread
+#endif
+
+#define SLAB_MIN_OBJECTS	8		// Slabs are one page unless objects are large
+#define CACHE_BATCH			32		// Upper limit for objects moved between a thread cache and the pool
+
+typedef struct free_object_s
+{
+	struct free_object_s*	next;
+} free_object_t;
+
+typedef struct slab_s
+{
+	struct slab_s*	next;
+} slab_t;
+
+// Slab headers are padded so that objects stay 16 byte aligned
+#define SLAB_HEADER_SIZE	( ( sizeof(slab_t) + 15 ) & ~15 )
+
+struct pool_s
+{
+	uint32			id;				// Index to the thread cache table
+	uint32			generation;		// Invalidates thread caches on pool_free_all
+	size_t			object_size;
+	size_t			slab_size;
+	uint32			slab_objects;
+	uint32			batch;			// Objects moved to or from a thread cache at once
+
+	sysmutex_t		lock;
+	free_object_t*	free_list;
+	uint32			free_count;
+	slab_t*			slabs;
+	uint32			slab_count;
+	uint32			peak;
+};
+
+typedef struct {
+	free_object_t*	head;
+	uint32			count;
+	uint32			generation;
+} pool_cache_t;
+
+static pool_t*						pools[POOL_MAX_POOLS];
+static sysmutex_t					pools_lock;
+static volatile uint32				pool_generation		= 0;
+static POOL_TLS pool_cache_t		thread_caches[POOL_MAX_POOLS];
+
+static const size_t size_classes[] = { 16, 32, 48, 64, 96, 128, 192, 256, 384, 512 };
+static pool_t* size_class_pools[sizeof(size_classes)/sizeof(size_classes[0])];
+
+static void pool_add_slab( pool_t* pool )
+{
+	slab_t* slab;
+	uint8* object;
+	uint32 i;
+
+	// Slabs are whole pages, aligned so that none straddles a page boundary
+	slab = (slab_t*)mem_alloc_aligned( pool->slab_size, mem_page_size() );
+	slab->next = pool->slabs;
+
+	pool->slabs = slab;
+	pool->slab_count++;
+
+	// Thread the new objects onto the free list
+	object = (uint8*)slab + SLAB_HEADER_SIZE;
+
+	for ( i = 0; i < pool->slab_objects; ++i, object += pool->object_size )
+	{
+		((free_object_t*)object)->next = pool->free_list;
+		pool->free_list = (free_object_t*)object;
+	}
+
+	pool->free_count += pool->slab_objects;
+}
+
+static MYLLY_INLINE uint32 pool_in_use( pool_t* pool )
+{
+	return pool->slab_count * pool->slab_objects - pool->free_count;
+}
+
+static MYLLY_INLINE pool_cache_t* pool_get_cache( pool_t* pool )
+{
+	pool_cache_t* cache = &thread_caches[pool->id];
+
+	if ( cache->generation != pool->generation )
+	{
+		// The cache belongs to a destroyed pool or predates pool_free_all
+		cache->head = NULL;
+		cache->count = 0;
+		cache->generation = pool->generation;
+	}
+
+	return cache;
+}
+
+pool_t* pool_create( size_t object_size )
+{
+	pool_t* pool;
+	uint32 id;
+
+	mutex_lock( &pools_lock );
+
+	for ( id = 0; id < POOL_MAX_POOLS; ++id )
+	{
+		if ( pools[id] == NULL ) break;
+	}
+
+	if ( id == POOL_MAX_POOLS )
+	{
+		mutex_unlock( &pools_lock );
+		return NULL;
+	}
+
+	pool = (pool_t*)mem_alloc_clean( sizeof(*pool) );
+	pools[id] = pool;
+
+	mutex_unlock( &pools_lock );
+
+	// Objects must be able to hold the free list link and are kept aligned
+	if ( object_size < sizeof(free_object_t) ) object_size = sizeof(free_object_t);
+	object_size = ( object_size + sizeof(void*) - 1 ) & ~( sizeof(void*) - 1 );
+	if ( object_size >= 16 ) object_size = ( object_size + 15 ) & ~(size_t)15;
+
+	pool->id = id;
+	pool->generation = atomic_fetch_add_32( &pool_generation, 1, MEMORY_ORDER_RELAXED ) + 1;
+	pool->object_size = object_size;
+	pool->slab_size = mem_page_size();
+
+	while ( ( pool->slab_size - SLAB_HEADER_SIZE ) / object_size < SLAB_MIN_OBJECTS )
+		pool->slab_size *= 2;
+
+	pool->slab_objects = (uint32)( ( pool->slab_size - SLAB_HEADER_SIZE ) / object_size );
+	pool->batch = pool->slab_objects < CACHE_BATCH ? pool->slab_objects : CACHE_BATCH;
+
+	mutex_init( &pool->lock );
+	return pool;
+}
+
+static void pool_free_slabs( pool_t* pool )
+{
+	slab_t *slab, *next;
+
+	for ( slab = pool->slabs; slab != NULL; slab = next )
+	{
+		next = slab->next;
+		mem_free_aligned( slab );
+	}
+
+	pool->slabs = NULL;
+	pool->slab_count = 0;
+	pool->free_list = NULL;
+	pool->free_count = 0;
+}
+
+void pool_destroy( pool_t* pool )
+{
+	uint32 i;
+
+	if ( pool == NULL ) return;
+
+	pool_free_slabs( pool );
+
+	mutex_lock( &pools_lock );
+
+	pools[pool->id] = NULL;
+
+	for ( i = 0; i < sizeof(size_classes)/sizeof(size_classes[0]); ++i )
+	{
+		if ( size_class_pools[i] == pool ) size_class_pools[i] = NULL;
+	}
+
+	mutex_unlock( &pools_lock );
+
+	mem_free( pool );
+}
+
+pool_t* pool_for_size( size_t size )
+{
+	pool_t *pool, *expected;
+	uint32 i;
+
+	for ( i = 0; i < sizeof(size_classes)/sizeof(size_classes[0]); ++i )
+	{
+		if ( size > size_classes[i] ) continue;
+
+		pool = (pool_t*)atomic_load_ptr( (void* volatile*)&size_class_pools[i], MEMORY_ORDER_ACQUIRE );
+		if ( pool ) return pool;
+
+		// Create the size class pool on first use
+		pool = pool_create( size_classes[i] );
+		if ( pool == NULL ) return NULL;
+
+		// Another thread may have beaten us to it
+		expected = NULL;
+
+		if ( !atomic_cas_ptr( (void* volatile*)&size_class_pools[i], (void**)&expected, pool, MEMORY_ORDER_ACQ_REL ) )
+		{
+			pool_destroy( pool );
+			pool = expected;
+		}
+
+		return pool;
+	}
+
+	return NULL;
+}
+
+void* pool_alloc( pool_t* pool )
+{
+	pool_cache_t* cache = pool_get_cache( pool );
+	free_object_t* object;
+	uint32 i, in_use;
+
+	if ( cache->head == NULL )
+	{
+		// Refill the cache with a batch of objects from the pool
+		mutex_lock( &pool->lock );
+
+		for ( i = 0; i < pool->batch; ++i )
+		{
+			if ( pool->free_list == NULL ) pool_add_slab( pool );
+
+			object = pool->free_list;
+			pool->free_list = object->next;
+			pool->free_count--;
+
+			object->next = cache->head;
+			cache->head = object;
+		}
+
+		cache->count += pool->batch;
+
+		in_use = pool_in_use( pool );
+		if ( in_use > pool->peak ) pool->peak = in_use;
+
+		mutex_unlock( &pool->lock );
+	}
+
+	object = cache->head;
+	cache->head = object->next;
+	cache->count--;
+
+	return object;
+}
+
+void pool_free( pool_t* pool, void* ptr )
+{
+	pool_cache_t* cache;
+	free_object_t *object, *last;
+	uint32 i;
+
+	if ( ptr == NULL ) return;
+
+	cache = pool_get_cache( pool );
+	object = (free_object_t*)ptr;
+
+	object->next = cache->head;
+	cache->head = object;
+	cache->count++;
+
+	if ( cache->count < 2 * pool->batch ) return;
+
+	// The cache is full, return a batch to the pool
+	last = cache->head;
+	for ( i = 1; i < pool->batch; ++i ) last = last->next;
+
+	mutex_lock( &pool->lock );
+
+	object = cache->head;
+	cache->head = last->next;
+
+	last->next = pool->free_list;
+	pool->free_list = object;
+	pool->free_count += pool->batch;
+
+	mutex_unlock( &pool->lock );
+
+	cache->count -= pool->batch;
+}
+
+void pool_free_all( pool_t* pool )
+{
+	slab_t* slab;
+	uint8* object;
+	uint32 i;
+
+	if ( pool == NULL ) return;
+
+	mutex_lock( &pool->lock );
+
+	// Keep the slabs around but mark every object as free. Changing the
+	// generation discards whatever the thread caches are holding.
+	pool->generation = atomic_fetch_add_32( &pool_generation, 1, MEMORY_ORDER_RELAXED ) + 1;
+	pool->free_list = NULL;
+	pool->free_count = 0;
+
+	for ( slab = pool->slabs; slab != NULL; slab = slab->next )
+	{
+		object = (uint8*)slab + SLAB_HEADER_SIZE;
+
+		for ( i = 0; i < pool->slab_objects; ++i, object += pool->object_size )
+		{
+			((free_object_t*)object)->next = pool->free_list;
+			pool->free_list = (free_object_t*)object;
+		}
+
+		pool->free_count += pool->slab_objects;
+	}
+
+	mutex_unlock( &pool->lock );
+}
+
+void pool_get_stats( pool_t* pool, pool_stats_t* stats )
+{
+	if ( pool == NULL || stats == NULL ) return;
+
+	mutex_lock( &pool->lock );
+
+	stats->object_size = pool->object_size;
+	stats->slabs = pool->slab_count;
+	stats->capacity = pool->slab_count * pool->slab_objects;
+	stats->in_use = pool_in_use( pool );
+	stats->peak = pool->peak;
+
+	mutex_unlock( &pool->lock );
+}
@@ -0,0 +1,52 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		Pool.h
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Fixed-size object pool allocator.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+#pragma once
+#ifndef __LIB_PLATFORM_POOL_H
+#define __LIB_PLATFORM_POOL_H
+
+#include "stdtypes.h"
+
+// Pools hand out fixed-size objects carved from page-sized slabs. Each thread
+// keeps a small cache of free objects per pool, so allocation and release only
+// take the pool lock when a cache needs to be refilled or drained.
+//
+// Objects cached by a thread which exits are not returned to the pool until
+// pool_free_all is called. pool_free_all and pool_destroy must not run
+// concurrently with other operations on the same pool.
+
+#define POOL_MAX_POOLS		64
+
+typedef struct pool_s pool_t;
+
+typedef struct {
+	size_t		object_size;	// Size of a single object including padding
+	uint32		slabs;			// Number of slabs allocated
+	uint32		capacity;		// Number of objects the slabs can hold
+	uint32		in_use;			// Objects allocated or held in thread caches
+	uint32		peak;			// Highest in_use count
+} pool_stats_t;
+
+__BEGIN_DECLS
+
+MYLLY_API pool_t*	pool_create				( size_t object_size );
+MYLLY_API void		pool_destroy			( pool_t* pool );
+MYLLY_API pool_t*	pool_for_size			( size_t size );
+
+MYLLY_API void*		pool_alloc				( pool_t* pool );
+MYLLY_API void		pool_free				( pool_t* pool, void* ptr );
+MYLLY_API void		pool_free_all			( pool_t* pool );
+
+MYLLY_API void		pool_get_stats			( pool_t* pool, pool_stats_t* stats );
+
+__END_DECLS
+
+#endif /* __LIB_PLATFORM_POOL_H */
@@ -0,0 +1,379 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		Profiler.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Lightweight instrumentation profiler with trace output.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+#include "Platform/Profiler.h"
+#include "Platform/Timer.h"
+#include "Platform/Atomic.h"
+#include "Platform/Alloc.h"
+#include <stdio.h>
+
+#ifdef _WIN32
+#define PROFILER_TLS __declspec(thread)
+#else
+#define PROFILER_TLS __thread
+#endif
+
+#define DEFAULT_EVENTS_PER_THREAD	65536
+#define FLUSH_CHUNK					256
+#define OVERHEAD_SAMPLES			10000
+
+typedef enum {
+	EVENT_ZONE_BEGIN,
+	EVENT_ZONE_END,
+	EVENT_COUNTER,
+	EVENT_FRAME,
+} EVENT_TYPE;
+
+typedef struct {
+	uint64			time;
+	const char*		name;
+	int64			value;
+	uint32			type;
+} profiler_event_t;
+
+struct profiler_thread_s
+{
+	struct profiler_thread_s*	next;
+	profiler_event_t*			events;
+	uint64						mask;		// Capacity - 1, capacity is a power of two
+	volatile uint64				head;		// Next write position, only written by the owner
+	uint64						tail;		// Next read position, only touched by the flusher
+	uint32						id;
+	uint32						depth;		// Current zone nesting depth
+	const char*					name;
+	bool						name_written;
+};
+
+volatile bool							profiler_active		= false;
+
+static struct profiler_thread_s* volatile	thread_list			= NULL;
+static PROFILER_TLS struct profiler_thread_s* thread_buffer		= NULL;
+static PROFILER_TLS uint32				thread_generation	= 0;	// Generation thread_buffer was allocated in
+static volatile uint32					generation			= 0;	// Bumped when the buffers are freed
+static volatile uint32					thread_counter		= 0;
+static uint64							buffer_capacity		= DEFAULT_EVENTS_PER_THREAD;
+static uint64							time_base			= 0;
+static volatile uint64					frame_index			= 0;
+static uint32							events_lost			= 0;
+static FILE*							trace_file			= NULL;
+static bool								trace_first			= true;
+
+static struct profiler_thread_s* profiler_get_thread( void )
+{
+	struct profiler_thread_s* buffer = thread_buffer;
+	uint32 current = atomic_load_32( &generation, MEMORY_ORDER_ACQUIRE );
+
+	// A buffer from before the last shutdown has been freed already
+	if ( buffer != NULL && thread_generation == current ) return buffer;
+
+	// First event on this thread, preallocate the ring buffer and publish it
+	// to the flusher with a lock-free push.
+	buffer = (struct profiler_thread_s*)mem_alloc_clean( sizeof(*buffer) );
+	buffer->events = (profiler_event_t*)mem_alloc( (size_t)buffer_capacity * sizeof(profiler_event_t) );
+	buffer->mask = buffer_capacity - 1;
+	buffer->id = atomic_fetch_add_32( &thread_counter, 1, MEMORY_ORDER_RELAXED ) + 1;
+	buffer->next = (struct profiler_thread_s*)atomic_load_ptr( (void* volatile*)&thread_list, MEMORY_ORDER_RELAXED );
+
+	while ( !atomic_cas_ptr( (void* volatile*)&thread_list, (void**)&buffer->next, buffer, MEMORY_ORDER_RELEASE ) ) {}
+
+	thread_buffer = buffer;
+	thread_generation = current;
+
+	return buffer;
+}
+
+static MYLLY_INLINE void profiler_record( EVENT_TYPE type, const char* name, int64 value )
+{
+	struct profiler_thread_s* buffer = profiler_get_thread();
+	profiler_event_t* event;
+	uint64 head = buffer->head;
+
+	event = &buffer->events[head & buffer->mask];
+
+	event->time = get_time_ns_fast();
+	event->name = name;
+	event->value = value;
+	event->type = type;
+
+	// Publish the event. When the ring is full the oldest events are
+	// overwritten, the flusher detects this and skips them.
+	atomic_store_64( &buffer->head, head + 1, MEMORY_ORDER_RELEASE );
+}
+
+bool profiler_init( const char* file, uint32 events_per_thread )
+{
+	uint64 capacity = 1;
+
+	if ( trace_file != NULL ) return true;
+	if ( file == NULL ) return false;
+
+	trace_file = fopen( file, "w" );
+	if ( trace_file == NULL ) return false;
+
+	if ( events_per_thread == 0 ) events_per_thread = DEFAULT_EVENTS_PER_THREAD;
+	while ( capacity < events_per_thread ) capacity <<= 1;
+
+	buffer_capacity = capacity;
+	trace_first = true;
+	events_lost = 0;
+	frame_index = 0;
+
+	time_calibrate_tsc();
+	time_base = get_time_ns_fast();
+
+	// The JSON array format doesn't require the closing bracket, so the
+	// trace remains loadable even if the application crashes.
+	fputs( "[\n", trace_file );
+
+	profiler_active = true;
+	return true;
+}
+
+void profiler_shutdown( void )
+{
+	struct profiler_thread_s *buffer, *next;
+
+	if ( trace_file == NULL ) return;
+
+	profiler_active = false;
+	profiler_flush();
+
+	fputs( "\n]\n", trace_file );
+	fclose( trace_file );
+	trace_file = NULL;
+
+	// Other threads must have stopped recording by now. Their thread local
+	// buffer pointers are left dangling, the generation tells them apart.
+	atomic_fetch_add_32( &generation, 1, MEMORY_ORDER_RELEASE );
+
+	for ( buffer = thread_list; buffer != NULL; buffer = next )
+	{
+		next = buffer->next;
+
+		mem_free( buffer->events );
+		mem_free( buffer );
+	}
+
+	thread_list = NULL;
+	thread_buffer = NULL;
+}
+
+void profiler_enable( bool enable )
+{
+	profiler_active = ( enable && trace_file != NULL );
+}
+
+static void profiler_write_string( const char* str )
+{
+	// Names are given by the application, quotes, backslashes and control
+	// characters would break the JSON
+	for ( ; *str; ++str )
+	{
+		if ( *str == '"' || *str == '\\' )
+		{
+			fputc( '\\', trace_file );
+			fputc( *str, trace_file );
+		}
+		else if ( (uint8)*str < 0x20 )
+		{
+			fprintf( trace_file, "\\u%04x", (uint8)*str );
+		}
+		else
+		{
+			fputc( *str, trace_file );
+		}
+	}
+}
+
+static void profiler_write_event( const struct profiler_thread_s* buffer, const profiler_event_t* event )
+{
+	double ts;
+
+	ts = (double)(int64)( event->time - time_base ) / 1000.0;
+
+	fputs( trace_first ? "" : ",\n", trace_file );
+	trace_first = false;
+
+	switch ( event->type )
+	{
+	case EVENT_ZONE_BEGIN:
+		fputs( "{\"name\":\"", trace_file );
+		profiler_write_string( event->name );
+		fprintf( trace_file, "\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", ts, buffer->id );
+		break;
+
+	case EVENT_ZONE_END:
+		fprintf( trace_file, "{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+				 ts, buffer->id );
+		break;
+
+	case EVENT_COUNTER:
+		fputs( "{\"name\":\"", trace_file );
+		profiler_write_string( event->name );
+		fprintf( trace_file, "\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"value\":%lld}}",
+				 ts, buffer->id, (long long)event->value );
+		break;
+
+	case EVENT_FRAME:
+		fprintf( trace_file, "{\"name\":\"Frame %lld\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+				 (long long)event->value, ts, buffer->id );
+		break;
+	}
+}
+
+uint32 profiler_flush( void )
+{
+	struct profiler_thread_s* buffer;
+	profiler_event_t chunk[FLUSH_CHUNK];
+	uint64 head, start, count, oldest, i;
+	uint32 written = 0;
+
+	if ( trace_file == NULL ) return 0;
+
+	for ( buffer = (struct profiler_thread_s*)atomic_load_ptr( (void* volatile*)&thread_list, MEMORY_ORDER_ACQUIRE ); buffer != NULL; buffer = buffer->next )
+	{
+		if ( buffer->name && !buffer->name_written )
+		{
+			fprintf( trace_file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"",
+					 trace_first ? "" : ",\n", buffer->id );
+
+			profiler_write_string( buffer->name );
+			fputs( "\"}}", trace_file );
+
+			trace_first = false;
+			buffer->name_written = true;
+		}
+
+		head = atomic_load_64( &buffer->head, MEMORY_ORDER_ACQUIRE );
+
+		while ( buffer->tail < head )
+		{
+			// Skip anything the writer has already lapped
+			if ( head - buffer->tail > buffer->mask + 1 )
+			{
+				events_lost += (uint32)( head - buffer->tail - ( buffer->mask + 1 ) );
+				buffer->tail = head - ( buffer->mask + 1 );
+			}
+
+			start = buffer->tail;
+			count = head - start;
+			if ( count > FLUSH_CHUNK ) count = FLUSH_CHUNK;
+
+			for ( i = 0; i < count; ++i )
+				chunk[i] = buffer->events[( start + i ) & buffer->mask];
+
+			// Validate the copy against the writer position, any slot which may
+			// have been overwritten while copying is discarded.
+			atomic_fence( MEMORY_ORDER_ACQUIRE );
+			oldest = atomic_load_64( &buffer->head, MEMORY_ORDER_RELAXED );
+			oldest = oldest > buffer->mask + 1 ? oldest - ( buffer->mask + 1 ) : 0;
+
+			for ( i = 0; i < count; ++i )
+			{
+				if ( start + i < oldest )
+				{
+					events_lost++;
+					continue;
+				}
+
+				profiler_write_event( buffer, &chunk[i] );
+				written++;
+			}
+
+			buffer->tail = start + count;
+		}
+	}
+
+	if ( events_lost )
+	{
+		fprintf( trace_file, "%s{\"name\":\"Lost events\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{\"value\":%u}}",
+				 trace_first ? "" : ",\n", (double)(int64)( get_time_ns_fast() - time_base ) / 1000.0, events_lost );
+
+		trace_first = false;
+	}
+
+	fflush( trace_file );
+	return written;
+}
+
+void profiler_set_thread_name( const char* name )
+{
+	struct profiler_thread_s* buffer = profiler_get_thread();
+
+	buffer->name = name;
+	buffer->name_written = false;
+}
+
+void profiler_zone_begin( const char* name )
+{
+	profiler_get_thread()->depth++;
+	profiler_record( EVENT_ZONE_BEGIN, name, 0 );
+}
+
+void profiler_zone_end( void )
+{
+	struct profiler_thread_s* buffer = profiler_get_thread();
+
+	// Ignore ends without a matching begin, e.g. when the profiler was
+	// enabled while inside a zone.
+	if ( buffer->depth == 0 ) return;
+
+	buffer->depth--;
+	profiler_record( EVENT_ZONE_END, NULL, 0 );
+}
+
+void profiler_counter( const char* name, int64 value )
+{
+	profiler_record( EVENT_COUNTER, name, value );
+}
+
+void profiler_frame( void )
+{
+	// Frames may be marked from any thread
+	profiler_record( EVENT_FRAME, NULL, (int64)atomic_fetch_add_64( &frame_index, 1, MEMORY_ORDER_RELAXED ) );
+}
+
+uint64 profiler_measure_overhead( void )
+{
+	struct profiler_thread_s* buffer;
+	uint64 start, end, head, overwritten;
+	uint32 i;
+
+	buffer = profiler_get_thread();
+	head = buffer->head;
+
+	start = get_time_ns();
+
+	for ( i = 0; i < OVERHEAD_SAMPLES; ++i )
+	{
+		profiler_zone_begin( "overhead" );
+		profiler_zone_end();
+	}
+
+	end = get_time_ns();
+
+	// Discard the measurement events. Unflushed events they overwrote are
+	// skipped and counted as lost, as rewinding the head hides the overrun
+	// from profiler_flush. This must not run concurrently with it.
+	overwritten = head + 2 * OVERHEAD_SAMPLES - ( buffer->mask + 1 );
+
+	if ( head + 2 * OVERHEAD_SAMPLES > buffer->mask + 1 && overwritten > buffer->tail )
+	{
+		if ( overwritten > head ) overwritten = head;
+
+		events_lost += (uint32)( overwritten - buffer->tail );
+		buffer->tail = overwritten;
+	}
+
+	atomic_store_64( &buffer->head, head, MEMORY_ORDER_RELEASE );
+
+	return ( end - start ) / OVERHEAD_SAMPLES;
+}
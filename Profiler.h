@@ -0,0 +1,70 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		Profiler.h
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Lightweight instrumentation profiler with trace output.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+#pragma once
+#ifndef __LIB_PLATFORM_PROFILER_H
+#define __LIB_PLATFORM_PROFILER_H
+
+#include "stdtypes.h"
+
+// Zone names are stored by pointer and must remain valid until the next
+// flush, string literals are recommended.
+//
+// The profiling macros compile to nothing unless MYLLY_PROFILER is defined.
+// When compiled in, a disabled profiler costs one load and a branch per macro.
+
+__BEGIN_DECLS
+
+extern volatile bool			profiler_active;
+
+MYLLY_API bool		profiler_init				( const char* file, uint32 events_per_thread );
+MYLLY_API void		profiler_shutdown			( void );
+MYLLY_API void		profiler_enable				( bool enable );
+MYLLY_API uint32	profiler_flush				( void );
+
+MYLLY_API void		profiler_set_thread_name	( const char* name );
+MYLLY_API void		profiler_zone_begin			( const char* name );
+MYLLY_API void		profiler_zone_end			( void );
+MYLLY_API void		profiler_counter			( const char* name, int64 value );
+MYLLY_API void		profiler_frame				( void );
+
+MYLLY_API uint64	profiler_measure_overhead	( void );
+
+__END_DECLS
+
+#ifdef MYLLY_PROFILER
+
+#define PROFILE_ZONE_BEGIN( name ) \
+	do { if ( profiler_active ) profiler_zone_begin( name ); } while ( 0 )
+
+#define PROFILE_ZONE_END() \
+	do { if ( profiler_active ) profiler_zone_end(); } while ( 0 )
+
+#define PROFILE_COUNTER( name, value ) \
+	do { if ( profiler_active ) profiler_counter( name, (int64)(value) ); } while ( 0 )
+
+#define PROFILE_FRAME() \
+	do { if ( profiler_active ) profiler_frame(); } while ( 0 )
+
+#define PROFILE_THREAD_NAME( name ) \
+	profiler_set_thread_name( name )
+
+#else
+
+#define PROFILE_ZONE_BEGIN( name )
+#define PROFILE_ZONE_END()
+#define PROFILE_COUNTER( name, value )
+#define PROFILE_FRAME()
+#define PROFILE_THREAD_NAME( name )
+
+#endif /* MYLLY_PROFILER */
+
+#endif /* __LIB_PLATFORM_PROFILER_H */
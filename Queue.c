@@ -0,0 +1,368 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		Queue.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Bounded lock-free queues for passing messages between threads.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+#include "Platform/Queue.h"
+#include "Platform/Sync.h"
+#include "Platform/Timer.h"
+#include "Platform/Atomic.h"
+#include "Platform/Alloc.h"
+
+#define CACHE_LINE		64
+#define SPIN_COUNT		200
+
+// Threads blocked on a queue park on the sequence number, which is bumped
+// whenever the queue changes while someone is waiting.
+typedef struct {
+	volatile uint32		sequence;
+	volatile uint32		waiters;
+	uint8				padding[CACHE_LINE - 2 * sizeof(uint32)];
+} queue_waiter_t;
+
+struct spsc_queue_s
+{
+	// Consumer side
+	volatile uint32		head;
+	uint32				cached_tail;	// Consumer's last seen tail
+	uint8				padding1[CACHE_LINE - 2 * sizeof(uint32)];
+
+	// Producer side
+	volatile uint32		tail;
+	uint32				cached_head;	// Producer's last seen head
+	uint8				padding2[CACHE_LINE - 2 * sizeof(uint32)];
+
+	queue_waiter_t		not_empty;
+	queue_waiter_t		not_full;
+
+	uint32				mask;
+	size_t				item_size;
+	uint8*				items;
+};
+
+typedef struct {
+	volatile uint32		sequence;
+} mpmc_cell_t;
+
+struct mpmc_queue_s
+{
+	volatile uint32		enqueue_pos;
+	uint8				padding1[CACHE_LINE - sizeof(uint32)];
+	volatile uint32		dequeue_pos;
+	uint8				padding2[CACHE_LINE - sizeof(uint32)];
+
+	queue_waiter_t		not_empty;
+	queue_waiter_t		not_full;
+
+	uint32				mask;
+	size_t				item_size;
+	size_t				cell_size;		// Sequence number plus the item, aligned
+	uint8*				cells;
+};
+
+typedef bool ( *queue_op_t )( void* queue, void* item );
+
+static uint32 queue_round_capacity( uint32 capacity )
+{
+	uint32 size = 2;
+
+	while ( size < capacity && size < 0x40000000 ) size <<= 1;
+	return size;
+}
+
+static void* queue_alloc( size_t size )
+{
+	// Over-allocate so the queue can be aligned to a cache line
+	uint8* mem = (uint8*)mem_alloc_clean( size + CACHE_LINE );
+	uint8* aligned = (uint8*)( ( (size_t)mem + CACHE_LINE ) & ~(size_t)( CACHE_LINE - 1 ) );
+
+	aligned[-1] = (uint8)( aligned - mem );
+	return aligned;
+}
+
+static void queue_free( void* ptr )
+{
+	uint8* aligned = (uint8*)ptr;
+	mem_free( aligned - aligned[-1] );
+}
+
+static MYLLY_INLINE void queue_notify( queue_waiter_t* waiter )
+{
+	// Pairs with the waiter count increment in queue_wait, either the waiter
+	// sees the change or we see the waiter.
+	atomic_fence( MEMORY_ORDER_SEQ_CST );
+
+	if ( atomic_load_32( &waiter->waiters, MEMORY_ORDER_RELAXED ) != 0 )
+	{
+		atomic_fetch_add_32( &waiter->sequence, 1, MEMORY_ORDER_RELEASE );
+		futex_wake_all( &waiter->sequence );
+	}
+}
+
+static bool queue_wait( queue_waiter_t* waiter, queue_op_t op, void* queue, void* item, uint32 timeout )
+{
+	uint64 deadline = 0, now;
+	uint32 i, sequence, remaining = SYNC_INFINITE;
+	bool done;
+
+	for ( i = 0; i < SPIN_COUNT; ++i )
+	{
+		if ( op( queue, item ) ) return true;
+		cpu_pause();
+	}
+
+	if ( timeout == 0 ) return false;
+	if ( timeout != SYNC_INFINITE ) deadline = get_time_ns() + (uint64)timeout * 1000000;
+
+	for ( ;; )
+	{
+		sequence = atomic_load_32( &waiter->sequence, MEMORY_ORDER_ACQUIRE );
+		atomic_fetch_add_32( &waiter->waiters, 1, MEMORY_ORDER_SEQ_CST );
+
+		done = op( queue, item );
+
+		if ( !done )
+		{
+			if ( deadline )
+			{
+				now = get_time_ns();
+
+				if ( now >= deadline )
+				{
+					atomic_fetch_add_32( &waiter->waiters, (uint32)-1, MEMORY_ORDER_RELAXED );
+					return false;
+				}
+
+				remaining = (uint32)( ( deadline - now + 999999 ) / 1000000 );
+			}
+
+			futex_wait( &waiter->sequence, sequence, remaining );
+		}
+
+		atomic_fetch_add_32( &waiter->waiters, (uint32)-1, MEMORY_ORDER_RELAXED );
+		if ( done ) return true;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Single producer, single consumer queue
+//////////////////////////////////////////////////////////////////////////
+
+spsc_queue_t* spsc_queue_create( uint32 capacity, size_t item_size )
+{
+	spsc_queue_t* queue;
+
+	if ( item_size == 0 ) return NULL;
+
+	queue = (spsc_queue_t*)queue_alloc( sizeof(*queue) );
+
+	queue->mask = queue_round_capacity( capacity ) - 1;
+	queue->item_size = item_size;
+	queue->items = (uint8*)mem_alloc( ( queue->mask + 1 ) * item_size );
+
+	return queue;
+}
+
+void spsc_queue_destroy( spsc_queue_t* queue )
+{
+	if ( queue == NULL ) return;
+
+	mem_free( queue->items );
+	queue_free( queue );
+}
+
+bool spsc_queue_push( spsc_queue_t* queue, const void* item )
+{
+	uint32 tail = queue->tail;
+
+	if ( tail - queue->cached_head > queue->mask )
+	{
+		// Looks full, refresh our view of the consumer
+		queue->cached_head = atomic_load_32( &queue->head, MEMORY_ORDER_ACQUIRE );
+		if ( tail - queue->cached_head > queue->mask ) return false;
+	}
+
+	memcpy( queue->items + ( tail & queue->mask ) * queue->item_size, item, queue->item_size );
+	atomic_store_32( &queue->tail, tail + 1, MEMORY_ORDER_RELEASE );
+
+	queue_notify( &queue->not_empty );
+	return true;
+}
+
+bool spsc_queue_pop( spsc_queue_t* queue, void* item )
+{
+	uint32 head = queue->head;
+
+	if ( head == queue->cached_tail )
+	{
+		queue->cached_tail = atomic_load_32( &queue->tail, MEMORY_ORDER_ACQUIRE );
+		if ( head == queue->cached_tail ) return false;
+	}
+
+	memcpy( item, queue->items + ( head & queue->mask ) * queue->item_size, queue->item_size );
+	atomic_store_32( &queue->head, head + 1, MEMORY_ORDER_RELEASE );
+
+	queue_notify( &queue->not_full );
+	return true;
+}
+
+static bool spsc_push_op( void* queue, void* item )
+{
+	return spsc_queue_push( (spsc_queue_t*)queue, item );
+}
+
+static bool spsc_pop_op( void* queue, void* item )
+{
+	return spsc_queue_pop( (spsc_queue_t*)queue, item );
+}
+
+bool spsc_queue_push_wait( spsc_queue_t* queue, const void* item, uint32 timeout )
+{
+	return queue_wait( &queue->not_full, spsc_push_op, queue, (void*)item, timeout );
+}
+
+bool spsc_queue_pop_wait( spsc_queue_t* queue, void* item, uint32 timeout )
+{
+	return queue_wait( &queue->not_empty, spsc_pop_op, queue, item, timeout );
+}
+
+uint32 spsc_queue_size( spsc_queue_t* queue )
+{
+	return atomic_load_32( &queue->tail, MEMORY_ORDER_ACQUIRE ) - atomic_load_32( &queue->head, MEMORY_ORDER_ACQUIRE );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Multi producer, multi consumer queue (Dmitry Vyukov's bounded queue)
+//////////////////////////////////////////////////////////////////////////
+
+#define MPMC_CELL( queue, pos ) \
+	( (mpmc_cell_t*)( (queue)->cells + ( (pos) & (queue)->mask ) * (queue)->cell_size ) )
+
+mpmc_queue_t* mpmc_queue_create( uint32 capacity, size_t item_size )
+{
+	mpmc_queue_t* queue;
+	uint32 i;
+
+	if ( item_size == 0 ) return NULL;
+
+	queue = (mpmc_queue_t*)queue_alloc( sizeof(*queue) );
+
+	queue->mask = queue_round_capacity( capacity ) - 1;
+	queue->item_size = item_size;
+	queue->cell_size = ( sizeof(mpmc_cell_t) + item_size + sizeof(void*) - 1 ) & ~( sizeof(void*) - 1 );
+	queue->cells = (uint8*)mem_alloc( ( queue->mask + 1 ) * queue->cell_size );
+
+	// Each cell starts out as writable for the matching enqueue position
+	for ( i = 0; i <= queue->mask; ++i )
+		MPMC_CELL( queue, i )->sequence = i;
+
+	return queue;
+}
+
+void mpmc_queue_destroy( mpmc_queue_t* queue )
+{
+	if ( queue == NULL ) return;
+
+	mem_free( queue->cells );
+	queue_free( queue );
+}
+
+bool mpmc_queue_push( mpmc_queue_t* queue, const void* item )
+{
+	mpmc_cell_t* cell;
+	uint32 pos, sequence;
+	int32 diff;
+
+	pos = atomic_load_32( &queue->enqueue_pos, MEMORY_ORDER_RELAXED );
+
+	for ( ;; )
+	{
+		cell = MPMC_CELL( queue, pos );
+		sequence = atomic_load_32( &cell->sequence, MEMORY_ORDER_ACQUIRE );
+		diff = (int32)( sequence - pos );
+
+		if ( diff == 0 )
+		{
+			// On failure pos is updated with the current position
+			if ( atomic_cas_32( &queue->enqueue_pos, &pos, pos + 1, MEMORY_ORDER_RELAXED ) ) break;
+		}
+		else if ( diff < 0 )
+		{
+			// The cell hasn't been consumed yet, the queue is full
+			return false;
+		}
+		else
+		{
+			pos = atomic_load_32( &queue->enqueue_pos, MEMORY_ORDER_RELAXED );
+		}
+	}
+
+	memcpy( cell + 1, item, queue->item_size );
+	atomic_store_32( &cell->sequence, pos + 1, MEMORY_ORDER_RELEASE );
+
+	queue_notify( &queue->not_empty );
+	return true;
+}
+
+bool mpmc_queue_pop( mpmc_queue_t* queue, void* item )
+{
+	mpmc_cell_t* cell;
+	uint32 pos, sequence;
+	int32 diff;
+
+	pos = atomic_load_32( &queue->dequeue_pos, MEMORY_ORDER_RELAXED );
+
+	for ( ;; )
+	{
+		cell = MPMC_CELL( queue, pos );
+		sequence = atomic_load_32( &cell->sequence, MEMORY_ORDER_ACQUIRE );
+		diff = (int32)( sequence - ( pos + 1 ) );
+
+		if ( diff == 0 )
+		{
+			// On failure pos is updated with the current position
+			if ( atomic_cas_32( &queue->dequeue_pos, &pos, pos + 1, MEMORY_ORDER_RELAXED ) ) break;
+		}
+		else if ( diff < 0 )
+		{
+			// Nothing has been written to the cell yet, the queue is empty
+			return false;
+		}
+		else
+		{
+			pos = atomic_load_32( &queue->dequeue_pos, MEMORY_ORDER_RELAXED );
+		}
+	}
+
+	memcpy( item, cell + 1, queue->item_size );
+	atomic_store_32( &cell->sequence, pos + queue->mask + 1, MEMORY_ORDER_RELEASE );
+
+	queue_notify( &queue->not_full );
+	return true;
+}
+
+static bool mpmc_push_op( void* queue, void* item )
+{
+	return mpmc_queue_push( (mpmc_queue_t*)queue, item );
+}
+
+static bool mpmc_pop_op( void* queue, void* item )
+{
+	return mpmc_queue_pop( (mpmc_queue_t*)queue, item );
+}
+
+bool mpmc_queue_push_wait( mpmc_queue_t* queue, const void* item, uint32 timeout )
+{
+	return queue_wait( &queue->not_full, mpmc_push_op, queue, (void*)item, timeout );
+}
+
+bool mpmc_queue_pop_wait( mpmc_queue_t* queue, void* item, uint32 timeout )
+{
+	return queue_wait( &queue->not_empty, mpmc_pop_op, queue, item, timeout );
+}
@@ -0,0 +1,48 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		Queue.h
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Bounded lock-free queues for passing messages between threads.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+#pragma once
+#ifndef __LIB_PLATFORM_QUEUE_H
+#define __LIB_PLATFORM_QUEUE_H
+
+#include "stdtypes.h"
+
+// Both queues store fixed-size items by value. The capacity is rounded up to
+// a power of two. The _wait variants spin briefly and then park the thread on
+// a futex until the queue changes or the timeout (in milliseconds, see
+// SYNC_INFINITE) elapses.
+//
+// spsc_queue_t is safe for exactly one producer and one consumer thread,
+// mpmc_queue_t for any number of both.
+
+typedef struct spsc_queue_s spsc_queue_t;
+typedef struct mpmc_queue_s mpmc_queue_t;
+
+__BEGIN_DECLS
+
+MYLLY_API spsc_queue_t*	spsc_queue_create		( uint32 capacity, size_t item_size );
+MYLLY_API void			spsc_queue_destroy		( spsc_queue_t* queue );
+MYLLY_API bool			spsc_queue_push			( spsc_queue_t* queue, const void* item );
+MYLLY_API bool			spsc_queue_pop			( spsc_queue_t* queue, void* item );
+MYLLY_API bool			spsc_queue_push_wait	( spsc_queue_t* queue, const void* item, uint32 timeout );
+MYLLY_API bool			spsc_queue_pop_wait		( spsc_queue_t* queue, void* item, uint32 timeout );
+MYLLY_API uint32		spsc_queue_size			( spsc_queue_t* queue );
+
+MYLLY_API mpmc_queue_t*	mpmc_queue_create		( uint32 capacity, size_t item_size );
+MYLLY_API void			mpmc_queue_destroy		( mpmc_queue_t* queue );
+MYLLY_API bool			mpmc_queue_push			( mpmc_queue_t* queue, const void* item );
+MYLLY_API bool			mpmc_queue_pop			( mpmc_queue_t* queue, void* item );
+MYLLY_API bool			mpmc_queue_push_wait	( mpmc_queue_t* queue, const void* item, uint32 timeout );
+MYLLY_API bool			mpmc_queue_pop_wait		( mpmc_queue_t* queue, void* item, uint32 timeout );
+
+__END_DECLS
+
+#endif /* __LIB_PLATFORM_QUEUE_H */
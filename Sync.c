@@ -0,0 +1,520 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		Sync.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Platform independent thread synchronization primitives.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+#include "Platform/Sync.h"
+#include "Platform/Timer.h"
+#include "Platform/Atomic.h"
+
+#ifdef _WIN32
+
+//////////////////////////////////////////////////////////////////////////
+// Win32 implementation
+//////////////////////////////////////////////////////////////////////////
+
+#pragma comment( lib, "Synchronization.lib" )
+
+bool futex_wait( volatile uint32* addr, uint32 expected, uint32 timeout )
+{
+	if ( WaitOnAddress( addr, &expected, sizeof(expected), timeout == SYNC_INFINITE ? INFINITE : timeout ) )
+		return true;
+
+	return GetLastError() != ERROR_TIMEOUT;
+}
+
+void futex_wake( volatile uint32* addr, uint32 count )
+{
+	while ( count-- > 0 )
+		WakeByAddressSingle( (PVOID)addr );
+}
+
+void futex_wake_all( volatile uint32* addr )
+{
+	WakeByAddressAll( (PVOID)addr );
+}
+
+#else
+
+//////////////////////////////////////////////////////////////////////////
+// POSIX implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include <errno.h>
+#include <time.h>
+
+static void timeout_to_timespec( uint32 timeout, struct timespec* ts )
+{
+	ts->tv_sec = timeout / 1000;
+	ts->tv_nsec = ( timeout % 1000 ) * 1000000;
+}
+
+#ifdef __linux__
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <limits.h>
+
+bool futex_wait( volatile uint32* addr, uint32 expected, uint32 timeout )
+{
+	struct timespec ts;
+
+	if ( timeout != SYNC_INFINITE ) timeout_to_timespec( timeout, &ts );
+
+	if ( syscall( SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected,
+				  timeout != SYNC_INFINITE ? &ts : NULL, NULL, 0 ) == 0 )
+		return true;
+
+	// EAGAIN means the value had already changed, EINTR is a spurious wakeup
+	return errno != ETIMEDOUT;
+}
+
+void futex_wake( volatile uint32* addr, uint32 count )
+{
+	syscall( SYS_futex, addr, FUTEX_WAKE_PRIVATE, count > INT_MAX ? INT_MAX : (int)count, NULL, NULL, 0 );
+}
+
+void futex_wake_all( volatile uint32* addr )
+{
+	syscall( SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0 );
+}
+
+#else
+
+// No futex available, emulate it with a table of hashed wait queues. Waking
+// always broadcasts to the bucket, waiters recheck their address anyway.
+
+#include <pthread.h>
+#include <sys/time.h>
+
+#define FUTEX_BUCKETS 64
+
+static struct {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+} futex_buckets[FUTEX_BUCKETS];
+
+static pthread_once_t futex_once = PTHREAD_ONCE_INIT;
+
+static void futex_init_buckets( void )
+{
+	uint32 i;
+
+	for ( i = 0; i < FUTEX_BUCKETS; ++i )
+	{
+		pthread_mutex_init( &futex_buckets[i].mutex, NULL );
+		pthread_cond_init( &futex_buckets[i].cond, NULL );
+	}
+}
+
+static uint32 futex_bucket( volatile uint32* addr )
+{
+	return (uint32)( ( (size_t)addr >> 2 ) * 2654435761u ) % FUTEX_BUCKETS;
+}
+
+bool futex_wait( volatile uint32* addr, uint32 expected, uint32 timeout )
+{
+	struct timespec ts;
+	struct timeval now;
+	uint32 bucket;
+	int ret = 0;
+
+	pthread_once( &futex_once, futex_init_buckets );
+	bucket = futex_bucket( addr );
+
+	pthread_mutex_lock( &futex_buckets[bucket].mutex );
+
+	if ( *addr == expected )
+	{
+		if ( timeout == SYNC_INFINITE )
+		{
+			pthread_cond_wait( &futex_buckets[bucket].cond, &futex_buckets[bucket].mutex );
+		}
+		else
+		{
+			gettimeofday( &now, NULL );
+			timeout_to_timespec( timeout, &ts );
+
+			ts.tv_sec += now.tv_sec;
+			ts.tv_nsec += now.tv_usec * 1000;
+
+			if ( ts.tv_nsec >= 1000000000 )
+			{
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+
+			ret = pthread_cond_timedwait( &futex_buckets[bucket].cond, &futex_buckets[bucket].mutex, &ts );
+		}
+	}
+
+	pthread_mutex_unlock( &futex_buckets[bucket].mutex );
+
+	return ret != ETIMEDOUT;
+}
+
+void futex_wake( volatile uint32* addr, uint32 count )
+{
+	UNREFERENCED_PARAM( count );
+	futex_wake_all( addr );
+}
+
+void futex_wake_all( volatile uint32* addr )
+{
+	uint32 bucket;
+
+	pthread_once( &futex_once, futex_init_buckets );
+	bucket = futex_bucket( addr );
+
+	pthread_mutex_lock( &futex_buckets[bucket].mutex );
+	pthread_cond_broadcast( &futex_buckets[bucket].cond );
+	pthread_mutex_unlock( &futex_buckets[bucket].mutex );
+}
+
+#endif /* __linux__ */
+#endif /* _WIN32 */
+
+//////////////////////////////////////////////////////////////////////////
+// Common implementation
+//////////////////////////////////////////////////////////////////////////
+
+#define SPIN_COUNT		100
+
+#define RW_WRITER			0x80000000
+#define RW_WRITER_WAITING	0x40000000
+#define RW_READER_WAITING	0x20000000
+#define RW_READERS			0x1FFFFFFF
+
+static MYLLY_INLINE uint32 cas_value( volatile uint32* ptr, uint32 expected, uint32 desired )
+{
+	// Returns the previous value, like InterlockedCompareExchange
+	atomic_cas_32( ptr, &expected, desired, MEMORY_ORDER_SEQ_CST );
+	return expected;
+}
+
+static uint64 timeout_deadline( uint32 timeout )
+{
+	return timeout == SYNC_INFINITE ? 0 : get_time_ns() + (uint64)timeout * 1000000;
+}
+
+static bool timeout_remaining( uint64 deadline, uint32* remaining )
+{
+	uint64 now;
+
+	if ( deadline == 0 )
+	{
+		*remaining = SYNC_INFINITE;
+		return true;
+	}
+
+	now = get_time_ns();
+	if ( now >= deadline ) return false;
+
+	// Round up so we don't spin on sub-millisecond remainders
+	*remaining = (uint32)( ( deadline - now + 999999 ) / 1000000 );
+	return true;
+}
+
+void mutex_init( sysmutex_t* mutex )
+{
+	mutex->state = 0;
+}
+
+void mutex_lock( sysmutex_t* mutex )
+{
+	uint32 state, i;
+
+	state = cas_value( &mutex->state, 0, 1 );
+	if ( state == 0 ) return;
+
+	// Spin for a while in case the owner is about to release the lock
+	for ( i = 0; i < SPIN_COUNT; ++i )
+	{
+		cpu_pause();
+
+		if ( mutex->state == 0 )
+		{
+			state = cas_value( &mutex->state, 0, 1 );
+			if ( state == 0 ) return;
+		}
+	}
+
+	// Mark the mutex as contended and park until it's released
+	if ( state != 2 ) state = atomic_exchange_32( &mutex->state, 2, MEMORY_ORDER_SEQ_CST );
+
+	while ( state != 0 )
+	{
+		futex_wait( &mutex->state, 2, SYNC_INFINITE );
+		state = atomic_exchange_32( &mutex->state, 2, MEMORY_ORDER_SEQ_CST );
+	}
+}
+
+bool mutex_trylock( sysmutex_t* mutex )
+{
+	return cas_value( &mutex->state, 0, 1 ) == 0;
+}
+
+void mutex_unlock( sysmutex_t* mutex )
+{
+	// Only enter the kernel when someone is waiting
+	if ( atomic_fetch_add_32( &mutex->state, (uint32)-1, MEMORY_ORDER_SEQ_CST ) != 1 )
+	{
+		atomic_exchange_32( &mutex->state, 0, MEMORY_ORDER_SEQ_CST );
+		futex_wake( &mutex->state, 1 );
+	}
+}
+
+void cond_init( syscond_t* cond )
+{
+	cond->sequence = 0;
+}
+
+bool cond_wait( syscond_t* cond, sysmutex_t* mutex, uint32 timeout )
+{
+	uint32 sequence, state;
+	bool ret;
+
+	sequence = cond->sequence;
+
+	mutex_unlock( mutex );
+	ret = futex_wait( &cond->sequence, sequence, timeout );
+
+	// Other threads may have been woken up as well, so reacquire the mutex in
+	// the contended state to make sure they get woken up in turn.
+	state = atomic_exchange_32( &mutex->state, 2, MEMORY_ORDER_SEQ_CST );
+
+	while ( state != 0 )
+	{
+		futex_wait( &mutex->state, 2, SYNC_INFINITE );
+		state = atomic_exchange_32( &mutex->state, 2, MEMORY_ORDER_SEQ_CST );
+	}
+
+	return ret;
+}
+
+void cond_signal( syscond_t* cond )
+{
+	atomic_fetch_add_32( &cond->sequence, 1, MEMORY_ORDER_SEQ_CST );
+	futex_wake( &cond->sequence, 1 );
+}
+
+void cond_broadcast( syscond_t* cond )
+{
+	atomic_fetch_add_32( &cond->sequence, 1, MEMORY_ORDER_SEQ_CST );
+	futex_wake_all( &cond->sequence );
+}
+
+void semaphore_init( syssem_t* sem, uint32 count )
+{
+	sem->count = count;
+	sem->waiters = 0;
+}
+
+bool semaphore_trywait( syssem_t* sem )
+{
+	uint32 count;
+
+	while ( ( count = sem->count ) > 0 )
+	{
+		if ( cas_value( &sem->count, count, count - 1 ) == count )
+			return true;
+	}
+
+	return false;
+}
+
+bool semaphore_wait( syssem_t* sem, uint32 timeout )
+{
+	uint64 deadline;
+	uint32 i, remaining;
+
+	for ( i = 0; i < SPIN_COUNT; ++i )
+	{
+		if ( semaphore_trywait( sem ) ) return true;
+		cpu_pause();
+	}
+
+	if ( timeout == 0 ) return false;
+
+	deadline = timeout_deadline( timeout );
+	atomic_fetch_add_32( &sem->waiters, 1, MEMORY_ORDER_SEQ_CST );
+
+	while ( !semaphore_trywait( sem ) )
+	{
+		if ( !timeout_remaining( deadline, &remaining ) )
+		{
+			atomic_fetch_add_32( &sem->waiters, (uint32)-1, MEMORY_ORDER_SEQ_CST );
+			return false;
+		}
+
+		futex_wait( &sem->count, 0, remaining );
+	}
+
+	atomic_fetch_add_32( &sem->waiters, (uint32)-1, MEMORY_ORDER_SEQ_CST );
+	return true;
+}
+
+void semaphore_post( syssem_t* sem, uint32 count )
+{
+	if ( count == 0 ) return;
+
+	atomic_fetch_add_32( &sem->count, count, MEMORY_ORDER_SEQ_CST );
+
+	if ( sem->waiters > 0 )
+		futex_wake( &sem->count, count );
+}
+
+void rwlock_init( sysrwlock_t* lock )
+{
+	lock->state = 0;
+}
+
+void rwlock_read_lock( sysrwlock_t* lock )
+{
+	uint32 state, i = 0;
+
+	for ( ;; )
+	{
+		state = lock->state;
+
+		// Writers are preferred, new readers wait while one is queued
+		if ( ( state & ( RW_WRITER | RW_WRITER_WAITING ) ) == 0 )
+		{
+			if ( cas_value( &lock->state, state, state + 1 ) == state ) return;
+			continue;
+		}
+
+		if ( i++ < SPIN_COUNT )
+		{
+			cpu_pause();
+			continue;
+		}
+
+		if ( ( state & RW_READER_WAITING ) == 0 &&
+			 cas_value( &lock->state, state, state | RW_READER_WAITING ) != state )
+			continue;
+
+		futex_wait( &lock->state, state | RW_READER_WAITING, SYNC_INFINITE );
+	}
+}
+
+void rwlock_read_unlock( sysrwlock_t* lock )
+{
+	uint32 state;
+
+	state = atomic_fetch_add_32( &lock->state, (uint32)-1, MEMORY_ORDER_SEQ_CST ) - 1;
+
+	// The last reader out lets a waiting writer in
+	if ( ( state & RW_READERS ) == 0 && ( state & RW_WRITER_WAITING ) )
+		futex_wake_all( &lock->state );
+}
+
+void rwlock_write_lock( sysrwlock_t* lock )
+{
+	uint32 state, i = 0;
+
+	for ( ;; )
+	{
+		state = lock->state;
+
+		if ( ( state & ( RW_WRITER | RW_READERS ) ) == 0 )
+		{
+			// Keep the reader flag so they get woken up on unlock. Any other
+			// waiting writers were woken up and will set their flag again.
+			if ( cas_value( &lock->state, state, RW_WRITER | ( state & RW_READER_WAITING ) ) == state ) return;
+			continue;
+		}
+
+		if ( i++ < SPIN_COUNT )
+		{
+			cpu_pause();
+			continue;
+		}
+
+		if ( ( state & RW_WRITER_WAITING ) == 0 &&
+			 cas_value( &lock->state, state, state | RW_WRITER_WAITING ) != state )
+			continue;
+
+		futex_wait( &lock->state, state | RW_WRITER_WAITING, SYNC_INFINITE );
+	}
+}
+
+void rwlock_write_unlock( sysrwlock_t* lock )
+{
+	uint32 state;
+
+	state = atomic_exchange_32( &lock->state, 0, MEMORY_ORDER_SEQ_CST );
+
+	if ( state & ( RW_WRITER_WAITING | RW_READER_WAITING ) )
+		futex_wake_all( &lock->state );
+}
+
+void event_init( sysevent_t* event, bool manual_reset, bool signaled )
+{
+	event->state = signaled ? 1 : 0;
+	event->waiters = 0;
+	event->manual_reset = manual_reset;
+}
+
+static MYLLY_INLINE bool event_try_consume( sysevent_t* event )
+{
+	if ( event->manual_reset ) return event->state != 0;
+
+	// Auto-reset events release exactly one waiter
+	return cas_value( &event->state, 1, 0 ) == 1;
+}
+
+bool event_wait( sysevent_t* event, uint32 timeout )
+{
+	uint64 deadline;
+	uint32 i, remaining;
+
+	for ( i = 0; i < SPIN_COUNT; ++i )
+	{
+		if ( event_try_consume( event ) ) return true;
+		cpu_pause();
+	}
+
+	if ( timeout == 0 ) return false;
+
+	deadline = timeout_deadline( timeout );
+	atomic_fetch_add_32( &event->waiters, 1, MEMORY_ORDER_SEQ_CST );
+
+	while ( !event_try_consume( event ) )
+	{
+		if ( !timeout_remaining( deadline, &remaining ) )
+		{
+			atomic_fetch_add_32( &event->waiters, (uint32)-1, MEMORY_ORDER_SEQ_CST );
+			return false;
+		}
+
+		futex_wait( &event->state, 0, remaining );
+	}
+
+	atomic_fetch_add_32( &event->waiters, (uint32)-1, MEMORY_ORDER_SEQ_CST );
+	return true;
+}
+
+void event_set( sysevent_t* event )
+{
+	atomic_exchange_32( &event->state, 1, MEMORY_ORDER_SEQ_CST );
+
+	if ( event->waiters == 0 ) return;
+
+	if ( event->manual_reset )
+		futex_wake_all( &event->state );
+	else
+		futex_wake( &event->state, 1 );
+}
+
+void event_reset( sysevent_t* event )
+{
+	atomic_exchange_32( &event->state, 0, MEMORY_ORDER_SEQ_CST );
+}
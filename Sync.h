@@ -0,0 +1,84 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		Sync.h
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Platform independent thread synchronization primitives.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+#pragma once
+#ifndef __LIB_PLATFORM_SYNC_H
+#define __LIB_PLATFORM_SYNC_H
+
+#include "stdtypes.h"
+
+// All primitives are plain structs which need no cleanup, and can be
+// zero-initialized or set up with their respective init functions. They
+// spin briefly before parking the thread on a futex (WaitOnAddress on Win32),
+// so uncontended operations never enter the kernel.
+
+#define SYNC_INFINITE	0xFFFFFFFF
+
+typedef struct {
+	volatile uint32		state;		// 0 = unlocked, 1 = locked, 2 = locked with waiters
+} sysmutex_t;
+
+typedef struct {
+	volatile uint32		sequence;
+} syscond_t;
+
+typedef struct {
+	volatile uint32		count;
+	volatile uint32		waiters;
+} syssem_t;
+
+typedef struct {
+	volatile uint32		state;		// Reader count and writer/waiter flags
+} sysrwlock_t;
+
+typedef struct {
+	volatile uint32		state;		// 0 = reset, 1 = signaled
+	volatile uint32		waiters;
+	bool				manual_reset;
+} sysevent_t;
+
+__BEGIN_DECLS
+
+// Low level futex interface. futex_wait blocks while *addr equals expected,
+// and returns false if the timeout (in milliseconds) elapsed.
+MYLLY_API bool		futex_wait				( volatile uint32* addr, uint32 expected, uint32 timeout );
+MYLLY_API void		futex_wake				( volatile uint32* addr, uint32 count );
+MYLLY_API void		futex_wake_all			( volatile uint32* addr );
+
+MYLLY_API void		mutex_init				( sysmutex_t* mutex );
+MYLLY_API void		mutex_lock				( sysmutex_t* mutex );
+MYLLY_API bool		mutex_trylock			( sysmutex_t* mutex );
+MYLLY_API void		mutex_unlock			( sysmutex_t* mutex );
+
+MYLLY_API void		cond_init				( syscond_t* cond );
+MYLLY_API bool		cond_wait				( syscond_t* cond, sysmutex_t* mutex, uint32 timeout );
+MYLLY_API void		cond_signal				( syscond_t* cond );
+MYLLY_API void		cond_broadcast			( syscond_t* cond );
+
+MYLLY_API void		semaphore_init			( syssem_t* sem, uint32 count );
+MYLLY_API bool		semaphore_wait			( syssem_t* sem, uint32 timeout );
+MYLLY_API bool		semaphore_trywait		( syssem_t* sem );
+MYLLY_API void		semaphore_post			( syssem_t* sem, uint32 count );
+
+MYLLY_API void		rwlock_init				( sysrwlock_t* lock );
+MYLLY_API void		rwlock_read_lock		( sysrwlock_t* lock );
+MYLLY_API void		rwlock_read_unlock		( sysrwlock_t* lock );
+MYLLY_API void		rwlock_write_lock		( sysrwlock_t* lock );
+MYLLY_API void		rwlock_write_unlock		( sysrwlock_t* lock );
+
+MYLLY_API void		event_init				( sysevent_t* event, bool manual_reset, bool signaled );
+MYLLY_API bool		event_wait				( sysevent_t* event, uint32 timeout );
+MYLLY_API void		event_set				( sysevent_t* event );
+MYLLY_API void		event_reset				( sysevent_t* event );
+
+__END_DECLS
+
+#endif /* __LIB_PLATFORM_SYNC_H */
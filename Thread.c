@@ -9,7 +9,13 @@
  *
  **********************************************************************/
 
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // For thread names and CPU affinity
+#endif
+
 #include "Platform/Thread.h"
+#include "Platform/Atomic.h"
+#include "Platform/Alloc.h"
 
 #ifdef _WIN32
 
@@ -19,6 +25,17 @@
 
 #include <process.h>
 
+typedef HRESULT ( WINAPI *set_thread_description_t )( HANDLE thread, PCWSTR description );
+
+static const int thread_priorities[NUM_THREAD_PRIORITIES] = {
+	THREAD_PRIORITY_LOWEST,
+	THREAD_PRIORITY_BELOW_NORMAL,
+	THREAD_PRIORITY_NORMAL,
+	THREAD_PRIORITY_ABOVE_NORMAL,
+	THREAD_PRIORITY_HIGHEST,
+	THREAD_PRIORITY_TIME_CRITICAL,
+};
+
 int thread_create( thread_func_t func, void* args )
 {
 	HANDLE thread;
@@ -37,6 +54,84 @@ void thread_sleep( uint32 msec )
 	Sleep( msec );
 }
 
+systhread_t* thread_create_ex( thread_func_t func, void* args, const thread_attr_t* attr )
+{
+	HANDLE thread;
+	uint32 thread_addr = 0;
+
+	// Start suspended so the attributes are in effect before the thread runs
+	thread = (HANDLE)_beginthreadex( NULL, attr ? (uint32)attr->stack_size : 0, func, args,
+									 CREATE_SUSPENDED, &thread_addr );
+
+	if ( !thread ) return NULL;
+
+	if ( attr )
+	{
+		if ( attr->name ) thread_set_name( (systhread_t*)thread, attr->name );
+		if ( attr->affinity ) thread_set_affinity( (systhread_t*)thread, attr->affinity );
+		if ( attr->priority != THREAD_PRIO_NORMAL ) thread_set_priority( (systhread_t*)thread, attr->priority );
+	}
+
+	ResumeThread( thread );
+	return (systhread_t*)thread;
+}
+
+bool thread_join( systhread_t* thread )
+{
+	if ( !thread ) return false;
+
+	WaitForSingleObject( (HANDLE)thread, INFINITE );
+	CloseHandle( (HANDLE)thread );
+
+	return true;
+}
+
+void thread_detach( systhread_t* thread )
+{
+	if ( thread ) CloseHandle( (HANDLE)thread );
+}
+
+bool thread_set_name( systhread_t* thread, const char* name )
+{
+	static set_thread_description_t set_description = NULL;
+	static bool initialized = false;
+	WCHAR wide[64];
+
+	if ( !name ) return false;
+
+	// SetThreadDescription is only available on Windows 10 and newer
+	if ( !initialized )
+	{
+		set_description = (set_thread_description_t)GetProcAddress( GetModuleHandleA( "kernel32.dll" ), "SetThreadDescription" );
+		initialized = true;
+	}
+
+	if ( !set_description ) return false;
+	if ( !MultiByteToWideChar( CP_UTF8, 0, name, -1, wide, sizeof(wide)/sizeof(wide[0]) ) ) return false;
+
+	return SUCCEEDED( set_description( thread ? (HANDLE)thread : GetCurrentThread(), wide ) );
+}
+
+bool thread_set_affinity( systhread_t* thread, uint64 mask )
+{
+	return SetThreadAffinityMask( thread ? (HANDLE)thread : GetCurrentThread(), (DWORD_PTR)mask ) != 0;
+}
+
+bool thread_set_priority( systhread_t* thread, THREAD_PRIORITY priority )
+{
+	if ( priority >= NUM_THREAD_PRIORITIES ) return false;
+
+	return SetThreadPriority( thread ? (HANDLE)thread : GetCurrentThread(), thread_priorities[priority] ) != 0;
+}
+
+uint32 get_cpu_count( void )
+{
+	SYSTEM_INFO info;
+	GetSystemInfo( &info );
+
+	return (uint32)info.dwNumberOfProcessors;
+}
+
 #else
 
 //////////////////////////////////////////////////////////////////////////
@@ -44,7 +139,32 @@ void thread_sleep( uint32 msec )
 //////////////////////////////////////////////////////////////////////////
 
 #include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#define THREAD_NAME_MAX 16 // Including the terminator, longer names are truncated
+
+struct systhread_s
+{
+	pthread_t			thread;
+	thread_func_t		func;
+	void*				args;
+	volatile pid_t		tid;		// Kernel thread id, set once the thread has started
+	THREAD_PRIORITY		priority;
+	volatile uint32		refs;		// Shared by the creator and the thread itself
+};
+
+#ifdef __linux__
+// Nice values used for non-realtime priorities. Raising the priority above
+// normal requires CAP_SYS_NICE or a suitable RLIMIT_NICE.
+static const int thread_nice_values[NUM_THREAD_PRIORITIES] = { 10, 5, 0, -5, -10, -10 };
+#endif
 
 int thread_create( thread_func_t func, void* arguments )
 {
@@ -62,4 +182,217 @@ void thread_sleep( uint32 millisec )
 	usleep( millisec * 1000 );
 }
 
+static void thread_release( struct systhread_s* thread )
+{
+	if ( atomic_fetch_add_32( &thread->refs, (uint32)-1, MEMORY_ORDER_ACQ_REL ) == 1 )
+		mem_free( thread );
+}
+
+static bool thread_apply_priority( pthread_t thread, pid_t tid, THREAD_PRIORITY priority )
+{
+	struct sched_param param;
+
+	memset( &param, 0, sizeof(param) );
+
+	if ( priority == THREAD_PRIO_REALTIME )
+	{
+		param.sched_priority = sched_get_priority_min( SCHED_RR );
+		return pthread_setschedparam( thread, SCHED_RR, &param ) == 0;
+	}
+
+#ifdef __linux__
+	// SCHED_OTHER has a single static priority on Linux, the nice value is
+	// tracked per thread instead.
+	param.sched_priority = 0;
+	pthread_setschedparam( thread, SCHED_OTHER, &param );
+
+	return setpriority( PRIO_PROCESS, (id_t)tid, thread_nice_values[priority] ) == 0;
+#else
+	int min, max;
+
+	UNREFERENCED_PARAM( tid );
+
+	min = sched_get_priority_min( SCHED_OTHER );
+	max = sched_get_priority_max( SCHED_OTHER );
+
+	param.sched_priority = min + ( max - min ) * (int)priority / ( NUM_THREAD_PRIORITIES - 2 );
+	return pthread_setschedparam( thread, SCHED_OTHER, &param ) == 0;
+#endif
+}
+
+static void* thread_entry( void* args )
+{
+	struct systhread_s* thread = (struct systhread_s*)args;
+	void* result;
+
+#ifdef __linux__
+	thread->tid = (pid_t)syscall( SYS_gettid );
+	atomic_fence( MEMORY_ORDER_SEQ_CST );
+#endif
+
+	if ( thread->priority != THREAD_PRIO_NORMAL )
+		thread_apply_priority( pthread_self(), thread->tid, thread->priority );
+
+	result = thread->func( thread->args );
+
+	thread_release( thread );
+	return result;
+}
+
+systhread_t* thread_create_ex( thread_func_t func, void* args, const thread_attr_t* attr )
+{
+	struct systhread_s* thread;
+	pthread_attr_t pattr;
+	int ret;
+
+	thread = (struct systhread_s*)mem_alloc_clean( sizeof(*thread) );
+
+	thread->func = func;
+	thread->args = args;
+	thread->priority = attr ? attr->priority : THREAD_PRIO_NORMAL;
+	thread->refs = 2;
+
+	pthread_attr_init( &pattr );
+
+	if ( attr && attr->stack_size )
+		pthread_attr_setstacksize( &pattr, attr->stack_size );
+
+#ifdef __linux__
+	if ( attr && attr->affinity )
+	{
+		cpu_set_t set;
+		uint32 i;
+
+		CPU_ZERO( &set );
+
+		for ( i = 0; i < 64; ++i )
+		{
+			if ( attr->affinity & ( 1ULL << i ) ) CPU_SET( i, &set );
+		}
+
+		pthread_attr_setaffinity_np( &pattr, sizeof(set), &set );
+	}
+#endif
+
+	ret = pthread_create( &thread->thread, &pattr, thread_entry, thread );
+	pthread_attr_destroy( &pattr );
+
+	if ( ret != 0 )
+	{
+		mem_free( thread );
+		return NULL;
+	}
+
+	if ( attr && attr->name )
+		thread_set_name( (systhread_t*)thread, attr->name );
+
+	return (systhread_t*)thread;
+}
+
+bool thread_join( systhread_t* thread )
+{
+	struct systhread_s* p = (struct systhread_s*)thread;
+	bool ret;
+
+	if ( !thread ) return false;
+
+	ret = ( pthread_join( p->thread, NULL ) == 0 );
+	thread_release( p );
+
+	return ret;
+}
+
+void thread_detach( systhread_t* thread )
+{
+	struct systhread_s* p = (struct systhread_s*)thread;
+
+	if ( !thread ) return;
+
+	pthread_detach( p->thread );
+	thread_release( p );
+}
+
+bool thread_set_name( systhread_t* thread, const char* name )
+{
+#if defined(__linux__)
+	char buffer[THREAD_NAME_MAX];
+	pthread_t target = thread ? ((struct systhread_s*)thread)->thread : pthread_self();
+
+	if ( !name ) return false;
+
+	strncpy( buffer, name, sizeof(buffer) - 1 );
+	buffer[sizeof(buffer) - 1] = 0;
+
+	return pthread_setname_np( target, buffer ) == 0;
+#elif defined(__APPLE__)
+	// Only the calling thread can be named on OS X
+	if ( !name || thread ) return false;
+	return pthread_setname_np( name ) == 0;
+#else
+	UNREFERENCED_PARAM( thread );
+	UNREFERENCED_PARAM( name );
+	return false;
+#endif
+}
+
+bool thread_set_affinity( systhread_t* thread, uint64 mask )
+{
+#ifdef __linux__
+	pthread_t target = thread ? ((struct systhread_s*)thread)->thread : pthread_self();
+	cpu_set_t set;
+	uint32 i;
+
+	CPU_ZERO( &set );
+
+	for ( i = 0; i < 64; ++i )
+	{
+		if ( mask & ( 1ULL << i ) ) CPU_SET( i, &set );
+	}
+
+	if ( mask == 0 )
+	{
+		// Allow every CPU
+		for ( i = 0; i < CPU_SETSIZE; ++i ) CPU_SET( i, &set );
+	}
+
+	return pthread_setaffinity_np( target, sizeof(set), &set ) == 0;
+#else
+	UNREFERENCED_PARAM( thread );
+	UNREFERENCED_PARAM( mask );
+	return false;
+#endif
+}
+
+bool thread_set_priority( systhread_t* thread, THREAD_PRIORITY priority )
+{
+	struct systhread_s* p = (struct systhread_s*)thread;
+	pid_t tid = 0;
+
+	if ( priority >= NUM_THREAD_PRIORITIES ) return false;
+
+	if ( p == NULL )
+	{
+#ifdef __linux__
+		tid = (pid_t)syscall( SYS_gettid );
+#endif
+		return thread_apply_priority( pthread_self(), tid, priority );
+	}
+
+	p->priority = priority;
+	atomic_fence( MEMORY_ORDER_SEQ_CST );
+
+	// If the thread hasn't started yet it will apply the priority itself
+#ifdef __linux__
+	if ( p->tid == 0 ) return true;
+#endif
+
+	return thread_apply_priority( p->thread, p->tid, priority );
+}
+
+uint32 get_cpu_count( void )
+{
+	long count = sysconf( _SC_NPROCESSORS_ONLN );
+	return count > 0 ? (uint32)count : 1;
+}
+
 #endif
@@ -23,10 +23,40 @@
 	#define _THREAD_FUNC( func ) void* func( void* args )
 #endif
 
+typedef void systhread_t;
+
+typedef enum {
+	THREAD_PRIO_LOWEST,
+	THREAD_PRIO_LOW,
+	THREAD_PRIO_NORMAL,
+	THREAD_PRIO_HIGH,
+	THREAD_PRIO_HIGHEST,
+	THREAD_PRIO_REALTIME,	// Usually requires elevated privileges
+	NUM_THREAD_PRIORITIES
+} THREAD_PRIORITY;
+
+typedef struct {
+	const char*		name;			// Thread name for debuggers and perf/top, NULL for none
+	uint64			affinity;		// Mask of allowed CPUs, 0 for any
+	size_t			stack_size;		// Stack size in bytes, 0 for the system default
+	THREAD_PRIORITY	priority;
+} thread_attr_t;
+
 __BEGIN_DECLS
 
-MYLLY_API int		thread_create			( thread_func_t func, void* args );
-MYLLY_API void		thread_sleep			( uint32 msec );
+MYLLY_API int			thread_create			( thread_func_t func, void* args );
+MYLLY_API void			thread_sleep			( uint32 msec );
+
+// Joinable threads. A thread handle must be released by either thread_join
+// or thread_detach. Passing NULL as the handle to the thread_set_* functions
+// applies the setting to the calling thread.
+MYLLY_API systhread_t*	thread_create_ex		( thread_func_t func, void* args, const thread_attr_t* attr );
+MYLLY_API bool			thread_join				( systhread_t* thread );
+MYLLY_API void			thread_detach			( systhread_t* thread );
+MYLLY_API bool			thread_set_name			( systhread_t* thread, const char* name );
+MYLLY_API bool			thread_set_affinity		( systhread_t* thread, uint64 mask );
+MYLLY_API bool			thread_set_priority		( systhread_t* thread, THREAD_PRIORITY priority );
+MYLLY_API uint32		get_cpu_count			( void );
 
 __END_DECLS
 
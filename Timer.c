@@ -10,6 +10,7 @@
  **********************************************************************/
 
 #include "Platform/Timer.h"
+#include "Platform/Atomic.h"
 
 #ifdef _WIN32
 
@@ -19,20 +20,53 @@
 
 #include "Platform/Alloc.h"
 
-static float _timerfreq = 0.0f;
+static LONGLONG _timerfreq = 0;
 
 struct systimer_s
 {
 	HANDLE			handle;
-	LARGE_INTEGER	interval;
+	LONGLONG		interval;	// Interval in performance counter ticks
+	LONGLONG		deadline;	// Absolute deadline of the next tick
 	LARGE_INTEGER	prev_tick;
 };
 
+static uint64 ticks_to_ns( LONGLONG ticks )
+{
+	// Split the conversion to avoid overflowing on large tick counts
+	return (uint64)( ticks / _timerfreq ) * 1000000000ULL +
+		   (uint64)( ticks % _timerfreq ) * 1000000000ULL / (uint64)_timerfreq;
+}
+
 uint32 get_tick_count( void )
 {
 	return (uint32)GetTickCount64();
 }
 
+static uint64 clock_read_ns( TIME_SOURCE source )
+{
+	LARGE_INTEGER tick, frequency;
+
+	UNREFERENCED_PARAM( source );
+
+	if ( _timerfreq == 0 )
+	{
+		QueryPerformanceFrequency( &frequency );
+		_timerfreq = frequency.QuadPart;
+	}
+
+	// The performance counter is never slewed, so both monotonic sources map to it
+	QueryPerformanceCounter( &tick );
+	return ticks_to_ns( tick.QuadPart );
+}
+
+static uint64 clock_resolution_ns( TIME_SOURCE source )
+{
+	UNREFERENCED_PARAM( source );
+
+	clock_read_ns( source );
+	return ticks_to_ns( 1 ) ? ticks_to_ns( 1 ) : 1;
+}
+
 systimer_t* systimer_create( float interval )
 {
 	struct systimer_s* timer;
@@ -42,18 +76,18 @@ systimer_t* systimer_create( float interval )
 	{
 		// Cache the frequency first
 		QueryPerformanceFrequency( &frequency );
-		_timerfreq = (float)frequency.QuadPart;
+		_timerfreq = frequency.QuadPart;
 	}
 
 	timer = (struct systimer_s*)mem_alloc( sizeof(*timer) );
 
-	timer->handle				= CreateWaitableTimer( NULL, TRUE, NULL );
-	timer->interval.QuadPart	= (LONGLONG)( (double)interval * -10000000.0 );
+	timer->handle	= CreateWaitableTimer( NULL, TRUE, NULL );
+	timer->interval	= (LONGLONG)( (double)interval * (double)_timerfreq );
 
-	QueryPerformanceCounter( &timer->prev_tick );
+	if ( timer->interval <= 0 ) timer->interval = 1;
 
-	if ( timer->handle )
-		SetWaitableTimer( timer->handle, &timer->interval, 0, NULL, NULL, 0 );
+	QueryPerformanceCounter( &timer->prev_tick );
+	timer->deadline = timer->prev_tick.QuadPart;
 
 	return (systimer_t*)timer;
 }
@@ -72,23 +106,48 @@ void systimer_destroy( systimer_t* timer )
 
 float systimer_wait( systimer_t* timer, bool wait )
 {
-	LARGE_INTEGER tick;
-	float delta;
+	return (float)( (double)systimer_wait_ns( timer, wait ) * 1e-9 );
+}
+
+uint64 systimer_wait_ns( systimer_t* timer, bool wait )
+{
+	LARGE_INTEGER tick, due;
+	LONGLONG remaining;
+	uint64 delta;
 	struct systimer_s* p;
 
-	if ( !timer ) return 0.0f;
+	if ( !timer ) return 0;
 
 	p = (struct systimer_s*)timer;
 
 	if ( wait )
 	{
-		WaitForSingleObject( p->handle, INFINITE );
-		SetWaitableTimer( p->handle, &p->interval, 0, NULL, NULL, 0 );
+		// Schedule against an absolute deadline so that the time spent between
+		// waits does not accumulate into drift.
+		p->deadline += p->interval;
+
+		QueryPerformanceCounter( &tick );
+		remaining = p->deadline - tick.QuadPart;
+
+		if ( remaining > 0 )
+		{
+			// Waitable timers take relative due times in 100ns units
+			due.QuadPart = -(LONGLONG)( ticks_to_ns( remaining ) / 100 );
+
+			if ( p->handle && SetWaitableTimer( p->handle, &due, 0, NULL, NULL, 0 ) )
+				WaitForSingleObject( p->handle, INFINITE );
+		}
+		else if ( -remaining > p->interval )
+		{
+			// We've fallen behind by more than a full interval, resynchronize
+			// instead of firing a burst of back-to-back ticks.
+			p->deadline = tick.QuadPart;
+		}
 	}
 
 	QueryPerformanceCounter( &tick );
 
-	delta = (float)( tick.QuadPart - p->prev_tick.QuadPart ) / _timerfreq;
+	delta = ticks_to_ns( tick.QuadPart - p->prev_tick.QuadPart );
 
 	p->prev_tick = tick;
 
@@ -101,14 +160,411 @@ float systimer_wait( systimer_t* timer, bool wait )
 // POSIX implementation
 //////////////////////////////////////////////////////////////////////////
 
+#include "Platform/Alloc.h"
 #include <time.h>
+#include <errno.h>
 
-uint32 get_tick_count( void )
+#ifdef __linux__
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+struct systimer_s
+{
+	int		fd;			// timerfd handle, -1 if unavailable
+	int64	interval;	// Interval in nanoseconds
+	int64	deadline;	// Absolute deadline of the next tick (clock_nanosleep path)
+	int64	prev_tick;
+};
+
+static MYLLY_INLINE int64 monotonic_ns( void )
 {
 	struct timespec now;
 	clock_gettime( CLOCK_MONOTONIC, &now );
 
-	return (uint32)( (now.tv_sec * 1000000000LL + now.tv_nsec ) / 1000000LL );
+	return (int64)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static MYLLY_INLINE void ns_to_timespec( int64 ns, struct timespec* ts )
+{
+	ts->tv_sec = (time_t)( ns / 1000000000LL );
+	ts->tv_nsec = (long)( ns % 1000000000LL );
+}
+
+uint32 get_tick_count( void )
+{
+	return (uint32)( monotonic_ns() / 1000000LL );
+}
+
+#ifdef CLOCK_MONOTONIC_RAW
+#define RAW_CLOCK CLOCK_MONOTONIC_RAW
+#else
+#define RAW_CLOCK CLOCK_MONOTONIC
+#endif
+
+static uint64 clock_read_ns( TIME_SOURCE source )
+{
+	struct timespec now;
+
+	// Both clocks are serviced from the vDSO on Linux without entering the kernel
+	clock_gettime( source == TIME_SOURCE_MONOTONIC_RAW ? RAW_CLOCK : CLOCK_MONOTONIC, &now );
+
+	return (uint64)now.tv_sec * 1000000000ULL + (uint64)now.tv_nsec;
+}
+
+static uint64 clock_resolution_ns( TIME_SOURCE source )
+{
+	struct timespec res;
+
+	if ( clock_getres( source == TIME_SOURCE_MONOTONIC_RAW ? RAW_CLOCK : CLOCK_MONOTONIC, &res ) != 0 )
+		return 1;
+
+	return (uint64)res.tv_sec * 1000000000ULL + (uint64)res.tv_nsec;
+}
+
+systimer_t* systimer_create( float interval )
+{
+	struct systimer_s* timer;
+
+	timer = (struct systimer_s*)mem_alloc( sizeof(*timer) );
+
+	timer->fd			= -1;
+	timer->interval		= (int64)( (double)interval * 1e9 );
+	timer->prev_tick	= monotonic_ns();
+	timer->deadline		= timer->prev_tick;
+
+	if ( timer->interval <= 0 ) timer->interval = 1;
+
+#ifdef __linux__
+	{
+		struct itimerspec spec;
+
+		// Let the kernel run a periodic timer against absolute deadlines,
+		// this keeps the interval free of drift.
+		timer->fd = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC );
+
+		if ( timer->fd >= 0 )
+		{
+			ns_to_timespec( timer->deadline + timer->interval, &spec.it_value );
+			ns_to_timespec( timer->interval, &spec.it_interval );
+
+			if ( timerfd_settime( timer->fd, TFD_TIMER_ABSTIME, &spec, NULL ) != 0 )
+			{
+				close( timer->fd );
+				timer->fd = -1;
+			}
+		}
+	}
+#endif
+
+	return (systimer_t*)timer;
+}
+
+void systimer_destroy( systimer_t* timer )
+{
+	struct systimer_s* p;
+
+	if ( !timer ) return;
+
+	p = (struct systimer_s*)timer;
+
+#ifdef __linux__
+	if ( p->fd >= 0 ) close( p->fd );
+#endif
+
+	mem_free( timer );
+}
+
+float systimer_wait( systimer_t* timer, bool wait )
+{
+	return (float)( (double)systimer_wait_ns( timer, wait ) * 1e-9 );
+}
+
+uint64 systimer_wait_ns( systimer_t* timer, bool wait )
+{
+	struct timespec ts;
+	int64 now, delta;
+	struct systimer_s* p;
+
+	if ( !timer ) return 0;
+
+	p = (struct systimer_s*)timer;
+
+	if ( wait )
+	{
+#ifdef __linux__
+		if ( p->fd >= 0 )
+		{
+			uint64 expirations;
+
+			// Blocks until at least one period has elapsed. Missed periods are
+			// collapsed into a single wakeup.
+			while ( read( p->fd, &expirations, sizeof(expirations) ) < 0 && errno == EINTR ) {}
+		}
+		else
+#endif
+		{
+			p->deadline += p->interval;
+			now = monotonic_ns();
+
+			if ( now - p->deadline > p->interval )
+			{
+				// We've fallen behind by more than a full interval, resynchronize
+				p->deadline = now;
+			}
+			else
+			{
+				ns_to_timespec( p->deadline, &ts );
+				while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL ) == EINTR ) {}
+			}
+		}
+	}
+
+	now = monotonic_ns();
+
+	delta = now - p->prev_tick;
+	p->prev_tick = now;
+
+	return (uint64)delta;
+}
+
+int systimer_get_fd( systimer_t* timer )
+{
+	if ( !timer ) return -1;
+	return ( (struct systimer_s*)timer )->fd;
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Nanosecond clock and calibrated TSC
+//////////////////////////////////////////////////////////////////////////
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define MYLLY_HAS_TSC
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+#endif
+
+#define TSC_CALIBRATION_NS	20000000ULL		// Time spent calibrating the TSC
+#define TIMER_SAMPLE_COUNT	1000			// Reads per overhead measurement
+
+// TSC calibration state
+#define TSC_UNCALIBRATED	0
+#define TSC_CALIBRATING		1
+#define TSC_CALIBRATED		2
+#define TSC_UNAVAILABLE		3
+
+// The base and scale are written once before tsc_state is published with a
+// release store, readers must check the state with an acquire load first.
+static volatile uint32		tsc_state			= TSC_UNCALIBRATED;
+static uint64				tsc_base			= 0;
+static uint64				tsc_base_ns			= 0;
+static double				tsc_ns_per_tick		= 0.0;
+static bool					source_measured[NUM_TIME_SOURCES];
+static time_source_info_t	source_info[NUM_TIME_SOURCES];
+
+#ifdef MYLLY_HAS_TSC
+
+static bool tsc_is_invariant( void )
+{
+	uint32 regs[4] = { 0 };
+
+	// CPUID.80000007H:EDX[8] tells whether the TSC runs at a constant rate
+	// across P-, C- and T-states.
+#ifdef _MSC_VER
+	__cpuid( (int*)regs, 0x80000000 );
+	if ( regs[0] < 0x80000007 ) return false;
+
+	__cpuid( (int*)regs, 0x80000007 );
+#else
+	if ( __get_cpuid_max( 0x80000000, NULL ) < 0x80000007 ) return false;
+
+	__get_cpuid( 0x80000007, &regs[0], &regs[1], &regs[2], &regs[3] );
+#endif
+
+	return ( regs[3] & ( 1 << 8 ) ) != 0;
+}
+
+static MYLLY_INLINE uint64 tsc_read_ns( void )
+{
+	return tsc_base_ns + (uint64)( (double)(int64)( __rdtsc() - tsc_base ) * tsc_ns_per_tick );
+}
+
+#endif /* MYLLY_HAS_TSC */
+
+static MYLLY_INLINE bool tsc_calibrated( void )
+{
+	return atomic_load_32( &tsc_state, MEMORY_ORDER_ACQUIRE ) == TSC_CALIBRATED;
+}
+
+uint64 get_time_ns( void )
+{
+	return clock_read_ns( TIME_SOURCE_MONOTONIC_RAW );
+}
+
+uint64 get_time_ns_fast( void )
+{
+#ifdef MYLLY_HAS_TSC
+	if ( tsc_calibrated() ) return tsc_read_ns();
+#endif
+
+	return clock_read_ns( TIME_SOURCE_MONOTONIC_RAW );
+}
+
+uint64 get_time_ns_from( TIME_SOURCE source )
+{
+	switch ( source )
+	{
+#ifdef MYLLY_HAS_TSC
+	case TIME_SOURCE_TSC:
+		if ( tsc_calibrated() ) return tsc_read_ns();
+		break;
+#endif
+
+	case TIME_SOURCE_MONOTONIC:
+		return clock_read_ns( TIME_SOURCE_MONOTONIC );
+
+	default:
+		break;
+	}
+
+	return clock_read_ns( TIME_SOURCE_MONOTONIC_RAW );
 }
 
+bool time_calibrate_tsc( void )
+{
+#ifdef MYLLY_HAS_TSC
+	uint64 tsc_start, tsc_end, ns_start, ns_end;
+	uint32 state = TSC_UNCALIBRATED;
+
+	// Only one thread calibrates, the others wait for its result
+	if ( !atomic_cas_32( &tsc_state, &state, TSC_CALIBRATING, MEMORY_ORDER_ACQUIRE ) )
+	{
+		while ( state == TSC_CALIBRATING )
+			state = atomic_load_32( &tsc_state, MEMORY_ORDER_ACQUIRE );
+
+		return state == TSC_CALIBRATED;
+	}
+
+	if ( !tsc_is_invariant() )
+	{
+		atomic_store_32( &tsc_state, TSC_UNAVAILABLE, MEMORY_ORDER_RELEASE );
+		return false;
+	}
+
+	// Sample both clocks over a short busy interval. The reference clock is
+	// read on both sides of rdtsc so its own cost is split evenly.
+	ns_start = clock_read_ns( TIME_SOURCE_MONOTONIC_RAW );
+	tsc_start = __rdtsc();
+
+	do {
+		ns_end = clock_read_ns( TIME_SOURCE_MONOTONIC_RAW );
+	}
+	while ( ns_end - ns_start < TSC_CALIBRATION_NS );
+
+	tsc_end = __rdtsc();
+	ns_end = ( ns_end + clock_read_ns( TIME_SOURCE_MONOTONIC_RAW ) ) / 2;
+
+	if ( tsc_end <= tsc_start )
+	{
+		atomic_store_32( &tsc_state, TSC_UNCALIBRATED, MEMORY_ORDER_RELEASE );
+		return false;
+	}
+
+	tsc_ns_per_tick = (double)( ns_end - ns_start ) / (double)( tsc_end - tsc_start );
+	tsc_base = tsc_end;
+	tsc_base_ns = ns_end;
+
+	atomic_store_32( &tsc_state, TSC_CALIBRATED, MEMORY_ORDER_RELEASE );
+
+	return true;
+#else
+	return false;
 #endif
+}
+
+static void measure_time_source( TIME_SOURCE source )
+{
+	time_source_info_t* info = &source_info[source];
+	volatile uint64 sink = 0;
+	uint64 start, end, prev, now, step;
+	uint32 i;
+
+	info->available = ( source != TIME_SOURCE_TSC || tsc_calibrated() );
+
+	if ( !info->available )
+	{
+		source_measured[source] = true;
+		return;
+	}
+
+	// Average cost of a read, measured against the source itself
+	start = get_time_ns_from( source );
+
+	for ( i = 0; i < TIMER_SAMPLE_COUNT; ++i )
+		sink += get_time_ns_from( source );
+
+	end = get_time_ns_from( source );
+	info->overhead = ( end - start ) / TIMER_SAMPLE_COUNT;
+
+	// Smallest observed non-zero step between two consecutive reads. This may
+	// be coarser than the advertised resolution of the clock.
+	step = ~0ULL;
+	prev = get_time_ns_from( source );
+
+	for ( i = 0; i < TIMER_SAMPLE_COUNT; ++i )
+	{
+		now = get_time_ns_from( source );
+
+		if ( now > prev && now - prev < step ) step = now - prev;
+		prev = now;
+	}
+
+	if ( source == TIME_SOURCE_TSC )
+		info->resolution = tsc_ns_per_tick >= 1.0 ? (uint64)tsc_ns_per_tick : 1;
+	else
+		info->resolution = clock_resolution_ns( source );
+
+	if ( step != ~0ULL && step > info->resolution ) info->resolution = step;
+
+	UNREFERENCED_PARAM( sink );
+	source_measured[source] = true;
+}
+
+bool get_time_source_info( TIME_SOURCE source, time_source_info_t* info )
+{
+	if ( source >= NUM_TIME_SOURCES || info == NULL ) return false;
+
+	// The TSC may have been calibrated after an earlier query
+	if ( !source_measured[source] || ( source == TIME_SOURCE_TSC && tsc_calibrated() && !source_info[source].available ) )
+		measure_time_source( source );
+
+	*info = source_info[source];
+	return info->available;
+}
+
+TIME_SOURCE get_cheapest_time_source( void )
+{
+	time_source_info_t info;
+	TIME_SOURCE source, best = TIME_SOURCE_MONOTONIC_RAW;
+	uint64 cost = ~0ULL;
+
+	for ( source = TIME_SOURCE_MONOTONIC; source < NUM_TIME_SOURCES; ++source )
+	{
+		if ( !get_time_source_info( source, &info ) ) continue;
+
+		if ( info.overhead < cost )
+		{
+			cost = info.overhead;
+			best = source;
+		}
+	}
+
+	return best;
+}
@@ -17,13 +17,40 @@
 
 typedef void systimer_t;
 
+typedef enum {
+	TIME_SOURCE_MONOTONIC,		// CLOCK_MONOTONIC / QueryPerformanceCounter
+	TIME_SOURCE_MONOTONIC_RAW,	// CLOCK_MONOTONIC_RAW, not slewed by NTP
+	TIME_SOURCE_TSC,			// Calibrated rdtsc, requires time_calibrate_tsc
+	NUM_TIME_SOURCES
+} TIME_SOURCE;
+
+typedef struct {
+	bool		available;
+	uint64		resolution;		// Smallest observable step in nanoseconds
+	uint64		overhead;		// Average cost of a single read in nanoseconds
+} time_source_info_t;
+
 __BEGIN_DECLS
 
 MYLLY_API uint32		get_tick_count			( void );
 
+MYLLY_API uint64		get_time_ns				( void );
+MYLLY_API uint64		get_time_ns_fast		( void );
+MYLLY_API uint64		get_time_ns_from		( TIME_SOURCE source );
+MYLLY_API bool			time_calibrate_tsc		( void );
+MYLLY_API bool			get_time_source_info	( TIME_SOURCE source, time_source_info_t* info );
+MYLLY_API TIME_SOURCE	get_cheapest_time_source( void );
+
 MYLLY_API systimer_t*	systimer_create			( float interval );
 MYLLY_API void			systimer_destroy		( systimer_t* timer );
 MYLLY_API float			systimer_wait			( systimer_t* timer, bool wait );
+MYLLY_API uint64		systimer_wait_ns		( systimer_t* timer, bool wait );
+
+#ifndef _WIN32
+// Returns the timerfd of the timer, which becomes readable on every tick, or
+// -1 if the timer is not backed by one. Waiting for the timer consumes the tick.
+MYLLY_API int			systimer_get_fd			( systimer_t* timer );
+#endif
 
 __END_DECLS
 
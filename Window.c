@@ -13,8 +13,108 @@
 
 #include "Platform/Window.h"
 #include "Platform/Alloc.h"
+#include "Platform/Sync.h"
+#include "Platform/Queue.h"
+#include "Platform/Atomic.h"
 #include "Stringy/Stringy.h"
 
+#define TASK_BATCH 64		// Posted tasks run per pump before events get their turn
+
+typedef struct {
+	window_task_cb		func;
+	void*				arg;
+} window_task_t;
+
+static mpmc_queue_t* volatile	task_queue		= NULL;
+static volatile uint32			task_wakeup		= 0;	// The event loop has been woken up for queued tasks
+
+// Used by the Win32 and Xlib sections, WindowXcb.c has its own
+#if defined(_WIN32) || !defined(MYLLY_USE_XCB)
+static bool clip_rect( const window_rect_t* rect, uint16 width, uint16 height, int32* x, int32* y, int32* w, int32* h )
+{
+	int32 x2, y2;
+
+	*x = rect->x < 0 ? 0 : rect->x;
+	*y = rect->y < 0 ? 0 : rect->y;
+
+	x2 = rect->x + rect->w > width ? width : rect->x + rect->w;
+	y2 = rect->y + rect->h > height ? height : rect->y + rect->h;
+
+	*w = x2 - *x;
+	*h = y2 - *y;
+
+	return *w > 0 && *h > 0;
+}
+#endif
+
+static mpmc_queue_t* task_get_queue( void )
+{
+	mpmc_queue_t *queue, *expected = NULL;
+
+	queue = (mpmc_queue_t*)atomic_load_ptr( (void* volatile*)&task_queue, MEMORY_ORDER_ACQUIRE );
+	if ( queue != NULL ) return queue;
+
+	// Whoever loses the race destroys its own queue
+	queue = mpmc_queue_create( WINDOW_TASK_QUEUE_SIZE, sizeof(window_task_t) );
+
+	if ( !atomic_cas_ptr( (void* volatile*)&task_queue, (void**)&expected, queue, MEMORY_ORDER_ACQ_REL ) )
+	{
+		mpmc_queue_destroy( queue );
+		queue = expected;
+	}
+
+	return queue;
+}
+
+void post_to_window_thread( window_task_cb func, void* arg )
+{
+	mpmc_queue_t* queue;
+	window_task_t task;
+
+	if ( func == NULL ) return;
+
+	queue = task_get_queue();
+
+	task.func = func;
+	task.arg = arg;
+
+	if ( !mpmc_queue_push( queue, &task ) )
+	{
+		// The window thread is behind, make sure it's awake and wait for room
+		wake_event_loop();
+		mpmc_queue_push_wait( queue, &task, SYNC_INFINITE );
+	}
+
+	// Only the first task after the queue has been drained wakes the loop
+	if ( atomic_exchange_32( &task_wakeup, 1, MEMORY_ORDER_ACQ_REL ) == 0 )
+		wake_event_loop();
+}
+
+uint32 run_window_tasks( void )
+{
+	mpmc_queue_t* queue;
+	window_task_t task;
+	uint32 count;
+
+	queue = (mpmc_queue_t*)atomic_load_ptr( (void* volatile*)&task_queue, MEMORY_ORDER_ACQUIRE );
+	if ( queue == NULL ) return 0;
+
+	// Anything posted after this wakes the loop again
+	if ( atomic_exchange_32( &task_wakeup, 0, MEMORY_ORDER_SEQ_CST ) == 0 ) return 0;
+
+	for ( count = 0; count < TASK_BATCH; ++count )
+	{
+		if ( !mpmc_queue_pop( queue, &task ) ) return count;
+		task.func( task.arg );
+	}
+
+	// Leave the rest to the next pump so events aren't held up
+	atomic_store_32( &task_wakeup, 1, MEMORY_ORDER_RELEASE );
+	wake_event_loop();
+
+	return count;
+}
+
 #ifdef _WIN32
 
 //////////////////////////////////////////////////////////////////////////
@@ -26,6 +126,19 @@ struct WndCallbacks
 	void ( *window_message )( void* packet );
 };
 
+typedef struct sysframebuffer_s {
+	HDC dc;
+	HBITMAP bitmap;
+	HGDIOBJ old_bitmap;
+	uint32* pixels;
+	uint16 width;
+	uint16 height;
+} sysframebuffer_t;
+
+#define FRAMEBUFFER_PROP _MTEXT("mylly_framebuffer")
+
+static HANDLE volatile wakeup_event = NULL;
+
 static LONG_PTR __stdcall wnd_proc( HWND hwnd, uint32 message, WPARAM wparam, LPARAM lparam )
 {
 	struct WndCallbacks* cbstruct;
@@ -107,8 +220,21 @@ syswindow_t* create_system_window( int32 x, int32 y, uint32 w, uint32 h, const c
 	return (syswindow_t*)window;
 }
 
+static void framebuffer_destroy( sysframebuffer_t* fb )
+{
+	SelectObject( fb->dc, fb->old_bitmap );
+	DeleteObject( fb->bitmap );
+	DeleteDC( fb->dc );
+	mem_free( fb );
+}
+
 void destroy_system_window( syswindow_t* window )
 {
+	sysframebuffer_t* fb;
+
+	fb = (sysframebuffer_t*)RemoveProp( (HWND)window, FRAMEBUFFER_PROP );
+	if ( fb ) framebuffer_destroy( fb );
+
 	DestroyWindow( (HWND)window );
 }
 
@@ -129,6 +255,108 @@ void process_window_messages( syswindow_t* window, wnd_message_cb callback )
 		TranslateMessage( &msg );
 		DispatchMessage( &msg );
 	}
+
+	run_window_tasks();
+}
+
+void process_display_messages( wnd_message_cb callback )
+{
+	MSG msg;
+
+	// Messages for windows with callbacks are routed by the window procedure
+	while ( PeekMessage( &msg, NULL, 0, 0, PM_REMOVE ) )
+	{
+		if ( callback && GetWindowLongPtr( msg.hwnd, GWLP_USERDATA ) == 0 )
+		{
+			if ( !callback( (void*)&msg ) ) continue;
+		}
+
+		TranslateMessage( &msg );
+		DispatchMessage( &msg );
+	}
+
+	run_window_tasks();
+}
+
+static HANDLE wakeup_get_event( void )
+{
+	HANDLE event;
+
+	if ( wakeup_event == NULL )
+	{
+		// Whoever loses the race closes its own event
+		event = CreateEvent( NULL, FALSE, FALSE, NULL );
+
+		if ( InterlockedCompareExchangePointer( (PVOID volatile*)&wakeup_event, event, NULL ) != NULL )
+			CloseHandle( event );
+	}
+
+	return wakeup_event;
+}
+
+uint32 wait_for_events( uint32 timeout )
+{
+	HANDLE event = wakeup_get_event();
+	DWORD result;
+
+	// SYNC_INFINITE and INFINITE are the same value
+	result = MsgWaitForMultipleObjects( 1, &event, FALSE, timeout, QS_ALLINPUT );
+
+	if ( result == WAIT_OBJECT_0 ) return WAKE_POSTED;
+	if ( result == WAIT_OBJECT_0 + 1 ) return WAKE_EVENTS;
+
+	return 0;
+}
+
+void wake_event_loop( void )
+{
+	SetEvent( wakeup_get_event() );
+}
+
+bool add_event_timer( systimer_t* timer, event_timer_cb cb, void* data )
+{
+	// Waitable timers are armed for a single wait only
+	UNREFERENCED_PARAM( timer );
+	UNREFERENCED_PARAM( cb );
+	UNREFERENCED_PARAM( data );
+
+	return false;
+}
+
+void remove_event_timer( systimer_t* timer )
+{
+	UNREFERENCED_PARAM( timer );
+}
+
+bool set_window_event_handler( syswindow_t* window, wnd_event_cb cb, void* data )
+{
+	// Messages are decoded by the window procedure
+	UNREFERENCED_PARAM( window );
+	UNREFERENCED_PARAM( cb );
+	UNREFERENCED_PARAM( data );
+
+	return false;
+}
+
+void set_window_event_coalescing( syswindow_t* window, bool enable )
+{
+	// Windows already merges pending WM_MOUSEMOVE and WM_PAINT messages
+	UNREFERENCED_PARAM( window );
+	UNREFERENCED_PARAM( enable );
+}
+
+uint32 get_window_motion_history( syswindow_t* window, const window_motion_t** history )
+{
+	UNREFERENCED_PARAM( window );
+
+	*history = NULL;
+	return 0;
+}
+
+uint32 get_window_round_trips( syswindow_t* window )
+{
+	UNREFERENCED_PARAM( window );
+	return 0;
 }
 
 bool is_window_visible( syswindow_t* window )
@@ -192,6 +420,117 @@ void redraw_window( syswindow_t* window )
 	RedrawWindow( (HWND)window, NULL, NULL, RDW_INTERNALPAINT );
 }
 
+void invalidate_window_rect( syswindow_t* window, const window_rect_t* rect )
+{
+	RECT area;
+
+	if ( rect == NULL )
+	{
+		InvalidateRect( (HWND)window, NULL, FALSE );
+		return;
+	}
+
+	area.left = rect->x;
+	area.top = rect->y;
+	area.right = rect->x + rect->w;
+	area.bottom = rect->y + rect->h;
+
+	// Windows merges the update region and sends a single WM_PAINT for it
+	InvalidateRect( (HWND)window, &area, FALSE );
+}
+
+uint32 get_window_damage( syswindow_t* window, const window_rect_t** rects )
+{
+	UNREFERENCED_PARAM( window );
+
+	*rects = NULL;
+	return 0;
+}
+
+uint32* get_window_framebuffer( syswindow_t* window, uint16* width, uint16* height, uint32* pitch )
+{
+	sysframebuffer_t* fb;
+	BITMAPINFO info;
+	RECT rect;
+	void* pixels;
+
+	GetClientRect( (HWND)window, &rect );
+	fb = (sysframebuffer_t*)GetProp( (HWND)window, FRAMEBUFFER_PROP );
+
+	if ( fb == NULL || fb->width != rect.right || fb->height != rect.bottom )
+	{
+		if ( fb ) framebuffer_destroy( fb );
+
+		ZeroMemory( &info, sizeof(info) );
+		info.bmiHeader.biSize = sizeof(info.bmiHeader);
+		info.bmiHeader.biWidth = rect.right;
+		info.bmiHeader.biHeight = -rect.bottom; // Top-down
+		info.bmiHeader.biPlanes = 1;
+		info.bmiHeader.biBitCount = 32;
+		info.bmiHeader.biCompression = BI_RGB;
+
+		fb = (sysframebuffer_t*)mem_alloc_clean( sizeof(*fb) );
+		fb->bitmap = CreateDIBSection( NULL, &info, DIB_RGB_COLORS, &pixels, NULL, 0 );
+
+		if ( fb->bitmap == NULL )
+		{
+			mem_free( fb );
+			RemoveProp( (HWND)window, FRAMEBUFFER_PROP );
+			return NULL;
+		}
+
+		fb->dc = CreateCompatibleDC( NULL );
+		fb->old_bitmap = SelectObject( fb->dc, fb->bitmap );
+		fb->pixels = (uint32*)pixels;
+		fb->width = (uint16)rect.right;
+		fb->height = (uint16)rect.bottom;
+
+		SetProp( (HWND)window, FRAMEBUFFER_PROP, (HANDLE)fb );
+	}
+
+	// Pending blits must be done before the bitmap is written to again
+	GdiFlush();
+
+	*width = fb->width;
+	*height = fb->height;
+	*pitch = fb->width;
+
+	return fb->pixels;
+}
+
+void present_window_framebuffer( syswindow_t* window, const window_rect_t* rects, uint32 count )
+{
+	sysframebuffer_t* fb;
+	window_rect_t full;
+	int32 x, y, w, h;
+	uint32 i;
+	HDC dc;
+
+	fb = (sysframebuffer_t*)GetProp( (HWND)window, FRAMEBUFFER_PROP );
+	if ( fb == NULL ) return;
+
+	if ( count == 0 )
+	{
+		full.x = 0;
+		full.y = 0;
+		full.w = fb->width;
+		full.h = fb->height;
+
+		rects = &full;
+		count = 1;
+	}
+
+	dc = GetDC( (HWND)window );
+
+	for ( i = 0; i < count; ++i )
+	{
+		if ( clip_rect( &rects[i], fb->width, fb->height, &x, &y, &w, &h ) )
+			BitBlt( dc, x, y, w, h, fb->dc, x, y, SRCCOPY );
+	}
+
+	ReleaseDC( (HWND)window, dc );
+}
+
 #ifdef MYLLY_UNICODE
 UINT data_mode = CF_UNICODETEXT;
 #else
@@ -257,6 +596,63 @@ void clipboard_paste( syswindow_t* window, clip_paste_cb cb, void* cbdata )
 	cb( text, cbdata );
 }
 
+void clipboard_paste_stream( syswindow_t* window, clip_stream_cb cb, void* cbdata )
+{
+	HANDLE mem = NULL;
+	const char_t* data = NULL;
+
+	UNREFERENCED_PARAM( window );
+
+	if ( cb == NULL ) return;
+
+	if ( !OpenClipboard( NULL ) )
+	{
+		cb( NULL, 0, true, cbdata );
+		return;
+	}
+
+	if ( IsClipboardFormatAvailable( data_mode ) )
+	{
+		mem = GetClipboardData( data_mode );
+		data = mem ? (const char_t*)GlobalLock( mem ) : NULL;
+	}
+
+	// The clipboard memory is passed on as is, in a single chunk
+	if ( data )
+	{
+		cb( (const char*)data, mstrsize( data ) - sizeof(char_t), true, cbdata );
+		GlobalUnlock( mem );
+	}
+	else
+	{
+		cb( NULL, 0, true, cbdata );
+	}
+
+	CloseClipboard();
+}
+
+uint32 clipboard_request( syswindow_t* window, clip_stream_cb cb, void* cbdata, uint32 timeout )
+{
+	static uint32 next_id = 0;
+
+	// The clipboard is read right away, so the request is done by the time
+	// its id is returned
+	UNREFERENCED_PARAM( timeout );
+
+	if ( cb == NULL ) return 0;
+
+	clipboard_paste_stream( window, cb, cbdata );
+
+	if ( ++next_id == 0 ) next_id = 1;
+	return next_id;
+}
+
+bool clipboard_cancel( uint32 id )
+{
+	UNREFERENCED_PARAM( id );
+	return false;
+}
+
 void set_mouse_cursor( syswindow_t* window, MOUSECURSOR cursor )
 {
 	static HCURSOR cursors[NUM_CURSORS] = { NULL };
@@ -295,20 +691,159 @@ void set_mouse_cursor( syswindow_t* window, MOUSECURSOR cursor )
 	SetCursor( cursors[cursor] );
 }
 
-#else
+#elif !defined(MYLLY_USE_XCB)
 
 //////////////////////////////////////////////////////////////////////////
 // X11 implementation
 //////////////////////////////////////////////////////////////////////////
 
+// The XCB implementation is in WindowXcb.c
+
 #include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#define CLIP_MAX_ACTIVE 4	// Clipboard conversions in flight at once, each has a property of its own
+
+#define WINDOW_EVENT_MASK ( ExposureMask|KeyPressMask|KeyReleaseMask|PointerMotionMask|ButtonPressMask|ButtonReleaseMask|\
+							StructureNotifyMask|VisibilityChangeMask|PropertyChangeMask )
+
+typedef enum {
+	ATOM_CLIPBOARD,
+	ATOM_TARGETS,
+	ATOM_UTF8_STRING,
+	ATOM_INCR,
+	ATOM_WM_PROTOCOLS,
+	ATOM_WM_DELETE_WINDOW,
+	ATOM_MOTIF_WM_HINTS,
+	ATOM_MYLLY_SELECTION,
+	ATOM_MYLLY_SELECTION_LAST = ATOM_MYLLY_SELECTION + CLIP_MAX_ACTIVE - 1,
+	NUM_ATOMS
+} X11_ATOM;
+
+static char* atom_names[NUM_ATOMS] = {
+	"CLIPBOARD",
+	"TARGETS",
+	"UTF8_STRING",
+	"INCR",
+	"WM_PROTOCOLS",
+	"WM_DELETE_WINDOW",
+	"_MOTIF_WM_HINTS",
+	"MYLLY_SELECTION0",
+	"MYLLY_SELECTION1",
+	"MYLLY_SELECTION2",
+	"MYLLY_SELECTION3",
+};
 
-static Display*			display				= NULL;
-static uint32			display_refcount	= 0;
-static clip_paste_cb	paste_cb			= NULL;
-static void*			paste_data			= NULL;
-static size_t			clipbrd_buf_len		= 0;
-static char				clipbrd_buf[1024];
+// Everything shared by the windows of a display connection
+typedef struct sysdisplay_s {
+	Display*		display;
+	uint32			refcount;
+	uint32			round_trips;	// Blocking requests made through the connection
+	Atom			atoms[NUM_ATOMS];
+	Cursor			cursors[NUM_CURSORS];
+	int				shm_state;		// MIT-SHM support, 0 = not queried, 1 = usable, -1 = unusable
+	int				shm_completion;	// Event type of ShmCompletion
+	XContext		window_context;	// Maps window ids to syswindow_t
+	syswindow_t*	windows;		// Every window created on the display
+	XEvent*			batch;			// Events read during the current pump
+	uint32			batch_count;
+	uint32			batch_capacity;
+	uint32			batch_index;	// Next event of the batch to be dispatched
+	bool			pumping;
+	XIM				im;				// Input method, opened when the first event handler is set
+	bool			im_opened;
+	platform_event_t* events;		// Translated events waiting to be handed out
+	uint32			event_count;
+	uint32			event_capacity;
+} sysdisplay_t;
+
+typedef struct {
+	systimer_t*		timer;
+	event_timer_cb	cb;
+	void*			data;
+	bool			ticked;
+} event_timer_t;
+
+// Text larger than a single request is sent with the INCR protocol. The owner
+// announces the transfer and writes the next chunk each time the requestor
+// deletes the property, ending with an empty chunk.
+#define CLIP_CHUNK_MAX 262144
+
+typedef struct {
+	Window			requestor;
+	Atom			property;
+	Atom			type;
+	size_t			offset;			// Bytes of the text sent so far
+	bool			foreign;		// The requestor is not one of our windows
+	uint64			deadline;		// Ended if the requestor hasn't taken a chunk by then
+} clip_transfer_t;
+
+typedef enum {
+	CLIP_QUEUED,					// Waiting for a free property
+	CLIP_CONVERTING,				// Waiting for the owner to answer
+	CLIP_RECEIVING,					// Receiving INCR chunks
+} CLIP_STATE;
+
+typedef struct {
+	uint32			id;
+	syswindow_t*	window;
+	clip_stream_cb	cb;
+	void*			data;
+	uint64			deadline;		// In get_time_ns time, 0 if the request never expires
+	uint32			slot;			// Index of the property used for the conversion
+	CLIP_STATE		state;
+	Atom			target;
+} clip_request_t;
+
+typedef struct {
+	clip_paste_cb	cb;
+	void*			data;
+	char*			text;
+	size_t			length;
+	size_t			capacity;
+} paste_collect_t;
+
+typedef struct sysframebuffer_s {
+	XImage*			image;
+	XShmSegmentInfo	shm;
+	GC				gc;
+	bool			use_shm;
+	bool			pending;		// The server may still be reading the shared image
+	unsigned long	serial;			// Request the completion event is sent for
+	uint16			width;
+	uint16			height;
+} sysframebuffer_t;
+
+static sysdisplay_t		x11					= { NULL };
+static bool				shm_error			= false;
+static int				wakeup_fds[2]		= { -1, -1 };	// Read and write ends, the same eventfd on Linux
+static pthread_once_t	wakeup_once			= PTHREAD_ONCE_INIT;
+static event_timer_t*	timers				= NULL;
+static uint32			timer_count			= 0;
+static uint32			timer_capacity		= 0;
+static struct pollfd*	poll_fds			= NULL;
+static char*			clip_text			= NULL;	// Contents of the clipboard while we own it
+static size_t			clip_length			= 0;
+static clip_transfer_t*	clip_transfers		= NULL;	// Incremental transfers to other clients
+static uint32			clip_transfer_count	= 0;
+static uint32			clip_transfer_capacity = 0;
+static bool				clip_cleared		= false;	// Someone else took the clipboard during the transfers
+static clip_request_t*	clip_requests		= NULL;	// Pastes in the order they were requested
+static uint32			clip_request_count	= 0;
+static uint32			clip_request_capacity = 0;
+static uint32			clip_next_id		= 0;
+static uint32			clip_slots			= 0;	// Mask of the properties in use
 
 #define XC_X_cursor 0
 #define XC_crosshair 34
@@ -341,140 +876,1656 @@ enum
     MWM_FUNC_CLOSE		= 1 << 5,
 };
 
-syswindow_t* create_system_window( int32 x, int32 y, uint32 w, uint32 h, const char_t* title, bool decoration, wnd_message_cb cb )
+static sysdisplay_t* display_open( void )
 {
-	Window wnd;
-	int screen;
-	syswindow_t* window;
-	struct MWMHints hints;
-	Atom prop;
+	if ( x11.display == NULL )
+	{
+		x11.display = XOpenDisplay( NULL );
+		if ( x11.display == NULL ) return NULL;
 
-	if ( display == NULL ) display = XOpenDisplay( NULL );
-	if ( display == NULL ) return NULL;
+		// Intern every atom we need with a single round trip
+		XInternAtoms( x11.display, atom_names, NUM_ATOMS, False, x11.atoms );
+		x11.round_trips++;
 
-	display_refcount++; // Display reference count
+		x11.window_context = XUniqueContext();
+	}
 
-	screen = DefaultScreen( display );
-	wnd = XCreateSimpleWindow( display, RootWindow( display, screen ), x, y, w, h, decoration ? 1 : 0,
-							   BlackPixel( display, screen ), WhitePixel( display, screen ) );
+	x11.refcount++;
+	return &x11;
+}
 
-	XSelectInput( display, wnd, ExposureMask|KeyPressMask|KeyReleaseMask|PointerMotionMask|ButtonPressMask|ButtonReleaseMask );
-	XMapWindow( display, wnd );
-	XStoreName( display, wnd, title );
+static void display_close( sysdisplay_t* context )
+{
+	uint32 i;
 
-	window = mem_alloc( sizeof(*window) );
-	window->display = display;
-	window->window = wnd;
-	window->root = RootWindow( display, DefaultScreen( display ) );
-	window->cb = cb;
+	if ( --context->refcount > 0 ) return;
 
-	if ( !decoration )
+	for ( i = 0; i < NUM_CURSORS; ++i )
 	{
-		memset( &hints, 0, sizeof(hints) );
-		hints.flags = MWM_HINTS_DECORATIONS;
-		hints.decorations = 0;
+		if ( context->cursors[i] ) XFreeCursor( context->display, context->cursors[i] );
+	}
 
-		prop = XInternAtom( display, "_MOTIF_WM_HINTS", False );
+	if ( context->im ) XCloseIM( context->im );
 
-		XChangeProperty( display, wnd, prop, prop, 32, PropModeReplace, (uint8*)&hints, 5 );
-	}
+	XCloseDisplay( context->display );
+	mem_free( context->batch );
+	mem_free( context->events );
 
-	return window;
+	// Also ends a pump in progress if the last window was destroyed from a callback
+	memset( context, 0, sizeof(*context) );
 }
 
-void destroy_system_window( syswindow_t* window )
+static syswindow_t* display_find_window( sysdisplay_t* context, Window id )
 {
-	if ( window == NULL ) return;
+	XPointer window;
 
-	XDestroyWindow( window->display, window->window );
+	if ( XFindContext( context->display, id, context->window_context, &window ) != 0 ) return NULL;
+	return (syswindow_t*)window;
+}
 
-	if ( --display_refcount == 0 )
-		XCloseDisplay( window->display );
+static size_t clipboard_chunk_size( Display* display )
+{
+	size_t size;
 
-	mem_free( window );
+	// Leave room for the request header
+	size = (size_t)XMaxRequestSize( display ) * 4 - 256;
+	return size < CLIP_CHUNK_MAX ? size : CLIP_CHUNK_MAX;
 }
 
-void process_window_messages( syswindow_t* window, bool (*callback)(void*) )
+static bool clipboard_requestor_busy( Window requestor, uint32 except )
 {
-	XEvent event;
-
-	if ( window == NULL ) return;
+	uint32 i;
 
-	while ( XPending( window->display ) )
+	for ( i = 0; i < clip_transfer_count; ++i )
 	{
-		XNextEvent( window->display, &event );
-
-		if ( window->cb )
-			window->cb( &event );
-
-		else if ( callback )
-			callback( &event );
+		if ( i != except && clip_transfers[i].requestor == requestor ) return true;
 	}
+
+	return false;
 }
 
-bool is_window_visible( syswindow_t* window )
+static void clipboard_end_transfer( sysdisplay_t* context, uint32 index )
 {
-	XWindowAttributes xwa;
-	XGetWindowAttributes( window->display, window->window, &xwa );
+	clip_transfer_t* transfer = &clip_transfers[index];
+
+	// The requestor may be receiving another transfer on a different property
+	if ( transfer->foreign && !clipboard_requestor_busy( transfer->requestor, index ) )
+		XSelectInput( context->display, transfer->requestor, NoEventMask );
+
+	*transfer = clip_transfers[--clip_transfer_count];
 
-	return ( xwa.map_state == IsViewable );
+	// The text was only kept for the transfers
+	if ( clip_transfer_count == 0 && clip_cleared )
+	{
+		mem_free( clip_text );
+
+		clip_text = NULL;
+		clip_length = 0;
+		clip_cleared = false;
+	}
 }
 
-void window_pos_to_screen( syswindow_t* window, int16* x, int16* y )
+static bool clipboard_send( syswindow_t* window, Window requestor, Atom property, Atom target )
 {
-	int x_out, y_out;
-	Window child;
+	sysdisplay_t* context = window->context;
+	clip_transfer_t* transfer;
+	Atom targets[3];
+	long length;
 
-	if ( window == NULL )
+	if ( target == context->atoms[ATOM_TARGETS] )
 	{
-		*x = 0;
-		*y = 0;
-		return;
+		targets[0] = context->atoms[ATOM_TARGETS];
+		targets[1] = context->atoms[ATOM_UTF8_STRING];
+		targets[2] = XA_STRING;
+
+		XChangeProperty( window->display, requestor, property, XA_ATOM, 32, PropModeReplace, (uint8*)targets, 3 );
+		return true;
 	}
 
-	XTranslateCoordinates( window->display, window->window, window->root,
-						   (int32)*x, (int32)*y, &x_out, &y_out, &child );
+	if ( target != context->atoms[ATOM_UTF8_STRING] && target != XA_STRING ) return false;
+	if ( clip_text == NULL ) return false;
 
-	*x = (int16)x_out;
-	*y = (int16)y_out;
-}
+	if ( clip_length <= clipboard_chunk_size( window->display ) )
+	{
+		XChangeProperty( window->display, requestor, property, target, 8, PropModeReplace, (uint8*)clip_text, (int)clip_length );
+		return true;
+	}
 
-void get_window_pos( syswindow_t* window, int16* x, int16* y )
-{
-	int x_out, y_out;
-	Window child;
+	if ( clip_transfer_count == clip_transfer_capacity )
+	{
+		clip_transfer_capacity = clip_transfer_capacity ? 2 * clip_transfer_capacity : 4;
 
+		transfer = (clip_transfer_t*)mem_alloc( clip_transfer_capacity * sizeof(clip_transfer_t) );
+		if ( clip_transfer_count ) memcpy( transfer, clip_transfers, clip_transfer_count * sizeof(clip_transfer_t) );
 
-	if ( window == NULL )
-	{
-		*x = 0;
-		*y = 0;
-		return;
+		mem_free( clip_transfers );
+		clip_transfers = transfer;
 	}
 
-	XTranslateCoordinates( window->display, window->window, window->root,
-						   0, 0, &x_out, &y_out, &child );
+	transfer = &clip_transfers[clip_transfer_count++];
+	transfer->requestor = requestor;
+	transfer->property = property;
+	transfer->type = target;
+	transfer->offset = 0;
+	transfer->foreign = ( display_find_window( context, requestor ) == NULL );
+	transfer->deadline = get_time_ns() + (uint64)CLIPBOARD_TIMEOUT * 1000000;
 
-	*x = (int16)x_out;
-	*y = (int16)y_out;
+	// Our own windows already listen to property changes
+	if ( transfer->foreign )
+		XSelectInput( window->display, requestor, PropertyChangeMask );
+
+	// The announcement carries a lower bound of the size
+	length = (long)clip_length;
+	XChangeProperty( window->display, requestor, property, context->atoms[ATOM_INCR], 32, PropModeReplace, (uint8*)&length, 1 );
+
+	return true;
 }
 
-void set_window_pos( syswindow_t* window, int16 x, int16 y )
+static int32 clip_find_request( uint32 id )
 {
-	XWindowChanges xwc;
+	uint32 i;
 
-	if ( window == NULL ) return;
-
-	xwc.x = x;
-	xwc.y = y;
+	for ( i = 0; i < clip_request_count; ++i )
+	{
+		if ( clip_requests[i].id == id ) return (int32)i;
+	}
 
-	XConfigureWindow( window->display, window->window, CWX|CWY, &xwc );
+	return -1;
 }
 
-void get_window_size( syswindow_t* window, uint16* w, uint16* h )
+static void clip_remove_request( uint32 index )
 {
-	XWindowAttributes xwa;
+	if ( clip_requests[index].state != CLIP_QUEUED )
+		clip_slots &= ~( 1 << clip_requests[index].slot );
 
+	// Keep the order, requests are started first come first served
+	memmove( &clip_requests[index], &clip_requests[index + 1], ( clip_request_count - index - 1 ) * sizeof(clip_request_t) );
+	clip_request_count--;
+}
+
+static void clip_convert( clip_request_t* request )
+{
+	syswindow_t* window = request->window;
+
+	XConvertSelection( window->display, window->context->atoms[ATOM_CLIPBOARD], request->target,
+					   window->context->atoms[ATOM_MYLLY_SELECTION + request->slot], window->window, CurrentTime );
+	XFlush( window->display );
+}
+
+static void clip_start_requests( void )
+{
+	clip_request_t* request;
+	uint32 i, slot;
+
+	for ( i = 0; i < clip_request_count && clip_slots != ( 1 << CLIP_MAX_ACTIVE ) - 1; ++i )
+	{
+		request = &clip_requests[i];
+		if ( request->state != CLIP_QUEUED ) continue;
+
+		for ( slot = 0; clip_slots & ( 1 << slot ); ++slot ) {}
+
+		clip_slots |= 1 << slot;
+
+		request->slot = slot;
+		request->state = CLIP_CONVERTING;
+
+		// An owner of an abandoned conversion may still write to the property,
+		// clear it so a leftover value isn't mistaken for ours
+		XDeleteProperty( request->window->display, request->window->window,
+						 request->window->context->atoms[ATOM_MYLLY_SELECTION + slot] );
+
+		// Ask for UTF-8 first, clients which don't support it are asked for
+		// Latin-1 when they refuse
+		request->target = request->window->context->atoms[ATOM_UTF8_STRING];
+		clip_convert( request );
+	}
+}
+
+static void clip_finish( uint32 index, const char* chunk, size_t length )
+{
+	clip_request_t request = clip_requests[index];
+
+	// Let the next request in before the callback, which may queue more
+	clip_remove_request( index );
+	clip_start_requests();
+
+	request.cb( chunk, length, true, request.data );
+}
+
+static void clip_read_property( uint32 id )
+{
+	clip_request_t* request;
+	syswindow_t* window;
+	Atom type;
+	int format;
+	unsigned long items, remaining;
+	uint8* buf;
+	long offset = 0;
+	int32 index;
+
+	do
+	{
+		// A callback may have cancelled the request or moved it around
+		index = clip_find_request( id );
+		if ( index < 0 ) return;
+
+		request = &clip_requests[index];
+		window = request->window;
+
+		// Reading the whole property deletes it, which also tells an INCR
+		// owner to send the next chunk. Large properties are read and passed
+		// on a piece at a time.
+		if ( XGetWindowProperty( window->display, window->window, window->context->atoms[ATOM_MYLLY_SELECTION + request->slot],
+								 offset, CLIP_CHUNK_MAX / 4, True, AnyPropertyType, &type, &format, &items, &remaining, &buf ) != Success )
+		{
+			clip_finish( (uint32)index, NULL, 0 );
+			return;
+		}
+
+		window->context->round_trips++;
+
+		if ( type == window->context->atoms[ATOM_INCR] )
+		{
+			// The contents follow in chunks, each announced by a PropertyNotify
+			XFree( buf );
+			request->state = CLIP_RECEIVING;
+			return;
+		}
+
+		if ( format != 8 )
+		{
+			if ( buf ) XFree( buf );
+			clip_finish( (uint32)index, NULL, 0 );
+			return;
+		}
+
+		if ( request->state == CLIP_RECEIVING && items == 0 )
+		{
+			// An empty chunk ends the transfer
+			XFree( buf );
+			clip_finish( (uint32)index, "", 0 );
+			return;
+		}
+
+		if ( request->state != CLIP_RECEIVING && remaining == 0 )
+		{
+			clip_finish( (uint32)index, (const char*)buf, items );
+			XFree( buf );
+			return;
+		}
+
+		if ( items ) request->cb( (const char*)buf, items, false, request->data );
+
+		offset += (long)( items / 4 );
+		XFree( buf );
+	}
+	while ( remaining > 0 );
+}
+
+static void clip_check_timeouts( sysdisplay_t* context )
+{
+	uint64 now = 0;
+	uint32 i;
+
+	// Requestors which have died or stopped taking chunks
+	for ( i = clip_transfer_count; i > 0; --i )
+	{
+		if ( now == 0 ) now = get_time_ns();
+		if ( clip_transfers[i - 1].deadline <= now ) clipboard_end_transfer( context, i - 1 );
+	}
+
+	for ( i = 0; i < clip_request_count; )
+	{
+		if ( clip_requests[i].deadline == 0 )
+		{
+			++i;
+			continue;
+		}
+
+		if ( now == 0 ) now = get_time_ns();
+
+		if ( clip_requests[i].deadline <= now )
+		{
+			// The owner has stopped responding, start over as the callback may
+			// have changed the requests
+			clip_finish( i, NULL, 0 );
+			i = 0;
+			continue;
+		}
+
+		++i;
+	}
+}
+
+static uint64 clip_next_deadline( void )
+{
+	uint64 deadline = 0;
+	uint32 i;
+
+	for ( i = 0; i < clip_transfer_count; ++i )
+	{
+		if ( deadline == 0 || clip_transfers[i].deadline < deadline )
+			deadline = clip_transfers[i].deadline;
+	}
+
+	for ( i = 0; i < clip_request_count; ++i )
+	{
+		if ( clip_requests[i].deadline && ( deadline == 0 || clip_requests[i].deadline < deadline ) )
+			deadline = clip_requests[i].deadline;
+	}
+
+	return deadline;
+}
+
+static bool clipboard_filter_event( sysdisplay_t* context, const XEvent* event )
+{
+	const XPropertyEvent* property = &event->xproperty;
+	clip_transfer_t* transfer;
+	size_t length;
+	uint32 i;
+
+	if ( event->type != PropertyNotify ) return false;
+
+	for ( i = 0; i < clip_request_count; ++i )
+	{
+		if ( clip_requests[i].state != CLIP_RECEIVING || property->window != clip_requests[i].window->window ||
+			 property->atom != context->atoms[ATOM_MYLLY_SELECTION + clip_requests[i].slot] ) continue;
+
+		if ( property->state == PropertyNewValue ) clip_read_property( clip_requests[i].id );
+		return true;
+	}
+
+	if ( property->state != PropertyDelete ) return false;
+
+	for ( i = 0; i < clip_transfer_count; ++i )
+	{
+		transfer = &clip_transfers[i];
+		if ( transfer->requestor != property->window || transfer->property != property->atom ) continue;
+
+		// The requestor has taken the previous chunk. The chunks are written
+		// straight from the clipboard text.
+		length = clip_length - transfer->offset;
+		if ( length > clipboard_chunk_size( context->display ) ) length = clipboard_chunk_size( context->display );
+
+		XChangeProperty( context->display, transfer->requestor, transfer->property, transfer->type, 8, PropModeReplace,
+						 (uint8*)clip_text + transfer->offset, (int)length );
+
+		transfer->offset += length;
+		transfer->deadline = get_time_ns() + (uint64)CLIPBOARD_TIMEOUT * 1000000;
+
+		if ( length == 0 ) clipboard_end_transfer( context, i );
+		return true;
+	}
+
+	return false;
+}
+
+syswindow_t* create_system_window( int32 x, int32 y, uint32 w, uint32 h, const char_t* title, bool decoration, wnd_message_cb cb )
+{
+	Window wnd;
+	int screen;
+	syswindow_t* window;
+	sysdisplay_t* context;
+	Display* display;
+	struct MWMHints hints;
+
+	context = display_open();
+	if ( context == NULL ) return NULL;
+
+	display = context->display;
+	screen = DefaultScreen( display );
+	wnd = XCreateSimpleWindow( display, RootWindow( display, screen ), x, y, w, h, decoration ? 1 : 0,
+							   BlackPixel( display, screen ), WhitePixel( display, screen ) );
+
+	XSelectInput( display, wnd, WINDOW_EVENT_MASK );
+	XMapWindow( display, wnd );
+	XStoreName( display, wnd, title );
+
+	window = mem_alloc_clean( sizeof(*window) );
+	window->context = context;
+	window->display = display;
+	window->window = wnd;
+	window->root = RootWindow( display, DefaultScreen( display ) );
+	window->parent = window->root;
+	window->cb = cb;
+	window->x = (int16)x;
+	window->y = (int16)y;
+	window->width = (uint16)w;
+	window->height = (uint16)h;
+
+	XSaveContext( display, wnd, context->window_context, (XPointer)window );
+
+	window->next = context->windows;
+	context->windows = window;
+
+	if ( !decoration )
+	{
+		memset( &hints, 0, sizeof(hints) );
+		hints.flags = MWM_HINTS_DECORATIONS;
+		hints.decorations = 0;
+
+		XChangeProperty( display, wnd, context->atoms[ATOM_MOTIF_WM_HINTS], context->atoms[ATOM_MOTIF_WM_HINTS],
+						 32, PropModeReplace, (uint8*)&hints, 5 );
+	}
+
+	return window;
+}
+
+static int shm_error_handler( Display* display, XErrorEvent* error )
+{
+	UNREFERENCED_PARAM( display );
+	UNREFERENCED_PARAM( error );
+
+	shm_error = true;
+	return 0;
+}
+
+static bool framebuffer_completed( syswindow_t* window, const XEvent* event )
+{
+	// Completions of earlier presents may still be around, only the one for
+	// the latest present will do
+	return event->type == window->context->shm_completion && window->framebuffer &&
+		   ((const XShmCompletionEvent*)event)->drawable == window->window &&
+		   (long)( event->xany.serial - window->framebuffer->serial ) >= 0;
+}
+
+static Bool shm_completion_predicate( Display* display, XEvent* event, XPointer arg )
+{
+	UNREFERENCED_PARAM( display );
+	return framebuffer_completed( (syswindow_t*)arg, event );
+}
+
+static void framebuffer_wait( syswindow_t* window )
+{
+	sysdisplay_t* context = window->context;
+	XEvent event;
+	uint32 i;
+
+	if ( !window->framebuffer->pending ) return;
+
+	// When called from a callback, the completion may already have been moved
+	// from the Xlib queue to the batch being dispatched
+	for ( i = context->batch_index; i < context->batch_count; ++i )
+	{
+		if ( framebuffer_completed( window, &context->batch[i] ) )
+		{
+			window->framebuffer->pending = false;
+			return;
+		}
+	}
+
+	// Wait until the server has finished copying the previous present
+	XIfEvent( window->display, &event, shm_completion_predicate, (XPointer)window );
+	window->framebuffer->pending = false;
+}
+
+static bool framebuffer_attach_shm( syswindow_t* window, sysframebuffer_t* fb, Visual* visual, int depth )
+{
+	sysdisplay_t* context = window->context;
+	int ( *handler )( Display*, XErrorEvent* );
+
+	if ( context->shm_state == 0 )
+	{
+		context->shm_state = XShmQueryExtension( window->display ) ? 1 : -1;
+		context->shm_completion = XShmGetEventBase( window->display ) + ShmCompletion;
+		context->round_trips++;
+	}
+
+	if ( context->shm_state < 0 ) return false;
+
+	fb->image = XShmCreateImage( window->display, visual, (uint32)depth, ZPixmap, NULL, &fb->shm, fb->width, fb->height );
+	if ( fb->image == NULL ) return false;
+
+	fb->shm.shmid = shmget( IPC_PRIVATE, (size_t)fb->image->bytes_per_line * fb->height, IPC_CREAT|0600 );
+
+	if ( fb->shm.shmid < 0 )
+	{
+		XDestroyImage( fb->image );
+		return false;
+	}
+
+	fb->shm.shmaddr = fb->image->data = (char*)shmat( fb->shm.shmid, NULL, 0 );
+	fb->shm.readOnly = False;
+
+	if ( fb->shm.shmaddr == (char*)-1 )
+	{
+		shmctl( fb->shm.shmid, IPC_RMID, NULL );
+
+		fb->image->data = NULL;
+		XDestroyImage( fb->image );
+		return false;
+	}
+
+	// Attaching fails on remote displays, which is only reported as an error
+	// event. Sync to catch it and stop trying SHM on this display.
+	shm_error = false;
+	handler = XSetErrorHandler( shm_error_handler );
+
+	XShmAttach( window->display, &fb->shm );
+	XSync( window->display, False );
+	context->round_trips++;
+
+	XSetErrorHandler( handler );
+
+	// The segment is removed once both sides have detached
+	shmctl( fb->shm.shmid, IPC_RMID, NULL );
+
+	if ( shm_error )
+	{
+		shmdt( fb->shm.shmaddr );
+
+		fb->image->data = NULL;
+		XDestroyImage( fb->image );
+
+		context->shm_state = -1;
+		return false;
+	}
+
+	return true;
+}
+
+static void framebuffer_destroy( syswindow_t* window )
+{
+	sysframebuffer_t* fb = window->framebuffer;
+
+	if ( fb == NULL ) return;
+
+	if ( fb->use_shm )
+	{
+		framebuffer_wait( window );
+
+		XShmDetach( window->display, &fb->shm );
+		XSync( window->display, False );
+		window->context->round_trips++;
+
+		shmdt( fb->shm.shmaddr );
+	}
+	else
+	{
+		mem_free( fb->image->data );
+	}
+
+	// The pixel data has been released already
+	fb->image->data = NULL;
+	XDestroyImage( fb->image );
+	XFreeGC( window->display, fb->gc );
+
+	mem_free( fb );
+	window->framebuffer = NULL;
+}
+
+uint32* get_window_framebuffer( syswindow_t* window, uint16* width, uint16* height, uint32* pitch )
+{
+	sysframebuffer_t* fb;
+	Visual* visual;
+	int screen, depth;
+
+	if ( window == NULL ) return NULL;
+
+	fb = window->framebuffer;
+
+	if ( fb && ( fb->width != window->width || fb->height != window->height ) )
+	{
+		framebuffer_destroy( window );
+		fb = NULL;
+	}
+
+	if ( fb == NULL )
+	{
+		screen = DefaultScreen( window->display );
+		visual = DefaultVisual( window->display, screen );
+		depth = DefaultDepth( window->display, screen );
+
+		// Pixels are written as 32-bit RGB
+		if ( depth != 24 && depth != 32 ) return NULL;
+		if ( window->width == 0 || window->height == 0 ) return NULL;
+
+		fb = (sysframebuffer_t*)mem_alloc_clean( sizeof(*fb) );
+		fb->width = window->width;
+		fb->height = window->height;
+
+		fb->use_shm = framebuffer_attach_shm( window, fb, visual, depth );
+
+		if ( !fb->use_shm )
+		{
+			fb->image = XCreateImage( window->display, visual, (uint32)depth, ZPixmap, 0,
+									  (char*)mem_alloc( (size_t)fb->width * fb->height * 4 ),
+									  fb->width, fb->height, 32, fb->width * 4 );
+		}
+
+		fb->gc = XCreateGC( window->display, window->window, 0, NULL );
+		window->framebuffer = fb;
+	}
+
+	framebuffer_wait( window );
+
+	*width = fb->width;
+	*height = fb->height;
+	*pitch = (uint32)fb->image->bytes_per_line / 4;
+
+	return (uint32*)fb->image->data;
+}
+
+void present_window_framebuffer( syswindow_t* window, const window_rect_t* rects, uint32 count )
+{
+	sysframebuffer_t* fb;
+	window_rect_t full;
+	int32 x, y, w, h;
+	uint32 i, last;
+
+	if ( window == NULL ) return;
+
+	fb = window->framebuffer;
+	if ( fb == NULL ) return;
+
+	if ( count == 0 )
+	{
+		full.x = 0;
+		full.y = 0;
+		full.w = fb->width;
+		full.h = fb->height;
+
+		rects = &full;
+		count = 1;
+	}
+
+	// Find the last visible rectangle, only its copy needs a completion event
+	for ( last = count; last > 0; --last )
+	{
+		if ( clip_rect( &rects[last - 1], fb->width, fb->height, &x, &y, &w, &h ) ) break;
+	}
+
+	for ( i = 0; i < last; ++i )
+	{
+		if ( !clip_rect( &rects[i], fb->width, fb->height, &x, &y, &w, &h ) ) continue;
+
+		if ( fb->use_shm )
+		{
+			if ( i == last - 1 ) fb->serial = NextRequest( window->display );
+
+			XShmPutImage( window->display, window->window, fb->gc, fb->image,
+						  x, y, x, y, (uint32)w, (uint32)h, i == last - 1 ? True : False );
+		}
+		else
+		{
+			XPutImage( window->display, window->window, fb->gc, fb->image,
+					   x, y, x, y, (uint32)w, (uint32)h );
+		}
+	}
+
+	if ( last > 0 && fb->use_shm ) fb->pending = true;
+
+	XFlush( window->display );
+}
+
+void destroy_system_window( syswindow_t* window )
+{
+	syswindow_t** link;
+	uint32 i;
+
+	if ( window == NULL ) return;
+
+	// Pastes into the window fail
+	for ( i = 0; i < clip_request_count; )
+	{
+		if ( clip_requests[i].window == window )
+		{
+			clip_finish( i, NULL, 0 );
+			i = 0;
+			continue;
+		}
+
+		++i;
+	}
+
+	for ( i = clip_transfer_count; i > 0; --i )
+	{
+		if ( clip_transfers[i - 1].requestor == window->window ) clipboard_end_transfer( window->context, i - 1 );
+	}
+
+	framebuffer_destroy( window );
+
+	// Translated events not handed out yet are dropped
+	for ( i = 0; i < window->context->event_count; ++i )
+	{
+		if ( window->context->events[i].window == window ) window->context->events[i].window = NULL;
+	}
+
+	if ( window->ic ) XDestroyIC( window->ic );
+
+	// Events still queued for the window are passed on as unowned
+	XDeleteContext( window->display, window->window, window->context->window_context );
+
+	for ( link = &window->context->windows; *link != NULL; link = &(*link)->next )
+	{
+		if ( *link == window )
+		{
+			*link = window->next;
+			break;
+		}
+	}
+
+	XDestroyWindow( window->display, window->window );
+	display_close( window->context );
+
+	mem_free( window->motion );
+	mem_free( window );
+}
+
+static void window_update_cache( syswindow_t* window, const XEvent* event )
+{
+	if ( event->xany.window != window->window ) return;
+
+	switch ( event->type )
+	{
+	case ConfigureNotify:
+		window->width = (uint16)event->xconfigure.width;
+		window->height = (uint16)event->xconfigure.height;
+
+		// Real events are relative to the parent, which is the frame once the
+		// window manager has reparented us. It then sends synthetic events
+		// with root coordinates whenever the window moves.
+		if ( event->xconfigure.send_event || window->parent == window->root )
+		{
+			window->x = (int16)event->xconfigure.x;
+			window->y = (int16)event->xconfigure.y;
+		}
+		break;
+
+	case ReparentNotify:
+		window->parent = event->xreparent.parent;
+		break;
+
+	case MapNotify:
+		window->mapped = true;
+		break;
+
+	case UnmapNotify:
+		window->mapped = false;
+		break;
+
+	case VisibilityNotify:
+		window->obscured = ( event->xvisibility.state == VisibilityFullyObscured );
+		break;
+	}
+}
+
+static void window_dispatch( syswindow_t* window, XEvent* event, wnd_message_cb callback )
+{
+	window_update_cache( window, event );
+
+	if ( window->cb )
+		window->cb( event );
+
+	else if ( callback )
+		callback( event );
+}
+
+static platform_event_t* display_event_push( sysdisplay_t* context, syswindow_t* window, PLATFORM_EVENT type, uint32 time )
+{
+	platform_event_t* event;
+
+	if ( context->event_count == context->event_capacity )
+	{
+		context->event_capacity = context->event_capacity ? 2 * context->event_capacity : 64;
+
+		event = (platform_event_t*)mem_alloc( context->event_capacity * sizeof(platform_event_t) );
+		if ( context->event_count ) memcpy( event, context->events, context->event_count * sizeof(platform_event_t) );
+
+		mem_free( context->events );
+		context->events = event;
+	}
+
+	event = &context->events[context->event_count++];
+	memset( event, 0, sizeof(*event) );
+
+	event->type = (uint8)type;
+	event->time = time;
+	event->window = window;
+
+	return event;
+}
+
+static void display_flush_events( sysdisplay_t* context )
+{
+	platform_event_t* events;
+	syswindow_t* window;
+	uint32 i, count;
+
+	// Consecutive events of a window go out in a single call. Handlers may
+	// destroy windows, which clears the window of the events left behind, or
+	// close the display, which clears the whole array.
+	for ( i = 0; i < context->event_count; i += count )
+	{
+		events = &context->events[i];
+		window = events->window;
+
+		for ( count = 1; i + count < context->event_count && events[count].window == window; ++count ) {}
+
+		if ( window ) window->event_cb( events, count, window->event_data );
+	}
+
+	context->event_count = 0;
+}
+
+static uint8 event_modifiers( uint32 state )
+{
+	uint8 modifiers = 0;
+
+	if ( state & ShiftMask ) modifiers |= EVENT_MOD_SHIFT;
+	if ( state & ControlMask ) modifiers |= EVENT_MOD_CTRL;
+	if ( state & Mod1Mask ) modifiers |= EVENT_MOD_ALT;
+	if ( state & Mod4Mask ) modifiers |= EVENT_MOD_SUPER;
+
+	return modifiers;
+}
+
+static int keysym_to_utf8( KeySym keysym, char* text )
+{
+	uint32 code = 0;
+
+	// Latin-1 keysyms match their code points, Unicode keysyms carry theirs
+	if ( ( keysym >= 0x20 && keysym <= 0x7E ) || ( keysym >= 0xA0 && keysym <= 0xFF ) ) code = (uint32)keysym;
+	else if ( ( keysym & 0xFF000000 ) == 0x01000000 ) code = (uint32)( keysym & 0x00FFFFFF );
+
+	if ( code == 0 ) return 0;
+
+	if ( code < 0x80 )
+	{
+		text[0] = (char)code;
+		return 1;
+	}
+
+	if ( code < 0x800 )
+	{
+		text[0] = (char)( 0xC0 | ( code >> 6 ) );
+		text[1] = (char)( 0x80 | ( code & 0x3F ) );
+		return 2;
+	}
+
+	if ( code < 0x10000 )
+	{
+		text[0] = (char)( 0xE0 | ( code >> 12 ) );
+		text[1] = (char)( 0x80 | ( ( code >> 6 ) & 0x3F ) );
+		text[2] = (char)( 0x80 | ( code & 0x3F ) );
+		return 3;
+	}
+
+	text[0] = (char)( 0xF0 | ( code >> 18 ) );
+	text[1] = (char)( 0x80 | ( ( code >> 12 ) & 0x3F ) );
+	text[2] = (char)( 0x80 | ( ( code >> 6 ) & 0x3F ) );
+	text[3] = (char)( 0x80 | ( code & 0x3F ) );
+	return 4;
+}
+
+static void window_push_text( syswindow_t* window, const char* text, int length, uint8 modifiers, uint32 time )
+{
+	platform_event_t* event;
+	int size;
+
+	// Control characters produced by Return, Tab and such are left to the key events
+	if ( length == 1 && ( (uint8)text[0] < 0x20 || text[0] == 0x7F ) ) return;
+
+	while ( length > 0 )
+	{
+		size = length < EVENT_TEXT_MAX ? length : EVENT_TEXT_MAX;
+
+		// Don't split a character, continuation bytes are 10xxxxxx
+		if ( size < length )
+		{
+			while ( size > 1 && ( text[size] & 0xC0 ) == 0x80 ) --size;
+		}
+
+		event = display_event_push( window->context, window, EVENT_TEXT, time );
+		event->modifiers = modifiers;
+		event->text.length = (uint8)size;
+
+		memcpy( event->text.utf8, text, size );
+
+		text += size;
+		length -= size;
+	}
+}
+
+static void window_translate_key( syswindow_t* window, XKeyEvent* key )
+{
+	sysdisplay_t* context = window->context;
+	platform_event_t *event, *last;
+	char text[256];
+	KeySym keysym = NoSymbol;
+	Status status;
+	int length = 0;
+
+	if ( key->type == KeyPress && window->ic )
+	{
+		// A single lookup gives both the keysym and the text composed by the
+		// input method. Commits too long for the buffer are dropped.
+		length = Xutf8LookupString( window->ic, key, text, sizeof(text), &keysym, &status );
+
+		if ( status != XLookupKeySym && status != XLookupBoth ) keysym = NoSymbol;
+		if ( status != XLookupChars && status != XLookupBoth ) length = 0;
+	}
+	else
+	{
+		XLookupString( key, NULL, 0, &keysym, NULL );
+		if ( key->type == KeyPress && !( key->state & ControlMask ) ) length = keysym_to_utf8( keysym, text );
+	}
+
+	// Text committed by the input method comes without a key
+	if ( key->keycode != 0 )
+	{
+		last = context->event_count ? &context->events[context->event_count - 1] : NULL;
+
+		// Auto-repeat sends a release and a press with the same time, the
+		// release is replaced by the repeated press
+		if ( key->type == KeyPress && last && last->type == EVENT_KEY_UP && last->window == window &&
+			 last->key.keycode == key->keycode && last->time == (uint32)key->time )
+		{
+			context->event_count--;
+
+			event = display_event_push( context, window, EVENT_KEY_DOWN, (uint32)key->time );
+			event->key.repeat = true;
+		}
+		else
+		{
+			event = display_event_push( context, window, key->type == KeyPress ? EVENT_KEY_DOWN : EVENT_KEY_UP, (uint32)key->time );
+		}
+
+		event->modifiers = event_modifiers( key->state );
+		event->key.keysym = (uint32)keysym;
+		event->key.keycode = (uint16)key->keycode;
+	}
+
+	if ( length > 0 ) window_push_text( window, text, length, event_modifiers( key->state ), (uint32)key->time );
+}
+
+static bool window_translate( syswindow_t* window, XEvent* xevent )
+{
+	platform_event_t* event;
+	uint32 button;
+
+	if ( xevent->xany.window != window->window ) return false;
+
+	switch ( xevent->type )
+	{
+	case KeyPress:
+	case KeyRelease:
+		window_translate_key( window, &xevent->xkey );
+		return true;
+
+	case MotionNotify:
+		event = display_event_push( window->context, window, EVENT_POINTER, (uint32)xevent->xmotion.time );
+		event->modifiers = event_modifiers( xevent->xmotion.state );
+		event->pointer.x = (int16)xevent->xmotion.x;
+		event->pointer.y = (int16)xevent->xmotion.y;
+		return true;
+
+	case ButtonPress:
+	case ButtonRelease:
+		button = xevent->xbutton.button;
+
+		if ( button >= 4 && button <= 7 )
+		{
+			// Wheels click buttons 4 to 7, the releases don't tell anything new
+			if ( xevent->type == ButtonRelease ) return true;
+
+			event = display_event_push( window->context, window, EVENT_SCROLL, (uint32)xevent->xbutton.time );
+			event->scroll.x = (int16)xevent->xbutton.x;
+			event->scroll.y = (int16)xevent->xbutton.y;
+			event->scroll.dy = button == 4 ? 1 : button == 5 ? -1 : 0;
+			event->scroll.dx = button == 7 ? 1 : button == 6 ? -1 : 0;
+		}
+		else
+		{
+			event = display_event_push( window->context, window, xevent->type == ButtonPress ? EVENT_BUTTON_DOWN : EVENT_BUTTON_UP,
+										(uint32)xevent->xbutton.time );
+			event->button.x = (int16)xevent->xbutton.x;
+			event->button.y = (int16)xevent->xbutton.y;
+			event->button.button = (uint8)( button > 7 ? button - 4 : button );
+		}
+
+		event->modifiers = event_modifiers( xevent->xbutton.state );
+		return true;
+
+	case ConfigureNotify:
+		// Compared to the cache before it's updated from the event
+		if ( xevent->xconfigure.width != window->width || xevent->xconfigure.height != window->height )
+		{
+			event = display_event_push( window->context, window, EVENT_RESIZE, 0 );
+			event->resize.width = (uint16)xevent->xconfigure.width;
+			event->resize.height = (uint16)xevent->xconfigure.height;
+		}
+		return true;
+
+	case FocusIn:
+	case FocusOut:
+		// The pointer moving in and out of a focused window isn't a change
+		if ( xevent->xfocus.detail == NotifyPointer ) return true;
+
+		if ( window->ic )
+		{
+			if ( xevent->type == FocusIn ) XSetICFocus( window->ic );
+			else XUnsetICFocus( window->ic );
+		}
+
+		event = display_event_push( window->context, window, EVENT_FOCUS, 0 );
+		event->focus.focused = ( xevent->type == FocusIn );
+		return true;
+
+	case Expose:
+		event = display_event_push( window->context, window, EVENT_EXPOSE, 0 );
+		event->expose.x = (int16)xevent->xexpose.x;
+		event->expose.y = (int16)xevent->xexpose.y;
+		event->expose.w = (uint16)xevent->xexpose.width;
+		event->expose.h = (uint16)xevent->xexpose.height;
+		return true;
+
+	case ClientMessage:
+		if ( xevent->xclient.message_type != window->context->atoms[ATOM_WM_PROTOCOLS] ||
+			 (Atom)xevent->xclient.data.l[0] != window->context->atoms[ATOM_WM_DELETE_WINDOW] ) return false;
+
+		display_event_push( window->context, window, EVENT_CLOSE, 0 );
+		return true;
+	}
+
+	return false;
+}
+
+static void display_batch_push( sysdisplay_t* context, const XEvent* event )
+{
+	XEvent* batch;
+
+	if ( context->batch_count == context->batch_capacity )
+	{
+		context->batch_capacity = context->batch_capacity ? 2 * context->batch_capacity : 64;
+
+		batch = (XEvent*)mem_alloc( context->batch_capacity * sizeof(XEvent) );
+		if ( context->batch_count ) memcpy( batch, context->batch, context->batch_count * sizeof(XEvent) );
+
+		mem_free( context->batch );
+		context->batch = batch;
+	}
+
+	context->batch[context->batch_count++] = *event;
+}
+
+static void window_motion_push( syswindow_t* window, const XMotionEvent* event )
+{
+	window_motion_t* motion;
+
+	if ( window->motion_count == window->motion_capacity )
+	{
+		window->motion_capacity = window->motion_capacity ? 2 * window->motion_capacity : 64;
+
+		motion = (window_motion_t*)mem_alloc( window->motion_capacity * sizeof(window_motion_t) );
+		if ( window->motion_count ) memcpy( motion, window->motion, window->motion_count * sizeof(window_motion_t) );
+
+		mem_free( window->motion );
+		window->motion = motion;
+	}
+
+	motion = &window->motion[window->motion_count++];
+	motion->x = (int16)event->x;
+	motion->y = (int16)event->y;
+	motion->time = (uint32)event->time;
+}
+
+static bool rects_touch( const window_rect_t* a, const window_rect_t* b )
+{
+	return a->x <= b->x + b->w && b->x <= a->x + a->w &&
+		   a->y <= b->y + b->h && b->y <= a->y + a->h;
+}
+
+static void rect_union( window_rect_t* a, const window_rect_t* b )
+{
+	int32 x1, y1, x2, y2;
+
+	x1 = a->x < b->x ? a->x : b->x;
+	y1 = a->y < b->y ? a->y : b->y;
+	x2 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+	y2 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+
+	a->x = (int16)x1;
+	a->y = (int16)y1;
+	a->w = (uint16)( x2 - x1 );
+	a->h = (uint16)( y2 - y1 );
+}
+
+static void window_add_damage( syswindow_t* window, const window_rect_t* rect )
+{
+	window_rect_t area;
+	int32 x, y, w, h;
+	uint32 i;
+
+	if ( !clip_rect( rect, window->width, window->height, &x, &y, &w, &h ) ) return;
+
+	area.x = (int16)x;
+	area.y = (int16)y;
+	area.w = (uint16)w;
+	area.h = (uint16)h;
+
+	// Absorb every rectangle touching the new one. The grown area may touch
+	// rectangles already checked, so start over after each merge.
+	for ( i = 0; i < window->damage_count; )
+	{
+		if ( rects_touch( &window->damage[i], &area ) )
+		{
+			rect_union( &area, &window->damage[i] );
+			window->damage[i] = window->damage[--window->damage_count];
+			i = 0;
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	if ( window->damage_count == WINDOW_MAX_DAMAGE )
+	{
+		// Too fragmented, repaint the bounding box instead
+		for ( i = 0; i < window->damage_count; ++i )
+			rect_union( &area, &window->damage[i] );
+
+		window->damage_count = 0;
+	}
+
+	window->damage[window->damage_count++] = area;
+}
+
+static bool window_filter_expose( syswindow_t* window, const XEvent* event )
+{
+	window_rect_t rect;
+
+	if ( event->type != Expose || event->xexpose.window != window->window ) return false;
+
+	// Our own wakeup event, the damage is already recorded
+	if ( event->xexpose.send_event )
+	{
+		window->redraw_posted = false;
+		return true;
+	}
+
+	rect.x = (int16)event->xexpose.x;
+	rect.y = (int16)event->xexpose.y;
+	rect.w = (uint16)event->xexpose.width;
+	rect.h = (uint16)event->xexpose.height;
+
+	window_add_damage( window, &rect );
+	return true;
+}
+
+static void window_repaint( syswindow_t* window, wnd_message_cb callback )
+{
+	XEvent event;
+	window_rect_t bounds;
+	uint32 i;
+
+	if ( window->damage_count == 0 ) return;
+
+	// Hand the damage over to the repaint, anything invalidated while it is
+	// being handled goes to the next one
+	memcpy( window->repaint, window->damage, window->damage_count * sizeof(window_rect_t) );
+	window->repaint_count = window->damage_count;
+	window->damage_count = 0;
+
+	bounds = window->repaint[0];
+	for ( i = 1; i < window->repaint_count; ++i )
+		rect_union( &bounds, &window->repaint[i] );
+
+	memset( &event, 0, sizeof(event) );
+
+	event.xexpose.type = Expose;
+	event.xexpose.display = window->display;
+	event.xexpose.window = window->window;
+	event.xexpose.x = bounds.x;
+	event.xexpose.y = bounds.y;
+	event.xexpose.width = bounds.w;
+	event.xexpose.height = bounds.h;
+	event.xexpose.count = 0;
+
+	// The rectangles stay readable until the translated event has been handled
+	if ( window->event_cb && window_translate( window, &event ) ) return;
+
+	window_dispatch( window, &event, callback );
+	window->repaint_count = 0;
+}
+
+static void display_pump( sysdisplay_t* context, wnd_message_cb callback )
+{
+	syswindow_t *window, *next;
+	XEvent event;
+	XEvent* last;
+	uint32 i;
+	int count;
+
+	// A callback pumping the display again would see an empty queue anyway
+	if ( context->pumping ) return;
+	context->pumping = true;
+
+	for ( window = context->windows; window != NULL; window = window->next )
+		window->motion_count = 0;
+
+	// Drain everything the server has sent so far in one go and sort it out
+	// to the windows the events belong to
+	count = XEventsQueued( context->display, QueuedAfterFlush );
+	context->batch_count = 0;
+	context->batch_index = 0;
+
+	while ( count-- > 0 )
+	{
+		XNextEvent( context->display, &event );
+
+		// Events used by the input method to compose text
+		if ( context->im && XFilterEvent( &event, None ) ) continue;
+
+		if ( event.type == MappingNotify ) XRefreshKeyboardMapping( &event.xmapping );
+
+		window = display_find_window( context, event.xany.window );
+
+		// Callbacks earlier in the batch may wait for the framebuffer, the
+		// completion is noted before it gets there. The drawable is where the
+		// window is in other events.
+		if ( window && framebuffer_completed( window, &event ) ) window->framebuffer->pending = false;
+
+		if ( window && window_filter_expose( window, &event ) ) continue;
+
+		if ( window && window->coalesce && event.type == MotionNotify )
+		{
+			window_motion_push( window, &event.xmotion );
+
+			// Replace the previous event if it was motion in the same window
+			// with the same buttons held
+			last = context->batch_count ? &context->batch[context->batch_count - 1] : NULL;
+
+			if ( last && last->type == MotionNotify &&
+				 last->xmotion.window == event.xmotion.window &&
+				 last->xmotion.state == event.xmotion.state )
+			{
+				*last = event;
+				continue;
+			}
+		}
+
+		display_batch_push( context, &event );
+	}
+
+	// The owner is looked up again as callbacks may destroy windows. Closing
+	// the display clears the batch, which ends the loop.
+	for ( i = 0; i < context->batch_count; ++i )
+	{
+		context->batch_index = i + 1;
+
+		// Chunks of clipboard transfers are handled here
+		if ( clipboard_filter_event( context, &context->batch[i] ) ) continue;
+
+		window = display_find_window( context, context->batch[i].xany.window );
+
+		// Windows with an event handler get the events it knows about
+		// translated, and handed out together with the following ones
+		if ( window && window->event_cb && window_translate( window, &context->batch[i] ) )
+		{
+			window_update_cache( window, &context->batch[i] );
+			continue;
+		}
+
+		if ( context->event_count )
+		{
+			// Keep the order, the translated events go out before the packet
+			display_flush_events( context );
+			if ( context->batch_count == 0 ) break;
+
+			window = display_find_window( context, context->batch[i].xany.window );
+		}
+
+		if ( window )
+			window_dispatch( window, &context->batch[i], callback );
+
+		else if ( callback )
+			callback( &context->batch[i] );
+	}
+
+	display_flush_events( context );
+	context->batch_count = 0;
+
+	// Results handed over by other threads get painted in the same pump
+	run_window_tasks();
+	clip_check_timeouts( context );
+
+	for ( window = context->windows; window != NULL; window = next )
+	{
+		next = window->next;
+		window_repaint( window, callback );
+	}
+
+	display_flush_events( context );
+
+	for ( window = context->windows; window != NULL; window = window->next )
+		window->repaint_count = 0;
+
+	context->pumping = false;
+}
+
+void process_window_messages( syswindow_t* window, wnd_message_cb callback )
+{
+	if ( window == NULL ) return;
+	display_pump( window->context, callback );
+}
+
+void process_display_messages( wnd_message_cb callback )
+{
+	if ( x11.display == NULL )
+	{
+		run_window_tasks();
+		return;
+	}
+
+	display_pump( &x11, callback );
+}
+
+static void wakeup_create( void )
+{
+#ifdef __linux__
+	wakeup_fds[0] = wakeup_fds[1] = eventfd( 0, EFD_CLOEXEC|EFD_NONBLOCK );
+#else
+	if ( pipe( wakeup_fds ) == 0 )
+	{
+		fcntl( wakeup_fds[0], F_SETFL, O_NONBLOCK );
+		fcntl( wakeup_fds[1], F_SETFL, O_NONBLOCK );
+		fcntl( wakeup_fds[0], F_SETFD, FD_CLOEXEC );
+		fcntl( wakeup_fds[1], F_SETFD, FD_CLOEXEC );
+	}
+#endif
+}
+
+static void wakeup_drain( void )
+{
+	uint8 buf[64];
+
+	// An eventfd is reset by a single read, a pipe may hold several wakeups
+	while ( read( wakeup_fds[0], buf, sizeof(buf) ) > 0 ) {}
+}
+
+static void event_timers_dispatch( void )
+{
+	uint32 i;
+
+	// A callback may add or remove timers, so start over after each one
+	for ( i = 0; i < timer_count; )
+	{
+		if ( timers[i].ticked )
+		{
+			timers[i].ticked = false;
+			timers[i].cb( timers[i].timer, timers[i].data );
+
+			i = 0;
+			continue;
+		}
+
+		++i;
+	}
+}
+
+uint32 wait_for_events( uint32 timeout )
+{
+	uint32 result = 0, count = 0, i;
+	uint64 deadline, now;
+	int ret;
+
+	pthread_once( &wakeup_once, wakeup_create );
+
+	// Room for the display connection and the wakeup descriptor
+	if ( poll_fds == NULL ) poll_fds = (struct pollfd*)mem_alloc_clean( 2 * sizeof(struct pollfd) );
+
+	// Return in time for the pump to expire clipboard requests and transfers
+	deadline = clip_next_deadline();
+
+	if ( deadline )
+	{
+		now = get_time_ns();
+		now = deadline > now ? ( deadline - now + 999999 ) / 1000000 : 0;
+
+		if ( now < timeout ) timeout = (uint32)now;
+	}
+
+	if ( x11.display != NULL )
+	{
+		// Replies to earlier requests may have queued events already, those
+		// won't show up on the socket
+		XFlush( x11.display );
+
+		if ( XEventsQueued( x11.display, QueuedAlready ) > 0 )
+		{
+			result |= WAKE_EVENTS;
+			timeout = 0;
+		}
+
+		poll_fds[count].fd = ConnectionNumber( x11.display );
+		poll_fds[count++].events = POLLIN;
+	}
+
+	if ( wakeup_fds[0] >= 0 )
+	{
+		poll_fds[count].fd = wakeup_fds[0];
+		poll_fds[count++].events = POLLIN;
+	}
+
+	for ( i = 0; i < timer_count; ++i )
+	{
+		poll_fds[count].fd = systimer_get_fd( timers[i].timer );
+		poll_fds[count++].events = POLLIN;
+	}
+
+	ret = poll( poll_fds, count, timeout == SYNC_INFINITE ? -1 : (int)timeout );
+
+	// Interrupted by a signal, report it as an early timeout
+	if ( ret <= 0 ) return result;
+
+	count = 0;
+
+	if ( x11.display != NULL && poll_fds[count++].revents )
+		result |= WAKE_EVENTS;
+
+	if ( wakeup_fds[0] >= 0 && poll_fds[count++].revents )
+	{
+		wakeup_drain();
+		result |= WAKE_POSTED;
+	}
+
+	for ( i = 0; i < timer_count; ++i )
+	{
+		if ( poll_fds[count++].revents == 0 ) continue;
+
+		// Consumes the tick without blocking and updates the timer's delta
+		systimer_wait_ns( timers[i].timer, true );
+
+		timers[i].ticked = true;
+		result |= WAKE_TIMER;
+	}
+
+	if ( result & WAKE_TIMER ) event_timers_dispatch();
+
+	return result;
+}
+
+void wake_event_loop( void )
+{
+	uint64 value = 1;
+
+	pthread_once( &wakeup_once, wakeup_create );
+
+	// A full pipe or eventfd means the loop is going to wake up anyway
+	if ( write( wakeup_fds[1], &value, sizeof(value) ) < 0 ) return;
+}
+
+bool add_event_timer( systimer_t* timer, event_timer_cb cb, void* data )
+{
+	event_timer_t* array;
+	uint32 i;
+
+	if ( timer == NULL || cb == NULL ) return false;
+	if ( systimer_get_fd( timer ) < 0 ) return false;
+
+	for ( i = 0; i < timer_count; ++i )
+	{
+		if ( timers[i].timer == timer ) return false;
+	}
+
+	if ( timer_count == timer_capacity )
+	{
+		timer_capacity = timer_capacity ? 2 * timer_capacity : 8;
+
+		array = (event_timer_t*)mem_alloc( timer_capacity * sizeof(event_timer_t) );
+		if ( timer_count ) memcpy( array, timers, timer_count * sizeof(event_timer_t) );
+
+		mem_free( timers );
+		timers = array;
+
+		// Room for the display connection and the wakeup descriptor as well
+		mem_free( poll_fds );
+		poll_fds = (struct pollfd*)mem_alloc_clean( ( timer_capacity + 2 ) * sizeof(struct pollfd) );
+	}
+
+	timers[timer_count].timer = timer;
+	timers[timer_count].cb = cb;
+	timers[timer_count].data = data;
+	timers[timer_count].ticked = false;
+
+	timer_count++;
+	return true;
+}
+
+void remove_event_timer( systimer_t* timer )
+{
+	uint32 i;
+
+	for ( i = 0; i < timer_count; ++i )
+	{
+		if ( timers[i].timer == timer )
+		{
+			// Keep the order, timers are dispatched in the order they were added
+			memmove( &timers[i], &timers[i + 1], ( timer_count - i - 1 ) * sizeof(event_timer_t) );
+			timer_count--;
+			return;
+		}
+	}
+}
+
+bool set_window_event_handler( syswindow_t* window, wnd_event_cb cb, void* data )
+{
+	sysdisplay_t* context;
+	unsigned long filter = 0;
+
+	if ( window == NULL ) return false;
+
+	context = window->context;
+
+	window->event_cb = cb;
+	window->event_data = data;
+
+	if ( cb == NULL )
+	{
+		XSelectInput( window->display, window->window, WINDOW_EVENT_MASK );
+		return true;
+	}
+
+	if ( !context->im_opened )
+	{
+		// Composing text needs the locale to be set by the application,
+		// without an input method keys are looked up on their own
+		context->im_opened = true;
+
+		XSetLocaleModifiers( "" );
+		context->im = XOpenIM( window->display, NULL, NULL, NULL );
+	}
+
+	if ( context->im && window->ic == NULL )
+	{
+		window->ic = XCreateIC( context->im, XNInputStyle, XIMPreeditNothing|XIMStatusNothing,
+								XNClientWindow, window->window, XNFocusWindow, window->window, NULL );
+	}
+
+	// The input method may need events of its own
+	if ( window->ic ) XGetICValues( window->ic, XNFilterEvents, &filter, NULL );
+
+	XSelectInput( window->display, window->window, WINDOW_EVENT_MASK|FocusChangeMask|(long)filter );
+
+	// Closing the window is left to us rather than the window manager
+	XSetWMProtocols( window->display, window->window, &context->atoms[ATOM_WM_DELETE_WINDOW], 1 );
+	XFlush( window->display );
+
+	return true;
+}
+
+void set_window_event_coalescing( syswindow_t* window, bool enable )
+{
+	if ( window == NULL ) return;
+	window->coalesce = enable;
+}
+
+uint32 get_window_motion_history( syswindow_t* window, const window_motion_t** history )
+{
+	if ( window == NULL )
+	{
+		*history = NULL;
+		return 0;
+	}
+
+	*history = window->motion;
+	return window->motion_count;
+}
+
+bool is_window_visible( syswindow_t* window )
+{
+	if ( window == NULL ) return false;
+	return window->mapped && !window->obscured;
+}
+
+uint32 get_window_round_trips( syswindow_t* window )
+{
+	if ( window == NULL ) return 0;
+	return window->context->round_trips;
+}
+
+void window_pos_to_screen( syswindow_t* window, int16* x, int16* y )
+{
+	if ( window == NULL )
+	{
+		*x = 0;
+		*y = 0;
+		return;
+	}
+
+	*x += window->x;
+	*y += window->y;
+}
+
+void get_window_pos( syswindow_t* window, int16* x, int16* y )
+{
+	if ( window == NULL )
+	{
+		*x = 0;
+		*y = 0;
+		return;
+	}
+
+	*x = window->x;
+	*y = window->y;
+}
+
+void set_window_pos( syswindow_t* window, int16 x, int16 y )
+{
+	XWindowChanges xwc;
+
+	if ( window == NULL ) return;
+
+	xwc.x = x;
+	xwc.y = y;
+
+	XConfigureWindow( window->display, window->window, CWX|CWY, &xwc );
+}
+
+void get_window_size( syswindow_t* window, uint16* w, uint16* h )
+{
 	if ( window == NULL )
 	{
 		*w = 0;
@@ -482,10 +2533,8 @@ void get_window_size( syswindow_t* window, uint16* w, uint16* h )
 		return;
 	}
 
-	XGetWindowAttributes( window->display, window->window, &xwa );
-
-	*w = (uint16)xwa.width;
-	*h = (uint16)xwa.height;
+	*w = window->width;
+	*h = window->height;
 }
 
 void set_window_size( syswindow_t* window, uint16 w, uint16 h )
@@ -502,68 +2551,182 @@ void set_window_size( syswindow_t* window, uint16 w, uint16 h )
 
 void get_window_drawable_size( syswindow_t* window, uint16* width, uint16* height )
 {
-	int32 x, y;
-	uint32 w, h, border, depth;
-	Window root;
-
-	XGetGeometry( window->display, window->window, &root, &x, &y, &w, &h, &border, &depth );
-
-	*width = (uint16)w;
-	*height = (uint16)h;
+	// The cached size excludes the border, same as the drawable
+	get_window_size( window, width, height );
 }
 
 void redraw_window( syswindow_t* window )
 {
-	XWindowAttributes xwa;
+	invalidate_window_rect( window, NULL );
+}
+
+void invalidate_window_rect( syswindow_t* window, const window_rect_t* rect )
+{
 	XExposeEvent event;
+	window_rect_t full;
 
 	if ( window == NULL ) return;
 
-	XGetWindowAttributes( window->display, window->window, &xwa );
+	if ( rect == NULL )
+	{
+		full.x = 0;
+		full.y = 0;
+		full.w = window->width;
+		full.h = window->height;
+
+		rect = &full;
+	}
+
+	window_add_damage( window, rect );
+
+	// Wake up the event loop once, further invalidations before the repaint
+	// only grow the damage
+	if ( window->damage_count == 0 || window->redraw_posted ) return;
+
+	memset( &event, 0, sizeof(event) );
 
 	event.type = Expose;
-	event.serial = 0;
 	event.send_event = True;
 	event.display = window->display;
 	event.window = window->window;
-	event.x = 0;
-	event.y = 0;
-	event.width = xwa.width;
-	event.height = xwa.height;
 	event.count = 0;
 
 	XSendEvent( window->display, window->window, False, ExposureMask, (XEvent*)&event );
+	XFlush( window->display );
+
+	window->redraw_posted = true;
 }
 
-void clipboard_copy( syswindow_t* window, const char_t* text )
+uint32 get_window_damage( syswindow_t* window, const window_rect_t** rects )
 {
-	Atom atom;
+	if ( window == NULL )
+	{
+		*rects = NULL;
+		return 0;
+	}
+
+	*rects = window->repaint;
+	return window->repaint_count;
+}
 
+void clipboard_copy( syswindow_t* window, const char_t* text )
+{
 	if ( window == NULL ) return;
 	if ( text == NULL ) return;
 
-	atom = XInternAtom( window->display, "CLIPBOARD", True );
-	if ( atom == None ) return;
+	// Transfers still in progress would read the new text
+	clip_cleared = false;
+	while ( clip_transfer_count ) clipboard_end_transfer( window->context, 0 );
+
+	mem_free( clip_text );
+
+	clip_length = mstrlen( text );
+	clip_text = (char*)mem_alloc( clip_length + 1 );
+
+	memcpy( clip_text, text, clip_length + 1 );
+
+	XSetSelectionOwner( window->display, window->context->atoms[ATOM_CLIPBOARD], window->window, CurrentTime );
+	XFlush( window->display );
+}
+
+static void paste_collect( const char* chunk, size_t length, bool last, void* data )
+{
+	paste_collect_t* collect = (paste_collect_t*)data;
+	char* text;
+
+	if ( chunk && collect->length + length + 1 > collect->capacity )
+	{
+		collect->capacity = collect->capacity ? 2 * collect->capacity : 1024;
+		while ( collect->capacity < collect->length + length + 1 ) collect->capacity *= 2;
+
+		text = (char*)mem_alloc( collect->capacity );
+		if ( collect->length ) memcpy( text, collect->text, collect->length );
+
+		mem_free( collect->text );
+		collect->text = text;
+	}
+
+	if ( chunk )
+	{
+		memcpy( collect->text + collect->length, chunk, length );
+		collect->length += length;
+		collect->text[collect->length] = 0;
+	}
+
+	if ( !last ) return;
 
-	mstrcpy( (char_t*)clipbrd_buf, text, sizeof(clipbrd_buf)/sizeof(char_t) );
-	clipbrd_buf_len = mstrlen( text );
+	if ( collect->cb ) collect->cb( chunk ? collect->text : NULL, collect->data );
 
-	XSetSelectionOwner( window->display, atom, window->window, CurrentTime );
+	mem_free( collect->text );
+	mem_free( collect );
 }
 
 void clipboard_paste( syswindow_t* window, clip_paste_cb cb, void* data )
 {
-	Atom atom;
+	paste_collect_t* collect;
 
 	if ( window == NULL ) return;
 
-	atom = XInternAtom( window->display, "CLIPBOARD", True );
-	if ( atom == None ) return;
+	collect = (paste_collect_t*)mem_alloc_clean( sizeof(*collect) );
+	collect->cb = cb;
+	collect->data = data;
+
+	clipboard_paste_stream( window, paste_collect, collect );
+}
+
+void clipboard_paste_stream( syswindow_t* window, clip_stream_cb cb, void* data )
+{
+	clipboard_request( window, cb, data, CLIPBOARD_TIMEOUT );
+}
+
+uint32 clipboard_request( syswindow_t* window, clip_stream_cb cb, void* data, uint32 timeout )
+{
+	clip_request_t* request;
+
+	if ( window == NULL ) return 0;
+	if ( cb == NULL ) return 0;
+
+	if ( clip_request_count == clip_request_capacity )
+	{
+		clip_request_capacity = clip_request_capacity ? 2 * clip_request_capacity : 8;
+
+		request = (clip_request_t*)mem_alloc( clip_request_capacity * sizeof(clip_request_t) );
+		if ( clip_request_count ) memcpy( request, clip_requests, clip_request_count * sizeof(clip_request_t) );
+
+		mem_free( clip_requests );
+		clip_requests = request;
+	}
+
+	if ( ++clip_next_id == 0 ) clip_next_id = 1;
+
+	request = &clip_requests[clip_request_count++];
+	request->id = clip_next_id;
+	request->window = window;
+	request->cb = cb;
+	request->data = data;
+	request->deadline = timeout == SYNC_INFINITE ? 0 : get_time_ns() + (uint64)timeout * 1000000;
+	request->slot = 0;
+	request->state = CLIP_QUEUED;
+	request->target = None;
 
-	paste_cb = cb;
-	paste_data = data;
+	clip_start_requests();
 
-	XConvertSelection( window->display, atom, XA_STRING, XA_STRING, window->window, CurrentTime );
+	return clip_next_id;
+}
+
+bool clipboard_cancel( uint32 id )
+{
+	int32 index;
+
+	index = clip_find_request( id );
+	if ( index < 0 ) return false;
+
+	// Whatever the owner still sends ends up in a property which is cleared
+	// before it's used again
+	clip_remove_request( (uint32)index );
+	clip_start_requests();
+
+	return true;
 }
 
 void clipboard_handle_event( syswindow_t* window, void* packet )
@@ -571,10 +2734,9 @@ void clipboard_handle_event( syswindow_t* window, void* packet )
 	XSelectionEvent* event;
 	XSelectionRequestEvent* select;
 	XEvent response;
-	Atom type;
-	int32 format;
-	unsigned long items, bytes;
-	uint8* buf;
+	Atom property;
+	clip_request_t* request;
+	uint32 i;
 
 	if ( window == NULL ) return;
 	event = (XSelectionEvent*)packet;
@@ -582,30 +2744,40 @@ void clipboard_handle_event( syswindow_t* window, void* packet )
 	switch ( event->type )
 	{
 	case SelectionNotify:
-		if ( event->property == None )
+		// Find the conversion this answers, by the property or by the target
+		// when the owner refused
+		for ( i = 0; i < clip_request_count; ++i )
 		{
-			if ( paste_cb ) paste_cb( NULL, paste_data );
+			request = &clip_requests[i];
+			if ( request->window != window || request->state != CLIP_CONVERTING ) continue;
 
-			paste_cb = NULL;
-			paste_data = NULL;
-			break;
+			if ( event->property == None ? event->target == request->target :
+				 event->property == window->context->atoms[ATOM_MYLLY_SELECTION + request->slot] ) break;
 		}
 
-		XGetWindowProperty( window->display, window->window, event->property,
-							0, (~0L), False, AnyPropertyType, &type, &format,
-							&items, &bytes, &buf );
+		if ( i == clip_request_count ) break;
+
+		if ( event->property != None )
+		{
+			clip_read_property( request->id );
+			break;
+		}
 
-		paste_cb( (const char*)buf, paste_data );
+		if ( request->target == window->context->atoms[ATOM_UTF8_STRING] )
+		{
+			request->target = XA_STRING;
+			clip_convert( request );
+			break;
+		}
 
-		paste_cb = NULL;
-		paste_data = NULL;
+		clip_finish( i, NULL, 0 );
 		break;
 
 	case SelectionRequest:
 		select = (XSelectionRequestEvent*)event;
 
-		XChangeProperty( window->display, select->requestor, select->property,
-						 select->target, 8, PropModeReplace, (uint8*)clipbrd_buf, (int32)clipbrd_buf_len );
+		// Obsolete clients leave the property out
+		property = select->property != None ? select->property : select->target;
 
 		memset( &response, 0, sizeof(response) );
 
@@ -616,19 +2788,39 @@ void clipboard_handle_event( syswindow_t* window, void* packet )
 		response.xselection.selection = select->selection;
 		response.xselection.target = select->target;
 		response.xselection.time = select->time;
-		response.xselection.property = select->property;
+		response.xselection.property = clipboard_send( window, select->requestor, property, select->target ) ? property : None;
 
 		XSendEvent( window->display, select->requestor, False, NoEventMask, &response );
+		XFlush( window->display );
+		break;
+
+	case SelectionClear:
+		// Someone else owns the clipboard now, keep the text only for the
+		// transfers still in progress
+		if ( clip_transfer_count == 0 )
+		{
+			mem_free( clip_text );
+
+			clip_text = NULL;
+			clip_length = 0;
+		}
+		else
+		{
+			clip_cleared = true;
+		}
 		break;
 	}
 }
 
 void set_mouse_cursor( syswindow_t* window, MOUSECURSOR cursor )
 {
-	static Cursor cursors[NUM_CURSORS] = { 0 };
+	Cursor* cursors;
 
+	if ( window == NULL ) return;
 	if ( cursor >= NUM_CURSORS ) return;
 
+	cursors = window->context->cursors;
+
 	if ( !cursors[cursor] )
 	{
 		// The cursor needs to be loaded first
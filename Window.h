@@ -16,6 +16,7 @@
 #ifndef MYLLY_PLATFORM_MINIMAL
 
 #include "stdtypes.h"
+#include "Platform/Timer.h"
 
 typedef enum {
 	CURSOR_ARROW,
@@ -26,33 +27,198 @@ typedef enum {
 	NUM_CURSORS
 } MOUSECURSOR;
 
+typedef struct {
+	int16 x;
+	int16 y;
+	uint32 time;
+} window_motion_t;
+
+typedef struct {
+	int16 x;
+	int16 y;
+	uint16 w;
+	uint16 h;
+} window_rect_t;
+
+typedef enum {
+	WAKE_EVENTS		= 1 << 0,	// Window events are ready to be processed
+	WAKE_TIMER		= 1 << 1,	// A timer added to the event loop has ticked
+	WAKE_POSTED		= 1 << 2,	// wake_event_loop was called
+} WAKE_REASON;
+
+// The comments name the member of platform_event_t holding the details
+typedef enum {
+	EVENT_KEY_DOWN,				// key
+	EVENT_KEY_UP,				// key
+	EVENT_TEXT,					// text
+	EVENT_POINTER,				// pointer
+	EVENT_BUTTON_DOWN,			// button
+	EVENT_BUTTON_UP,			// button
+	EVENT_SCROLL,				// scroll
+	EVENT_RESIZE,				// resize
+	EVENT_FOCUS,				// focus
+	EVENT_EXPOSE,				// expose
+	EVENT_CLOSE,				// The user asked to close the window
+} PLATFORM_EVENT;
+
+typedef enum {
+	EVENT_MOD_SHIFT		= 1 << 0,
+	EVENT_MOD_CTRL		= 1 << 1,
+	EVENT_MOD_ALT		= 1 << 2,
+	EVENT_MOD_SUPER		= 1 << 3,
+} EVENT_MODIFIER;
+
+struct sysframebuffer_s;
+struct platform_event_s;
+
+#define WINDOW_MAX_DAMAGE 16	// Damage rectangles kept before they are merged into one
+#define WINDOW_TASK_QUEUE_SIZE 1024
+#define CLIPBOARD_TIMEOUT 5000	// Milliseconds clipboard_paste waits for the owner
+#define EVENT_TEXT_MAX 15		// Bytes of UTF-8 carried by a single text event
+
 typedef void ( *clip_paste_cb )( const char* pasted, void* data );
+typedef void ( *clip_stream_cb )( const char* chunk, size_t length, bool last, void* data );
 typedef bool ( *wnd_message_cb )( void* packet );
+typedef void ( *event_timer_cb )( systimer_t* timer, void* data );
+typedef void ( *window_task_cb )( void* arg );
+typedef void ( *wnd_event_cb )( const struct platform_event_s* events, uint32 count, void* data );
 
 #ifdef _WIN32
 
 typedef void syswindow_t;
 
+#elif defined(MYLLY_USE_XCB)
+
+#include <xcb/xcb.h>
+
+struct sysdisplay_s;
+
+typedef struct syswindow_t {
+	struct sysdisplay_s* context;		// Shared state of the display connection
+	struct syswindow_t* next;			// Next window in the same lookup bucket
+	xcb_connection_t* connection;
+	xcb_window_t window;
+	xcb_window_t root;
+	xcb_window_t parent;				// Frame window when reparented by the window manager
+	wnd_message_cb cb;
+	int16 x, y;							// Geometry cache, updated from structure events
+	uint16 width, height;
+	bool mapped;
+	bool obscured;
+	bool translate_pending;				// Root position has been requested
+	uint32 translate_request;
+	bool coalesce;						// Merge consecutive pointer motion events
+	window_motion_t* motion;			// Pointer positions merged into the last motion event
+	uint32 motion_count;
+	uint32 motion_capacity;
+	struct sysframebuffer_s* framebuffer;	// Software framebuffer, created on first use
+	window_rect_t damage[WINDOW_MAX_DAMAGE];	// Areas invalidated since the last repaint
+	uint32 damage_count;
+	window_rect_t repaint[WINDOW_MAX_DAMAGE];	// Areas of the repaint being dispatched
+	uint32 repaint_count;
+	bool redraw_posted;					// A wakeup expose event is on its way
+	wnd_event_cb event_cb;				// Receives translated events instead of cb
+	void* event_data;
+} syswindow_t;
+
 #else
 
 #include <X11/Xlib.h>
 
+struct sysdisplay_s;
+
 typedef struct syswindow_t {
+	struct sysdisplay_s* context;		// Shared state of the display connection
+	struct syswindow_t* next;			// Next window on the same display
 	Display* display;
 	Window window;
 	Window root;
+	Window parent;						// Frame window when reparented by the window manager
 	wnd_message_cb cb;
+	int16 x, y;							// Geometry cache, updated from structure events
+	uint16 width, height;
+	bool mapped;
+	bool obscured;
+	bool coalesce;						// Merge consecutive pointer motion events
+	window_motion_t* motion;			// Pointer positions merged into the last motion event
+	uint32 motion_count;
+	uint32 motion_capacity;
+	struct sysframebuffer_s* framebuffer;	// Software framebuffer, created on first use
+	window_rect_t damage[WINDOW_MAX_DAMAGE];	// Areas invalidated since the last repaint
+	uint32 damage_count;
+	window_rect_t repaint[WINDOW_MAX_DAMAGE];	// Areas of the repaint being dispatched
+	uint32 repaint_count;
+	bool redraw_posted;					// A wakeup expose event is on its way
+	XIC ic;								// Input context, when the input method could be opened
+	wnd_event_cb event_cb;				// Receives translated events instead of cb
+	void* event_data;
 } syswindow_t;
 
 #endif
 
+// Events are translated from the native ones once, while pumping the display,
+// and handed out in batches. Each one is 32 bytes on 64-bit systems.
+typedef struct platform_event_s {
+	uint8			type;			// PLATFORM_EVENT
+	uint8			modifiers;		// EVENT_MODIFIERs held when the event happened
+	uint16			reserved;
+	uint32			time;			// Milliseconds, in the clock of the window system
+	syswindow_t*	window;
+	union {
+		struct { uint32 keysym; uint16 keycode; bool repeat; } key;		// keysym is an X keysym
+		struct { char utf8[EVENT_TEXT_MAX]; uint8 length; } text;		// Not terminated
+		struct { int16 x, y; } pointer;
+		struct { int16 x, y; uint8 button; } button;					// 1 left, 2 middle, 3 right, 4 back, 5 forward
+		struct { int16 x, y; int16 dx, dy; } scroll;					// Steps, positive dy scrolls up and dx right
+		struct { uint16 width, height; } resize;
+		struct { bool focused; } focus;
+		window_rect_t expose;
+	};
+} platform_event_t;
+
 __BEGIN_DECLS
 
 MYLLY_API syswindow_t*		create_system_window			( int32 x, int32 y, uint32 w, uint32 h, const char_t* title, bool decoration, wnd_message_cb cb );
 MYLLY_API void				destroy_system_window			( syswindow_t* window );
 
+// All windows share one display connection. Pumping it reads every pending
+// event once and hands each one to the callback of the window it belongs to,
+// or to cb when the window has no callback of its own. Events which belong to
+// none of our windows are passed to cb as well. process_window_messages pumps
+// the display the window is on, so calling it for each window is harmless.
 MYLLY_API void				process_window_messages			( syswindow_t* window, wnd_message_cb cb );
+MYLLY_API void				process_display_messages		( wnd_message_cb cb );
+
+// Blocks until window events arrive, a timer added to the event loop ticks,
+// wake_event_loop is called from any thread or timeout milliseconds have
+// passed (0xFFFFFFFF waits forever). Returns a mask of WAKE_REASONs, 0 on
+// timeout. Timer callbacks are run before returning. Timers need a timerfd,
+// so they can't be added on Win32.
+MYLLY_API uint32			wait_for_events					( uint32 timeout );
+MYLLY_API void				wake_event_loop					( void );
+MYLLY_API bool				add_event_timer					( systimer_t* timer, event_timer_cb cb, void* data );
+MYLLY_API void				remove_event_timer				( systimer_t* timer );
+
+// Runs func( arg ) on the thread pumping the display, can be called from any
+// thread. Tasks run in the order they were posted, a batch at a time between
+// event dispatches, and wake up wait_for_events. Posting blocks while the
+// window thread is more than WINDOW_TASK_QUEUE_SIZE tasks behind.
+MYLLY_API void				post_to_window_thread			( window_task_cb func, void* arg );
+MYLLY_API uint32			run_window_tasks				( void );
+
+// Has the window's keyboard, pointer, resize, focus, expose and close events
+// translated to platform_event_ts and delivered to cb in order, instead of
+// passing the native packets to the message callback. Other packets still go
+// to the message callback. Key presses are looked up once, through the input
+// method when there is one, and text longer than EVENT_TEXT_MAX bytes is split
+// into several events. The events are only valid during the call. Returns
+// false on Win32, where messages are left to the window procedure.
+MYLLY_API bool				set_window_event_handler		( syswindow_t* window, wnd_event_cb cb, void* data );
+
+MYLLY_API void				set_window_event_coalescing		( syswindow_t* window, bool enable );
+MYLLY_API uint32			get_window_motion_history		( syswindow_t* window, const window_motion_t** history );
 MYLLY_API bool				is_window_visible				( syswindow_t* window );
+MYLLY_API uint32			get_window_round_trips			( syswindow_t* window );
 
 MYLLY_API void				window_pos_to_screen			( syswindow_t* window, int16* x, int16* y );
 MYLLY_API void				get_window_pos					( syswindow_t* window, int16* x, int16* y );
@@ -62,10 +228,38 @@ MYLLY_API void				set_window_size					( syswindow_t* window, uint16 x, uint16 y
 MYLLY_API void				get_window_drawable_size		( syswindow_t* window, uint16* w, uint16* h );
 
 MYLLY_API void				redraw_window					( syswindow_t* window );
+MYLLY_API void				invalidate_window_rect			( syswindow_t* window, const window_rect_t* rect );
+MYLLY_API uint32			get_window_damage				( syswindow_t* window, const window_rect_t** rects );
+
+// Invalidated areas are merged and delivered as a single expose event per
+// pump, covering the bounding box of the damage. The individual rectangles
+// can be read with get_window_damage while handling it. On Win32 the system
+// tracks the update region and get_window_damage returns nothing.
+//
+// The software framebuffer matches the size of the window and holds 32-bit
+// 0x00RRGGBB pixels, with rows pitch pixels apart. Presenting copies the given
+// rectangles to the window, or the whole framebuffer when count is 0.
+MYLLY_API uint32*			get_window_framebuffer			( syswindow_t* window, uint16* width, uint16* height, uint32* pitch );
+MYLLY_API void				present_window_framebuffer		( syswindow_t* window, const window_rect_t* rects, uint32 count );
 
 MYLLY_API void				clipboard_copy					( syswindow_t* window, const char_t* text );
 MYLLY_API void				clipboard_paste					( syswindow_t* window, clip_paste_cb cb, void* data );
 
+// Delivers the clipboard contents in chunks as they arrive, without collecting
+// them into a single buffer first. The chunks are only valid during the call.
+// The last call has last set, and chunk is NULL if nothing could be pasted.
+// clipboard_paste collects the chunks into a terminated string.
+MYLLY_API void				clipboard_paste_stream			( syswindow_t* window, clip_stream_cb cb, void* data );
+
+// Queues a paste and returns its id, or 0 on failure. Any number of requests
+// may be pending, a few are converted at a time and the rest wait for their
+// turn. A request fails with a NULL chunk if the owner hasn't delivered the
+// contents within timeout milliseconds (SYNC_INFINITE waits forever), checked
+// when the display is pumped. A cancelled request's callback is not called.
+// On Win32 the contents are delivered before clipboard_request returns.
+MYLLY_API uint32			clipboard_request				( syswindow_t* window, clip_stream_cb cb, void* data, uint32 timeout );
+MYLLY_API bool				clipboard_cancel				( uint32 id );
+
 #ifndef _WIN32
 MYLLY_API void				clipboard_handle_event			( syswindow_t* window, void* packet );
 #endif
@@ -0,0 +1,2288 @@
+/**********************************************************************
+ *
+ * PROJECT:		Platform library
+ * FILE:		WindowXcb.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		XCB implementation of the window system functions.
+ *
+ *				(c) Tuomo Jauhiainen 2013
+ *
+ **********************************************************************/
+
+#if !defined(MYLLY_PLATFORM_MINIMAL) && !defined(_WIN32) && defined(MYLLY_USE_XCB)
+
+#include "Platform/Window.h"
+#include "Platform/Alloc.h"
+#include "Platform/Sync.h"
+#include "Stringy/Stringy.h"
+#include <xcb/xcbext.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// XCB implementation
+//////////////////////////////////////////////////////////////////////////
+
+// Unlike Xlib, XCB hands out a cookie for every request and only blocks when
+// the reply is collected. Requests are issued in batches and their replies
+// are gathered afterwards or polled for from the event pump, so the latency
+// of a round trip is paid once per batch rather than once per request.
+
+#define CLIP_MAX_ACTIVE 4	// Clipboard conversions in flight at once, each has a property of its own
+#define PRESENT_MAX_BYTES 1048576	// Largest band packed on the scratch stack at once
+
+typedef enum {
+	ATOM_CLIPBOARD,
+	ATOM_TARGETS,
+	ATOM_UTF8_STRING,
+	ATOM_INCR,
+	ATOM_WM_PROTOCOLS,
+	ATOM_WM_DELETE_WINDOW,
+	ATOM_MOTIF_WM_HINTS,
+	ATOM_MYLLY_SELECTION,
+	ATOM_MYLLY_SELECTION_LAST = ATOM_MYLLY_SELECTION + CLIP_MAX_ACTIVE - 1,
+	NUM_ATOMS
+} X11_ATOM;
+
+static const char* atom_names[NUM_ATOMS] = {
+	"CLIPBOARD",
+	"TARGETS",
+	"UTF8_STRING",
+	"INCR",
+	"WM_PROTOCOLS",
+	"WM_DELETE_WINDOW",
+	"_MOTIF_WM_HINTS",
+	"MYLLY_SELECTION0",
+	"MYLLY_SELECTION1",
+	"MYLLY_SELECTION2",
+	"MYLLY_SELECTION3",
+};
+
+#define WINDOW_EVENT_MASK ( XCB_EVENT_MASK_EXPOSURE|XCB_EVENT_MASK_KEY_PRESS|XCB_EVENT_MASK_KEY_RELEASE|XCB_EVENT_MASK_POINTER_MOTION|\
+							XCB_EVENT_MASK_BUTTON_PRESS|XCB_EVENT_MASK_BUTTON_RELEASE|XCB_EVENT_MASK_STRUCTURE_NOTIFY|\
+							XCB_EVENT_MASK_VISIBILITY_CHANGE|XCB_EVENT_MASK_PROPERTY_CHANGE )
+
+#define WINDOW_BUCKETS 64
+#define WINDOW_BUCKET( id ) ( (id) & ( WINDOW_BUCKETS - 1 ) )	// Ids are handed out sequentially
+
+// Everything shared by the windows of a display connection
+typedef struct sysdisplay_s {
+	xcb_connection_t*	connection;
+	xcb_screen_t*		screen;
+	uint32				refcount;
+	uint32				round_trips;	// Blocking requests made through the connection
+	xcb_atom_t			atoms[NUM_ATOMS];
+	xcb_cursor_t		cursors[NUM_CURSORS];
+	syswindow_t*		windows[WINDOW_BUCKETS];	// Windows hashed by their id
+	xcb_generic_event_t** batch;		// Events read during the current pump
+	uint32				batch_count;
+	uint32				batch_capacity;
+	bool				pumping;
+	xcb_generic_event_t* peeked;		// Event taken off the queue while checking for input
+	xcb_get_keyboard_mapping_reply_t* keymap;	// Keysyms of every keycode, fetched when first needed
+	platform_event_t*	events;			// Translated events waiting to be handed out
+	uint32				event_count;
+	uint32				event_capacity;
+} sysdisplay_t;
+
+// MIT-SHM is not used here, images are uploaded with PutImage requests split
+// to fit the maximum request length
+// Text larger than a single request is sent with the INCR protocol. The owner
+// announces the transfer and writes the next chunk each time the requestor
+// deletes the property, ending with an empty chunk.
+#define CLIP_CHUNK_MAX 262144
+
+typedef struct {
+	xcb_window_t		requestor;
+	xcb_atom_t			property;
+	xcb_atom_t			type;
+	size_t				offset;			// Bytes of the text sent so far
+	bool				foreign;		// The requestor is not one of our windows
+	uint64				deadline;		// Ended if the requestor hasn't taken a chunk by then
+} clip_transfer_t;
+
+typedef enum {
+	CLIP_QUEUED,						// Waiting for a free property
+	CLIP_CONVERTING,					// Waiting for the owner to answer
+	CLIP_RECEIVING,						// Receiving INCR chunks
+} CLIP_STATE;
+
+typedef struct {
+	uint32				id;
+	syswindow_t*		window;
+	clip_stream_cb		cb;
+	void*				data;
+	uint64				deadline;		// In get_time_ns time, 0 if the request never expires
+	uint32				slot;			// Index of the property used for the conversion
+	CLIP_STATE			state;
+	xcb_atom_t			target;
+	uint32				offset;			// Read position within the property in 32-bit units
+	bool				pending;		// The property is being read
+	uint32				sequence;		// Sequence number of the pending property read
+} clip_request_t;
+
+typedef struct {
+	clip_paste_cb		cb;
+	void*				data;
+	char*				text;
+	size_t				length;
+	size_t				capacity;
+} paste_collect_t;
+
+typedef struct {
+	systimer_t*			timer;
+	event_timer_cb		cb;
+	void*				data;
+	bool				ticked;
+} event_timer_t;
+
+typedef struct sysframebuffer_s {
+	uint32*				pixels;
+	xcb_gcontext_t		gc;
+	uint16				width;
+	uint16				height;
+} sysframebuffer_t;
+
+static sysdisplay_t		xcb					= { NULL };
+static int				wakeup_fds[2]		= { -1, -1 };	// Read and write ends, the same eventfd on Linux
+static pthread_once_t	wakeup_once			= PTHREAD_ONCE_INIT;
+static event_timer_t*	timers				= NULL;
+static uint32			timer_count			= 0;
+static uint32			timer_capacity		= 0;
+static struct pollfd*	poll_fds			= NULL;
+static char*			clip_text			= NULL;	// Contents of the clipboard while we own it
+static size_t			clip_length			= 0;
+static clip_transfer_t*	clip_transfers		= NULL;	// Incremental transfers to other clients
+static uint32			clip_transfer_count	= 0;
+static uint32			clip_transfer_capacity = 0;
+static bool				clip_cleared		= false;	// Someone else took the clipboard during the transfers
+static clip_request_t*	clip_requests		= NULL;	// Pastes in the order they were requested
+static uint32			clip_request_count	= 0;
+static uint32			clip_request_capacity = 0;
+static uint32			clip_next_id		= 0;
+static uint32			clip_slots			= 0;	// Mask of the properties in use
+
+#define XC_X_cursor 0
+#define XC_crosshair 34
+#define XC_fleur 52
+#define XC_left_ptr 68
+#define XC_xterm 152
+
+#define EVENT_TYPE( event ) ( (event)->response_type & ~0x80 )
+#define EVENT_SYNTHETIC( event ) ( ( (event)->response_type & 0x80 ) != 0 )
+
+struct MWMHints
+{
+	uint32 flags;
+	uint32 functions;
+	uint32 decorations;
+	int32 input_mode;
+	uint32 status;
+};
+
+enum
+{
+	MWM_HINTS_FUNCTIONS		= 1 << 0,
+	MWM_HINTS_DECORATIONS	= 1 << 1,
+};
+
+static sysdisplay_t* display_open( void )
+{
+	xcb_intern_atom_cookie_t cookies[NUM_ATOMS];
+	xcb_intern_atom_reply_t* reply;
+	xcb_screen_iterator_t iter;
+	int screen, i;
+
+	if ( xcb.connection == NULL )
+	{
+		xcb.connection = xcb_connect( NULL, &screen );
+
+		if ( xcb_connection_has_error( xcb.connection ) )
+		{
+			xcb_disconnect( xcb.connection );
+			xcb.connection = NULL;
+			return NULL;
+		}
+
+		iter = xcb_setup_roots_iterator( xcb_get_setup( xcb.connection ) );
+		for ( i = 0; i < screen; ++i ) xcb_screen_next( &iter );
+
+		xcb.screen = iter.data;
+
+		// Send every intern request before waiting for the first reply
+		for ( i = 0; i < NUM_ATOMS; ++i )
+			cookies[i] = xcb_intern_atom( xcb.connection, 0, (uint16)strlen( atom_names[i] ), atom_names[i] );
+
+		for ( i = 0; i < NUM_ATOMS; ++i )
+		{
+			reply = xcb_intern_atom_reply( xcb.connection, cookies[i], NULL );
+
+			xcb.atoms[i] = reply ? reply->atom : XCB_ATOM_NONE;
+			free( reply );
+		}
+
+		xcb.round_trips++;
+	}
+
+	xcb.refcount++;
+	return &xcb;
+}
+
+static void display_close( sysdisplay_t* context )
+{
+	uint32 i;
+
+	if ( --context->refcount > 0 ) return;
+
+	for ( i = 0; i < NUM_CURSORS; ++i )
+	{
+		if ( context->cursors[i] ) xcb_free_cursor( context->connection, context->cursors[i] );
+	}
+
+	// Events left over when the last window is destroyed from a callback
+	for ( i = 0; i < context->batch_count; ++i )
+		free( context->batch[i] );
+
+	free( context->peeked );
+	free( context->keymap );
+	xcb_disconnect( context->connection );
+	mem_free( context->batch );
+	mem_free( context->events );
+
+	// Also ends a pump in progress
+	memset( context, 0, sizeof(*context) );
+}
+
+static syswindow_t* display_find_window( sysdisplay_t* context, xcb_window_t id )
+{
+	syswindow_t* window;
+
+	for ( window = context->windows[WINDOW_BUCKET( id )]; window != NULL; window = window->next )
+	{
+		if ( window->window == id ) return window;
+	}
+
+	return NULL;
+}
+
+static xcb_window_t event_window( const xcb_generic_event_t* event )
+{
+	// The window is stored in a different place depending on the event
+	switch ( EVENT_TYPE( event ) )
+	{
+	case XCB_KEY_PRESS:
+	case XCB_KEY_RELEASE:
+	case XCB_BUTTON_PRESS:
+	case XCB_BUTTON_RELEASE:
+	case XCB_MOTION_NOTIFY:
+		return ((const xcb_key_press_event_t*)event)->event;
+
+	case XCB_ENTER_NOTIFY:
+	case XCB_LEAVE_NOTIFY:
+		return ((const xcb_enter_notify_event_t*)event)->event;
+
+	case XCB_FOCUS_IN:
+	case XCB_FOCUS_OUT:
+		return ((const xcb_focus_in_event_t*)event)->event;
+
+	case XCB_EXPOSE:
+		return ((const xcb_expose_event_t*)event)->window;
+
+	case XCB_VISIBILITY_NOTIFY:
+		return ((const xcb_visibility_notify_event_t*)event)->window;
+
+	case XCB_DESTROY_NOTIFY:
+	case XCB_UNMAP_NOTIFY:
+	case XCB_MAP_NOTIFY:
+	case XCB_REPARENT_NOTIFY:
+	case XCB_CONFIGURE_NOTIFY:
+		// Layout shared by the structure events, the first field is the
+		// window the event was selected on
+		return ((const xcb_map_notify_event_t*)event)->event;
+
+	case XCB_PROPERTY_NOTIFY:
+		return ((const xcb_property_notify_event_t*)event)->window;
+
+	case XCB_SELECTION_CLEAR:
+		return ((const xcb_selection_clear_event_t*)event)->owner;
+
+	case XCB_SELECTION_REQUEST:
+		return ((const xcb_selection_request_event_t*)event)->owner;
+
+	case XCB_SELECTION_NOTIFY:
+		return ((const xcb_selection_notify_event_t*)event)->requestor;
+
+	case XCB_CLIENT_MESSAGE:
+		return ((const xcb_client_message_event_t*)event)->window;
+	}
+
+	return XCB_WINDOW_NONE;
+}
+
+static size_t clipboard_chunk_size( xcb_connection_t* connection )
+{
+	size_t size;
+
+	// Leave room for the request header
+	size = (size_t)xcb_get_maximum_request_length( connection ) * 4 - 256;
+	return size < CLIP_CHUNK_MAX ? size : CLIP_CHUNK_MAX;
+}
+
+static bool clipboard_requestor_busy( xcb_window_t requestor, uint32 except )
+{
+	uint32 i;
+
+	for ( i = 0; i < clip_transfer_count; ++i )
+	{
+		if ( i != except && clip_transfers[i].requestor == requestor ) return true;
+	}
+
+	return false;
+}
+
+static void clipboard_end_transfer( sysdisplay_t* context, uint32 index )
+{
+	clip_transfer_t* transfer = &clip_transfers[index];
+	uint32 mask = XCB_EVENT_MASK_NO_EVENT;
+
+	// The requestor may be receiving another transfer on a different property
+	if ( transfer->foreign && !clipboard_requestor_busy( transfer->requestor, index ) )
+		xcb_change_window_attributes( context->connection, transfer->requestor, XCB_CW_EVENT_MASK, &mask );
+
+	*transfer = clip_transfers[--clip_transfer_count];
+
+	// The text was only kept for the transfers
+	if ( clip_transfer_count == 0 && clip_cleared )
+	{
+		mem_free( clip_text );
+
+		clip_text = NULL;
+		clip_length = 0;
+		clip_cleared = false;
+	}
+}
+
+static bool clipboard_send( syswindow_t* window, xcb_window_t requestor, xcb_atom_t property, xcb_atom_t target )
+{
+	sysdisplay_t* context = window->context;
+	clip_transfer_t* transfer;
+	xcb_atom_t targets[3];
+	uint32 value;
+
+	if ( target == context->atoms[ATOM_TARGETS] )
+	{
+		targets[0] = context->atoms[ATOM_TARGETS];
+		targets[1] = context->atoms[ATOM_UTF8_STRING];
+		targets[2] = XCB_ATOM_STRING;
+
+		xcb_change_property( window->connection, XCB_PROP_MODE_REPLACE, requestor, property, XCB_ATOM_ATOM, 32, 3, targets );
+		return true;
+	}
+
+	if ( target != context->atoms[ATOM_UTF8_STRING] && target != XCB_ATOM_STRING ) return false;
+	if ( clip_text == NULL ) return false;
+
+	if ( clip_length <= clipboard_chunk_size( window->connection ) )
+	{
+		xcb_change_property( window->connection, XCB_PROP_MODE_REPLACE, requestor, property, target, 8, (uint32)clip_length, clip_text );
+		return true;
+	}
+
+	if ( clip_transfer_count == clip_transfer_capacity )
+	{
+		clip_transfer_capacity = clip_transfer_capacity ? 2 * clip_transfer_capacity : 4;
+
+		transfer = (clip_transfer_t*)mem_alloc( clip_transfer_capacity * sizeof(clip_transfer_t) );
+		if ( clip_transfer_count ) memcpy( transfer, clip_transfers, clip_transfer_count * sizeof(clip_transfer_t) );
+
+		mem_free( clip_transfers );
+		clip_transfers = transfer;
+	}
+
+	transfer = &clip_transfers[clip_transfer_count++];
+	transfer->requestor = requestor;
+	transfer->property = property;
+	transfer->type = target;
+	transfer->offset = 0;
+	transfer->foreign = ( display_find_window( context, requestor ) == NULL );
+	transfer->deadline = get_time_ns() + (uint64)CLIPBOARD_TIMEOUT * 1000000;
+
+	// Our own windows already listen to property changes
+	if ( transfer->foreign )
+	{
+		value = XCB_EVENT_MASK_PROPERTY_CHANGE;
+		xcb_change_window_attributes( window->connection, requestor, XCB_CW_EVENT_MASK, &value );
+	}
+
+	// The announcement carries a lower bound of the size
+	value = (uint32)clip_length;
+	xcb_change_property( window->connection, XCB_PROP_MODE_REPLACE, requestor, property, context->atoms[ATOM_INCR], 32, 1, &value );
+
+	return true;
+}
+
+static int32 clip_find_request( uint32 id )
+{
+	uint32 i;
+
+	for ( i = 0; i < clip_request_count; ++i )
+	{
+		if ( clip_requests[i].id == id ) return (int32)i;
+	}
+
+	return -1;
+}
+
+static void clip_remove_request( uint32 index )
+{
+	clip_request_t* request = &clip_requests[index];
+
+	if ( request->pending )
+		xcb_discard_reply( request->window->connection, request->sequence );
+
+	if ( request->state != CLIP_QUEUED )
+		clip_slots &= ~( 1 << request->slot );
+
+	// Keep the order, requests are started first come first served
+	memmove( request, request + 1, ( clip_request_count - index - 1 ) * sizeof(clip_request_t) );
+	clip_request_count--;
+}
+
+static void clip_convert( clip_request_t* request )
+{
+	syswindow_t* window = request->window;
+
+	xcb_convert_selection( window->connection, window->window, window->context->atoms[ATOM_CLIPBOARD],
+						   request->target, window->context->atoms[ATOM_MYLLY_SELECTION + request->slot], XCB_CURRENT_TIME );
+	xcb_flush( window->connection );
+}
+
+static void clip_start_requests( void )
+{
+	clip_request_t* request;
+	uint32 i, slot;
+
+	for ( i = 0; i < clip_request_count && clip_slots != ( 1 << CLIP_MAX_ACTIVE ) - 1; ++i )
+	{
+		request = &clip_requests[i];
+		if ( request->state != CLIP_QUEUED ) continue;
+
+		for ( slot = 0; clip_slots & ( 1 << slot ); ++slot ) {}
+
+		clip_slots |= 1 << slot;
+
+		request->slot = slot;
+		request->state = CLIP_CONVERTING;
+
+		// An owner of an abandoned conversion may still write to the property,
+		// clear it so a leftover value isn't mistaken for ours
+		xcb_delete_property( request->window->connection, request->window->window,
+							 request->window->context->atoms[ATOM_MYLLY_SELECTION + slot] );
+
+		// Ask for UTF-8 first, clients which don't support it are asked for
+		// Latin-1 when they refuse
+		request->target = request->window->context->atoms[ATOM_UTF8_STRING];
+		clip_convert( request );
+	}
+}
+
+static void clip_finish( uint32 index, const char* chunk, size_t length )
+{
+	clip_request_t request = clip_requests[index];
+
+	// Let the next request in before the callback, which may queue more
+	clip_remove_request( index );
+	clip_start_requests();
+
+	request.cb( chunk, length, true, request.data );
+}
+
+static void clip_read_property( clip_request_t* request )
+{
+	syswindow_t* window = request->window;
+	xcb_get_property_cookie_t cookie;
+
+	// Reading the whole property deletes it, which also tells an INCR owner to
+	// send the next chunk. The reply is picked up by the event pump.
+	cookie = xcb_get_property( window->connection, 1, window->window, window->context->atoms[ATOM_MYLLY_SELECTION + request->slot],
+							   XCB_GET_PROPERTY_TYPE_ANY, request->offset, CLIP_CHUNK_MAX / 4 );
+
+	request->pending = true;
+	request->sequence = cookie.sequence;
+
+	xcb_flush( window->connection );
+}
+
+static void clip_handle_reply( uint32 index, xcb_get_property_reply_t* property )
+{
+	clip_request_t* request = &clip_requests[index];
+	const char* value;
+	size_t length;
+	uint32 id;
+
+	if ( property == NULL )
+	{
+		clip_finish( index, NULL, 0 );
+		return;
+	}
+
+	if ( property->type == request->window->context->atoms[ATOM_INCR] )
+	{
+		// The contents follow in chunks, each announced by a PropertyNotify
+		request->state = CLIP_RECEIVING;
+		request->offset = 0;
+		return;
+	}
+
+	if ( property->format != 8 )
+	{
+		clip_finish( index, NULL, 0 );
+		return;
+	}
+
+	value = (const char*)xcb_get_property_value( property );
+	length = (size_t)xcb_get_property_value_length( property );
+
+	if ( request->state == CLIP_RECEIVING && length == 0 && request->offset == 0 )
+	{
+		// An empty chunk ends the transfer
+		clip_finish( index, "", 0 );
+		return;
+	}
+
+	if ( request->state != CLIP_RECEIVING && property->bytes_after == 0 )
+	{
+		clip_finish( index, value, length );
+		return;
+	}
+
+	if ( length )
+	{
+		// The callback may cancel the request or queue new ones
+		id = request->id;
+		request->cb( value, length, false, request->data );
+
+		index = (uint32)clip_find_request( id );
+		if ( (int32)index < 0 ) return;
+
+		request = &clip_requests[index];
+	}
+
+	// Large properties are read and passed on a piece at a time
+	if ( property->bytes_after > 0 )
+	{
+		request->offset += (uint32)( length / 4 );
+		clip_read_property( request );
+	}
+	else
+	{
+		request->offset = 0;
+	}
+}
+
+static void clip_poll_replies( void )
+{
+	clip_request_t* request;
+	xcb_generic_error_t* error;
+	void* reply;
+	uint32 i;
+
+	for ( i = 0; i < clip_request_count; ++i )
+	{
+		request = &clip_requests[i];
+
+		reply = NULL;
+		error = NULL;
+
+		if ( !request->pending ||
+			 !xcb_poll_for_reply( request->window->connection, request->sequence, &reply, &error ) ) continue;
+
+		request->pending = false;
+
+		// The chunks are passed on straight from the reply. Start over as the
+		// callbacks may have changed the requests.
+		clip_handle_reply( i, (xcb_get_property_reply_t*)reply );
+		i = (uint32)-1;
+
+		free( reply );
+		free( error );
+	}
+}
+
+static void clip_check_timeouts( sysdisplay_t* context )
+{
+	uint64 now = 0;
+	uint32 i;
+
+	// Requestors which have died or stopped taking chunks
+	for ( i = clip_transfer_count; i > 0; --i )
+	{
+		if ( now == 0 ) now = get_time_ns();
+		if ( clip_transfers[i - 1].deadline <= now ) clipboard_end_transfer( context, i - 1 );
+	}
+
+	for ( i = 0; i < clip_request_count; )
+	{
+		if ( clip_requests[i].deadline == 0 )
+		{
+			++i;
+			continue;
+		}
+
+		if ( now == 0 ) now = get_time_ns();
+
+		if ( clip_requests[i].deadline <= now )
+		{
+			// The owner has stopped responding, start over as the callback may
+			// have changed the requests
+			clip_finish( i, NULL, 0 );
+			i = 0;
+			continue;
+		}
+
+		++i;
+	}
+}
+
+static uint64 clip_next_deadline( void )
+{
+	uint64 deadline = 0;
+	uint32 i;
+
+	for ( i = 0; i < clip_transfer_count; ++i )
+	{
+		if ( deadline == 0 || clip_transfers[i].deadline < deadline )
+			deadline = clip_transfers[i].deadline;
+	}
+
+	for ( i = 0; i < clip_request_count; ++i )
+	{
+		if ( clip_requests[i].deadline && ( deadline == 0 || clip_requests[i].deadline < deadline ) )
+			deadline = clip_requests[i].deadline;
+	}
+
+	return deadline;
+}
+
+static bool clipboard_filter_event( sysdisplay_t* context, const xcb_generic_event_t* event )
+{
+	const xcb_property_notify_event_t* property = (const xcb_property_notify_event_t*)event;
+	clip_transfer_t* transfer;
+	size_t length;
+	uint32 i;
+
+	if ( EVENT_TYPE( event ) != XCB_PROPERTY_NOTIFY ) return false;
+
+	for ( i = 0; i < clip_request_count; ++i )
+	{
+		if ( clip_requests[i].state != CLIP_RECEIVING || property->window != clip_requests[i].window->window ||
+			 property->atom != context->atoms[ATOM_MYLLY_SELECTION + clip_requests[i].slot] ) continue;
+
+		if ( property->state == XCB_PROPERTY_NEW_VALUE && !clip_requests[i].pending ) clip_read_property( &clip_requests[i] );
+		return true;
+	}
+
+	if ( property->state != XCB_PROPERTY_DELETE ) return false;
+
+	for ( i = 0; i < clip_transfer_count; ++i )
+	{
+		transfer = &clip_transfers[i];
+		if ( transfer->requestor != property->window || transfer->property != property->atom ) continue;
+
+		// The requestor has taken the previous chunk. The chunks are written
+		// straight from the clipboard text.
+		length = clip_length - transfer->offset;
+		if ( length > clipboard_chunk_size( context->connection ) ) length = clipboard_chunk_size( context->connection );
+
+		xcb_change_property( context->connection, XCB_PROP_MODE_REPLACE, transfer->requestor, transfer->property,
+							 transfer->type, 8, (uint32)length, clip_text + transfer->offset );
+
+		transfer->offset += length;
+		transfer->deadline = get_time_ns() + (uint64)CLIPBOARD_TIMEOUT * 1000000;
+
+		if ( length == 0 ) clipboard_end_transfer( context, i );
+		return true;
+	}
+
+	return false;
+}
+
+syswindow_t* create_system_window( int32 x, int32 y, uint32 w, uint32 h, const char_t* title, bool decoration, wnd_message_cb cb )
+{
+	syswindow_t* window;
+	sysdisplay_t* context;
+	xcb_connection_t* connection;
+	struct MWMHints hints;
+	uint32 values[3];
+
+	context = display_open();
+	if ( context == NULL ) return NULL;
+
+	connection = context->connection;
+
+	window = mem_alloc_clean( sizeof(*window) );
+	window->context = context;
+	window->connection = connection;
+	window->window = xcb_generate_id( connection );
+	window->root = context->screen->root;
+	window->parent = window->root;
+	window->cb = cb;
+	window->x = (int16)x;
+	window->y = (int16)y;
+	window->width = (uint16)w;
+	window->height = (uint16)h;
+
+	window->next = context->windows[WINDOW_BUCKET( window->window )];
+	context->windows[WINDOW_BUCKET( window->window )] = window;
+
+	values[0] = context->screen->white_pixel;
+	values[1] = context->screen->black_pixel;
+	values[2] = WINDOW_EVENT_MASK;
+
+	xcb_create_window( connection, XCB_COPY_FROM_PARENT, window->window, window->root,
+					   (int16)x, (int16)y, (uint16)w, (uint16)h, decoration ? 1 : 0,
+					   XCB_WINDOW_CLASS_INPUT_OUTPUT, context->screen->root_visual,
+					   XCB_CW_BACK_PIXEL|XCB_CW_BORDER_PIXEL|XCB_CW_EVENT_MASK, values );
+
+	xcb_change_property( connection, XCB_PROP_MODE_REPLACE, window->window, XCB_ATOM_WM_NAME, XCB_ATOM_STRING,
+						 8, (uint32)strlen( title ), title );
+
+	if ( !decoration )
+	{
+		memset( &hints, 0, sizeof(hints) );
+		hints.flags = MWM_HINTS_DECORATIONS;
+		hints.decorations = 0;
+
+		xcb_change_property( connection, XCB_PROP_MODE_REPLACE, window->window, context->atoms[ATOM_MOTIF_WM_HINTS],
+							 context->atoms[ATOM_MOTIF_WM_HINTS], 32, 5, &hints );
+	}
+
+	xcb_map_window( connection, window->window );
+	xcb_flush( connection );
+
+	return window;
+}
+
+static void framebuffer_destroy( syswindow_t* window )
+{
+	sysframebuffer_t* fb = window->framebuffer;
+
+	if ( fb == NULL ) return;
+
+	xcb_free_gc( window->connection, fb->gc );
+
+	mem_free_aligned( fb->pixels );
+	mem_free( fb );
+
+	window->framebuffer = NULL;
+}
+
+static bool clip_rect( const window_rect_t* rect, uint16 width, uint16 height, int32* x, int32* y, int32* w, int32* h )
+{
+	int32 x2, y2;
+
+	*x = rect->x < 0 ? 0 : rect->x;
+	*y = rect->y < 0 ? 0 : rect->y;
+
+	x2 = rect->x + rect->w > width ? width : rect->x + rect->w;
+	y2 = rect->y + rect->h > height ? height : rect->y + rect->h;
+
+	*w = x2 - *x;
+	*h = y2 - *y;
+
+	return *w > 0 && *h > 0;
+}
+
+void destroy_system_window( syswindow_t* window )
+{
+	syswindow_t** link;
+	uint32 i;
+
+	if ( window == NULL ) return;
+
+	// Events still queued for the window are passed on as unowned
+	for ( link = &window->context->windows[WINDOW_BUCKET( window->window )]; *link != NULL; link = &(*link)->next )
+	{
+		if ( *link == window )
+		{
+			*link = window->next;
+			break;
+		}
+	}
+
+	// Pastes into the window fail
+	for ( i = 0; i < clip_request_count; )
+	{
+		if ( clip_requests[i].window == window )
+		{
+			clip_finish( i, NULL, 0 );
+			i = 0;
+			continue;
+		}
+
+		++i;
+	}
+
+	for ( i = clip_transfer_count; i > 0; --i )
+	{
+		if ( clip_transfers[i - 1].requestor == window->window ) clipboard_end_transfer( window->context, i - 1 );
+	}
+
+	if ( window->translate_pending )
+		xcb_discard_reply( window->connection, window->translate_request );
+
+	// Translated events not handed out yet are dropped
+	for ( i = 0; i < window->context->event_count; ++i )
+	{
+		if ( window->context->events[i].window == window ) window->context->events[i].window = NULL;
+	}
+
+	framebuffer_destroy( window );
+
+	xcb_destroy_window( window->connection, window->window );
+	xcb_flush( window->connection );
+
+	display_close( window->context );
+
+	mem_free( window->motion );
+	mem_free( window );
+}
+
+static void window_request_position( syswindow_t* window )
+{
+	xcb_translate_coordinates_cookie_t cookie;
+
+	if ( window->translate_pending )
+		xcb_discard_reply( window->connection, window->translate_request );
+
+	// Ask for the root coordinates of the client area, the reply is picked up
+	// by the event pump once it arrives.
+	cookie = xcb_translate_coordinates( window->connection, window->window, window->root, 0, 0 );
+
+	window->translate_request = cookie.sequence;
+	window->translate_pending = true;
+}
+
+static void window_poll_replies( syswindow_t* window )
+{
+	xcb_translate_coordinates_reply_t* position;
+	xcb_generic_error_t* error = NULL;
+	void* reply = NULL;
+
+	if ( window->translate_pending &&
+		 xcb_poll_for_reply( window->connection, window->translate_request, &reply, &error ) )
+	{
+		window->translate_pending = false;
+
+		if ( reply )
+		{
+			position = (xcb_translate_coordinates_reply_t*)reply;
+
+			window->x = position->dst_x;
+			window->y = position->dst_y;
+		}
+
+		free( reply );
+		free( error );
+	}
+}
+
+static void window_update_cache( syswindow_t* window, const xcb_generic_event_t* event )
+{
+	const xcb_configure_notify_event_t* configure;
+	const xcb_reparent_notify_event_t* reparent;
+	const xcb_visibility_notify_event_t* visibility;
+
+	switch ( EVENT_TYPE( event ) )
+	{
+	case XCB_CONFIGURE_NOTIFY:
+		configure = (const xcb_configure_notify_event_t*)event;
+		if ( configure->window != window->window ) break;
+
+		window->width = configure->width;
+		window->height = configure->height;
+
+		// Real events are relative to the parent, which is the frame once the
+		// window manager has reparented us. It then sends synthetic events
+		// with root coordinates whenever the window moves.
+		if ( EVENT_SYNTHETIC( event ) || window->parent == window->root )
+		{
+			window->x = configure->x;
+			window->y = configure->y;
+		}
+		else
+		{
+			window_request_position( window );
+		}
+		break;
+
+	case XCB_REPARENT_NOTIFY:
+		reparent = (const xcb_reparent_notify_event_t*)event;
+		if ( reparent->window != window->window ) break;
+
+		window->parent = reparent->parent;
+		window_request_position( window );
+		break;
+
+	case XCB_MAP_NOTIFY:
+		if ( ((const xcb_map_notify_event_t*)event)->window == window->window ) window->mapped = true;
+		break;
+
+	case XCB_UNMAP_NOTIFY:
+		if ( ((const xcb_unmap_notify_event_t*)event)->window == window->window ) window->mapped = false;
+		break;
+
+	case XCB_VISIBILITY_NOTIFY:
+		visibility = (const xcb_visibility_notify_event_t*)event;
+		if ( visibility->window != window->window ) break;
+
+		window->obscured = ( visibility->state == XCB_VISIBILITY_FULLY_OBSCURED );
+		break;
+	}
+}
+
+static void window_dispatch( syswindow_t* window, xcb_generic_event_t* event, wnd_message_cb callback )
+{
+	window_update_cache( window, event );
+
+	if ( window->cb )
+		window->cb( event );
+
+	else if ( callback )
+		callback( event );
+}
+
+static platform_event_t* display_event_push( sysdisplay_t* context, syswindow_t* window, PLATFORM_EVENT type, uint32 time )
+{
+	platform_event_t* event;
+
+	if ( context->event_count == context->event_capacity )
+	{
+		context->event_capacity = context->event_capacity ? 2 * context->event_capacity : 64;
+
+		event = (platform_event_t*)mem_alloc( context->event_capacity * sizeof(platform_event_t) );
+		if ( context->event_count ) memcpy( event, context->events, context->event_count * sizeof(platform_event_t) );
+
+		mem_free( context->events );
+		context->events = event;
+	}
+
+	event = &context->events[context->event_count++];
+	memset( event, 0, sizeof(*event) );
+
+	event->type = (uint8)type;
+	event->time = time;
+	event->window = window;
+
+	return event;
+}
+
+static void display_flush_events( sysdisplay_t* context )
+{
+	platform_event_t* events;
+	syswindow_t* window;
+	uint32 i, count;
+
+	// Consecutive events of a window go out in a single call. Handlers may
+	// destroy windows, which clears the window of the events left behind, or
+	// close the display, which clears the whole array.
+	for ( i = 0; i < context->event_count; i += count )
+	{
+		events = &context->events[i];
+		window = events->window;
+
+		for ( count = 1; i + count < context->event_count && events[count].window == window; ++count ) {}
+
+		if ( window ) window->event_cb( events, count, window->event_data );
+	}
+
+	context->event_count = 0;
+}
+
+static uint8 event_modifiers( uint16 state )
+{
+	uint8 modifiers = 0;
+
+	if ( state & XCB_MOD_MASK_SHIFT ) modifiers |= EVENT_MOD_SHIFT;
+	if ( state & XCB_MOD_MASK_CONTROL ) modifiers |= EVENT_MOD_CTRL;
+	if ( state & XCB_MOD_MASK_1 ) modifiers |= EVENT_MOD_ALT;
+	if ( state & XCB_MOD_MASK_4 ) modifiers |= EVENT_MOD_SUPER;
+
+	return modifiers;
+}
+
+static xcb_keysym_t keysym_upper( xcb_keysym_t keysym )
+{
+	// Latin-1 letters, less the division sign
+	if ( keysym >= 'a' && keysym <= 'z' ) return keysym - 0x20;
+	if ( keysym >= 0xE0 && keysym <= 0xFE && keysym != 0xF7 ) return keysym - 0x20;
+
+	return keysym;
+}
+
+static xcb_keysym_t display_lookup_keysym( sysdisplay_t* context, xcb_keycode_t keycode, uint16 state )
+{
+	const xcb_setup_t* setup;
+	xcb_keysym_t* keysyms;
+	xcb_keysym_t lower, upper;
+	uint32 per;
+
+	setup = xcb_get_setup( context->connection );
+
+	if ( context->keymap == NULL )
+	{
+		// XCB has no keyboard handling of its own, the mapping is fetched once
+		// and again only after it has changed
+		context->keymap = xcb_get_keyboard_mapping_reply( context->connection,
+			xcb_get_keyboard_mapping( context->connection, setup->min_keycode, (uint8)( setup->max_keycode - setup->min_keycode + 1 ) ), NULL );
+
+		context->round_trips++;
+		if ( context->keymap == NULL ) return XCB_NO_SYMBOL;
+	}
+
+	per = context->keymap->keysyms_per_keycode;
+	if ( keycode < setup->min_keycode || keycode > setup->max_keycode || per == 0 ) return XCB_NO_SYMBOL;
+
+	keysyms = xcb_get_keyboard_mapping_keysyms( context->keymap ) + ( keycode - setup->min_keycode ) * per;
+
+	// The core protocol rules for the first group, keys with a single keysym
+	// are shifted to upper case
+	lower = keysyms[0];
+	upper = per > 1 && keysyms[1] != XCB_NO_SYMBOL ? keysyms[1] : keysym_upper( lower );
+
+	if ( state & XCB_MOD_MASK_LOCK && keysym_upper( lower ) != lower ) state ^= XCB_MOD_MASK_SHIFT;
+
+	return state & XCB_MOD_MASK_SHIFT ? upper : lower;
+}
+
+static int keysym_to_utf8( xcb_keysym_t keysym, char* text )
+{
+	uint32 code = 0;
+
+	// Latin-1 keysyms match their code points, Unicode keysyms carry theirs
+	if ( ( keysym >= 0x20 && keysym <= 0x7E ) || ( keysym >= 0xA0 && keysym <= 0xFF ) ) code = keysym;
+	else if ( ( keysym & 0xFF000000 ) == 0x01000000 ) code = keysym & 0x00FFFFFF;
+
+	if ( code == 0 ) return 0;
+
+	if ( code < 0x80 )
+	{
+		text[0] = (char)code;
+		return 1;
+	}
+
+	if ( code < 0x800 )
+	{
+		text[0] = (char)( 0xC0 | ( code >> 6 ) );
+		text[1] = (char)( 0x80 | ( code & 0x3F ) );
+		return 2;
+	}
+
+	if ( code < 0x10000 )
+	{
+		text[0] = (char)( 0xE0 | ( code >> 12 ) );
+		text[1] = (char)( 0x80 | ( ( code >> 6 ) & 0x3F ) );
+		text[2] = (char)( 0x80 | ( code & 0x3F ) );
+		return 3;
+	}
+
+	text[0] = (char)( 0xF0 | ( code >> 18 ) );
+	text[1] = (char)( 0x80 | ( ( code >> 12 ) & 0x3F ) );
+	text[2] = (char)( 0x80 | ( ( code >> 6 ) & 0x3F ) );
+	text[3] = (char)( 0x80 | ( code & 0x3F ) );
+	return 4;
+}
+
+static void window_translate_key( syswindow_t* window, const xcb_key_press_event_t* key )
+{
+	sysdisplay_t* context = window->context;
+	platform_event_t *event, *last;
+	xcb_keysym_t keysym;
+	char text[4];
+	int length = 0;
+	bool press = ( EVENT_TYPE( key ) == XCB_KEY_PRESS );
+
+	// There is no input method, the text comes straight from the keysym
+	keysym = display_lookup_keysym( context, key->detail, key->state );
+	if ( press && !( key->state & XCB_MOD_MASK_CONTROL ) ) length = keysym_to_utf8( keysym, text );
+
+	last = context->event_count ? &context->events[context->event_count - 1] : NULL;
+
+	// Auto-repeat sends a release and a press with the same time, the release
+	// is replaced by the repeated press
+	if ( press && last && last->type == EVENT_KEY_UP && last->window == window &&
+		 last->key.keycode == key->detail && last->time == key->time )
+	{
+		context->event_count--;
+
+		event = display_event_push( context, window, EVENT_KEY_DOWN, key->time );
+		event->key.repeat = true;
+	}
+	else
+	{
+		event = display_event_push( context, window, press ? EVENT_KEY_DOWN : EVENT_KEY_UP, key->time );
+	}
+
+	event->modifiers = event_modifiers( key->state );
+	event->key.keysym = keysym;
+	event->key.keycode = key->detail;
+
+	if ( length > 0 )
+	{
+		event = display_event_push( context, window, EVENT_TEXT, key->time );
+		event->modifiers = event_modifiers( key->state );
+		event->text.length = (uint8)length;
+
+		memcpy( event->text.utf8, text, length );
+	}
+}
+
+static bool window_translate( syswindow_t* window, const xcb_generic_event_t* xevent )
+{
+	const xcb_button_press_event_t* press;
+	const xcb_motion_notify_event_t* motion;
+	const xcb_configure_notify_event_t* configure;
+	const xcb_focus_in_event_t* focus;
+	const xcb_expose_event_t* expose;
+	const xcb_client_message_event_t* message;
+	platform_event_t* event;
+
+	switch ( EVENT_TYPE( xevent ) )
+	{
+	case XCB_KEY_PRESS:
+	case XCB_KEY_RELEASE:
+		window_translate_key( window, (const xcb_key_press_event_t*)xevent );
+		return true;
+
+	case XCB_MOTION_NOTIFY:
+		motion = (const xcb_motion_notify_event_t*)xevent;
+
+		event = display_event_push( window->context, window, EVENT_POINTER, motion->time );
+		event->modifiers = event_modifiers( motion->state );
+		event->pointer.x = motion->event_x;
+		event->pointer.y = motion->event_y;
+		return true;
+
+	case XCB_BUTTON_PRESS:
+	case XCB_BUTTON_RELEASE:
+		press = (const xcb_button_press_event_t*)xevent;
+
+		if ( press->detail >= 4 && press->detail <= 7 )
+		{
+			// Wheels click buttons 4 to 7, the releases don't tell anything new
+			if ( EVENT_TYPE( xevent ) == XCB_BUTTON_RELEASE ) return true;
+
+			event = display_event_push( window->context, window, EVENT_SCROLL, press->time );
+			event->scroll.x = press->event_x;
+			event->scroll.y = press->event_y;
+			event->scroll.dy = press->detail == 4 ? 1 : press->detail == 5 ? -1 : 0;
+			event->scroll.dx = press->detail == 7 ? 1 : press->detail == 6 ? -1 : 0;
+		}
+		else
+		{
+			event = display_event_push( window->context, window, EVENT_TYPE( xevent ) == XCB_BUTTON_PRESS ? EVENT_BUTTON_DOWN : EVENT_BUTTON_UP,
+										press->time );
+			event->button.x = press->event_x;
+			event->button.y = press->event_y;
+			event->button.button = press->detail > 7 ? press->detail - 4 : press->detail;
+		}
+
+		event->modifiers = event_modifiers( press->state );
+		return true;
+
+	case XCB_CONFIGURE_NOTIFY:
+		configure = (const xcb_configure_notify_event_t*)xevent;
+		if ( configure->window != window->window ) return false;
+
+		// Compared to the cache before it's updated from the event
+		if ( configure->width != window->width || configure->height != window->height )
+		{
+			event = display_event_push( window->context, window, EVENT_RESIZE, 0 );
+			event->resize.width = configure->width;
+			event->resize.height = configure->height;
+		}
+		return true;
+
+	case XCB_FOCUS_IN:
+	case XCB_FOCUS_OUT:
+		focus = (const xcb_focus_in_event_t*)xevent;
+
+		// The pointer moving in and out of a focused window isn't a change
+		if ( focus->detail == XCB_NOTIFY_DETAIL_POINTER ) return true;
+
+		event = display_event_push( window->context, window, EVENT_FOCUS, 0 );
+		event->focus.focused = ( EVENT_TYPE( xevent ) == XCB_FOCUS_IN );
+		return true;
+
+	case XCB_EXPOSE:
+		expose = (const xcb_expose_event_t*)xevent;
+
+		event = display_event_push( window->context, window, EVENT_EXPOSE, 0 );
+		event->expose.x = (int16)expose->x;
+		event->expose.y = (int16)expose->y;
+		event->expose.w = expose->width;
+		event->expose.h = expose->height;
+		return true;
+
+	case XCB_CLIENT_MESSAGE:
+		message = (const xcb_client_message_event_t*)xevent;
+
+		if ( message->type != window->context->atoms[ATOM_WM_PROTOCOLS] ||
+			 message->data.data32[0] != window->context->atoms[ATOM_WM_DELETE_WINDOW] ) return false;
+
+		display_event_push( window->context, window, EVENT_CLOSE, 0 );
+		return true;
+	}
+
+	return false;
+}
+
+static void display_batch_push( sysdisplay_t* context, xcb_generic_event_t* event )
+{
+	xcb_generic_event_t** batch;
+
+	if ( context->batch_count == context->batch_capacity )
+	{
+		context->batch_capacity = context->batch_capacity ? 2 * context->batch_capacity : 64;
+
+		batch = (xcb_generic_event_t**)mem_alloc( context->batch_capacity * sizeof(xcb_generic_event_t*) );
+		if ( context->batch_count ) memcpy( batch, context->batch, context->batch_count * sizeof(xcb_generic_event_t*) );
+
+		mem_free( context->batch );
+		context->batch = batch;
+	}
+
+	context->batch[context->batch_count++] = event;
+}
+
+static void window_motion_push( syswindow_t* window, const xcb_motion_notify_event_t* event )
+{
+	window_motion_t* motion;
+
+	if ( window->motion_count == window->motion_capacity )
+	{
+		window->motion_capacity = window->motion_capacity ? 2 * window->motion_capacity : 64;
+
+		motion = (window_motion_t*)mem_alloc( window->motion_capacity * sizeof(window_motion_t) );
+		if ( window->motion_count ) memcpy( motion, window->motion, window->motion_count * sizeof(window_motion_t) );
+
+		mem_free( window->motion );
+		window->motion = motion;
+	}
+
+	motion = &window->motion[window->motion_count++];
+	motion->x = event->event_x;
+	motion->y = event->event_y;
+	motion->time = event->time;
+}
+
+static bool rects_touch( const window_rect_t* a, const window_rect_t* b )
+{
+	return a->x <= b->x + b->w && b->x <= a->x + a->w &&
+		   a->y <= b->y + b->h && b->y <= a->y + a->h;
+}
+
+static void rect_union( window_rect_t* a, const window_rect_t* b )
+{
+	int32 x1, y1, x2, y2;
+
+	x1 = a->x < b->x ? a->x : b->x;
+	y1 = a->y < b->y ? a->y : b->y;
+	x2 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+	y2 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+
+	a->x = (int16)x1;
+	a->y = (int16)y1;
+	a->w = (uint16)( x2 - x1 );
+	a->h = (uint16)( y2 - y1 );
+}
+
+static void window_add_damage( syswindow_t* window, const window_rect_t* rect )
+{
+	window_rect_t area;
+	int32 x, y, w, h;
+	uint32 i;
+
+	if ( !clip_rect( rect, window->width, window->height, &x, &y, &w, &h ) ) return;
+
+	area.x = (int16)x;
+	area.y = (int16)y;
+	area.w = (uint16)w;
+	area.h = (uint16)h;
+
+	// Absorb every rectangle touching the new one. The grown area may touch
+	// rectangles already checked, so start over after each merge.
+	for ( i = 0; i < window->damage_count; )
+	{
+		if ( rects_touch( &window->damage[i], &area ) )
+		{
+			rect_union( &area, &window->damage[i] );
+			window->damage[i] = window->damage[--window->damage_count];
+			i = 0;
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	if ( window->damage_count == WINDOW_MAX_DAMAGE )
+	{
+		// Too fragmented, repaint the bounding box instead
+		for ( i = 0; i < window->damage_count; ++i )
+			rect_union( &area, &window->damage[i] );
+
+		window->damage_count = 0;
+	}
+
+	window->damage[window->damage_count++] = area;
+}
+
+static bool window_filter_expose( syswindow_t* window, const xcb_generic_event_t* event )
+{
+	const xcb_expose_event_t* expose = (const xcb_expose_event_t*)event;
+	window_rect_t rect;
+
+	if ( EVENT_TYPE( event ) != XCB_EXPOSE || expose->window != window->window ) return false;
+
+	// Our own wakeup event, the damage is already recorded
+	if ( EVENT_SYNTHETIC( event ) )
+	{
+		window->redraw_posted = false;
+		return true;
+	}
+
+	rect.x = (int16)expose->x;
+	rect.y = (int16)expose->y;
+	rect.w = expose->width;
+	rect.h = expose->height;
+
+	window_add_damage( window, &rect );
+	return true;
+}
+
+static void window_repaint( syswindow_t* window, wnd_message_cb callback )
+{
+	xcb_expose_event_t event;
+	window_rect_t bounds;
+	uint32 i;
+
+	if ( window->damage_count == 0 ) return;
+
+	// Hand the damage over to the repaint, anything invalidated while it is
+	// being handled goes to the next one
+	memcpy( window->repaint, window->damage, window->damage_count * sizeof(window_rect_t) );
+	window->repaint_count = window->damage_count;
+	window->damage_count = 0;
+
+	bounds = window->repaint[0];
+	for ( i = 1; i < window->repaint_count; ++i )
+		rect_union( &bounds, &window->repaint[i] );
+
+	memset( &event, 0, sizeof(event) );
+
+	event.response_type = XCB_EXPOSE;
+	event.window = window->window;
+	event.x = (uint16)bounds.x;
+	event.y = (uint16)bounds.y;
+	event.width = bounds.w;
+	event.height = bounds.h;
+	event.count = 0;
+
+	// The rectangles stay readable until the translated event has been handled
+	if ( window->event_cb && window_translate( window, (xcb_generic_event_t*)&event ) ) return;
+
+	window_dispatch( window, (xcb_generic_event_t*)&event, callback );
+	window->repaint_count = 0;
+}
+
+static void display_poll_replies( sysdisplay_t* context )
+{
+	syswindow_t *window, *next;
+	uint32 i;
+
+	for ( i = 0; i < WINDOW_BUCKETS; ++i )
+	{
+		for ( window = context->windows[i]; window != NULL; window = next )
+		{
+			next = window->next;
+			window_poll_replies( window );
+		}
+	}
+
+	clip_poll_replies();
+}
+
+static void display_pump( sysdisplay_t* context, wnd_message_cb callback )
+{
+	syswindow_t *window, *next;
+	xcb_generic_event_t *event, *last;
+	xcb_motion_notify_event_t *motion, *last_motion;
+	uint32 i;
+
+	// A callback pumping the display again would see an empty queue anyway
+	if ( context->pumping ) return;
+	context->pumping = true;
+
+	xcb_flush( context->connection );
+	display_poll_replies( context );
+
+	for ( i = 0; i < WINDOW_BUCKETS; ++i )
+	{
+		for ( window = context->windows[i]; window != NULL; window = window->next )
+			window->motion_count = 0;
+	}
+
+	// Read from the socket once, then take only what is already queued so the
+	// pump can't be kept busy by a steady stream of events
+	context->batch_count = 0;
+
+	event = context->peeked ? context->peeked : xcb_poll_for_event( context->connection );
+	context->peeked = NULL;
+
+	for ( ; event != NULL;
+		  event = xcb_poll_for_queued_event( context->connection ) )
+	{
+		window = display_find_window( context, event_window( event ) );
+
+		if ( window && window_filter_expose( window, event ) )
+		{
+			free( event );
+			continue;
+		}
+
+		if ( window && window->coalesce && EVENT_TYPE( event ) == XCB_MOTION_NOTIFY )
+		{
+			motion = (xcb_motion_notify_event_t*)event;
+			window_motion_push( window, motion );
+
+			// Replace the previous event if it was motion in the same window
+			// with the same buttons held
+			last = context->batch_count ? context->batch[context->batch_count - 1] : NULL;
+			last_motion = (xcb_motion_notify_event_t*)last;
+
+			if ( last && EVENT_TYPE( last ) == XCB_MOTION_NOTIFY &&
+				 last_motion->event == motion->event && last_motion->state == motion->state )
+			{
+				free( last );
+				context->batch[context->batch_count - 1] = event;
+				continue;
+			}
+		}
+
+		display_batch_push( context, event );
+	}
+
+	// The owner is looked up again as callbacks may destroy windows. Closing
+	// the display frees the rest of the batch, which ends the loop.
+	for ( i = 0; i < context->batch_count; ++i )
+	{
+		event = context->batch[i];
+		context->batch[i] = NULL;
+
+		// Chunks of clipboard transfers are handled here
+		if ( clipboard_filter_event( context, event ) )
+		{
+			free( event );
+			continue;
+		}
+
+		// The keyboard mapping is fetched again when it's next needed
+		if ( EVENT_TYPE( event ) == XCB_MAPPING_NOTIFY )
+		{
+			free( context->keymap );
+			context->keymap = NULL;
+		}
+
+		window = display_find_window( context, event_window( event ) );
+
+		// Windows with an event handler get the events it knows about
+		// translated, and handed out together with the following ones
+		if ( window && window->event_cb && window_translate( window, event ) )
+		{
+			window_update_cache( window, event );
+			free( event );
+			continue;
+		}
+
+		if ( context->event_count )
+		{
+			// Keep the order, the translated events go out before the packet
+			display_flush_events( context );
+
+			if ( context->batch_count == 0 )
+			{
+				free( event );
+				break;
+			}
+
+			window = display_find_window( context, event_window( event ) );
+		}
+
+		if ( window )
+			window_dispatch( window, event, callback );
+
+		else if ( callback )
+			callback( event );
+
+		free( event );
+	}
+
+	display_flush_events( context );
+	context->batch_count = 0;
+
+	// Results handed over by other threads get painted in the same pump
+	run_window_tasks();
+	clip_check_timeouts( context );
+
+	for ( i = 0; i < WINDOW_BUCKETS; ++i )
+	{
+		for ( window = context->windows[i]; window != NULL; window = next )
+		{
+			next = window->next;
+			window_repaint( window, callback );
+		}
+	}
+
+	display_flush_events( context );
+
+	for ( i = 0; i < WINDOW_BUCKETS; ++i )
+	{
+		for ( window = context->windows[i]; window != NULL; window = window->next )
+			window->repaint_count = 0;
+	}
+
+	if ( context->connection ) display_poll_replies( context );
+	context->pumping = false;
+}
+
+void process_window_messages( syswindow_t* window, wnd_message_cb callback )
+{
+	if ( window == NULL ) return;
+	display_pump( window->context, callback );
+}
+
+void process_display_messages( wnd_message_cb callback )
+{
+	if ( xcb.connection == NULL )
+	{
+		run_window_tasks();
+		return;
+	}
+
+	display_pump( &xcb, callback );
+}
+
+static void wakeup_create( void )
+{
+#ifdef __linux__
+	wakeup_fds[0] = wakeup_fds[1] = eventfd( 0, EFD_CLOEXEC|EFD_NONBLOCK );
+#else
+	if ( pipe( wakeup_fds ) == 0 )
+	{
+		fcntl( wakeup_fds[0], F_SETFL, O_NONBLOCK );
+		fcntl( wakeup_fds[1], F_SETFL, O_NONBLOCK );
+		fcntl( wakeup_fds[0], F_SETFD, FD_CLOEXEC );
+		fcntl( wakeup_fds[1], F_SETFD, FD_CLOEXEC );
+	}
+#endif
+}
+
+static void wakeup_drain( void )
+{
+	uint8 buf[64];
+
+	// An eventfd is reset by a single read, a pipe may hold several wakeups
+	while ( read( wakeup_fds[0], buf, sizeof(buf) ) > 0 ) {}
+}
+
+static void event_timers_dispatch( void )
+{
+	uint32 i;
+
+	// A callback may add or remove timers, so start over after each one
+	for ( i = 0; i < timer_count; )
+	{
+		if ( timers[i].ticked )
+		{
+			timers[i].ticked = false;
+			timers[i].cb( timers[i].timer, timers[i].data );
+
+			i = 0;
+			continue;
+		}
+
+		++i;
+	}
+}
+
+uint32 wait_for_events( uint32 timeout )
+{
+	uint32 result = 0, count = 0, i;
+	uint64 deadline, now;
+	int ret;
+
+	pthread_once( &wakeup_once, wakeup_create );
+
+	// Room for the display connection and the wakeup descriptor
+	if ( poll_fds == NULL ) poll_fds = (struct pollfd*)mem_alloc_clean( 2 * sizeof(struct pollfd) );
+
+	// Return in time for the pump to expire clipboard requests and transfers
+	deadline = clip_next_deadline();
+
+	if ( deadline )
+	{
+		now = get_time_ns();
+		now = deadline > now ? ( deadline - now + 999999 ) / 1000000 : 0;
+
+		if ( now < timeout ) timeout = (uint32)now;
+	}
+
+	if ( xcb.connection != NULL )
+	{
+		// Replies to earlier requests may have queued events already, those
+		// won't show up on the socket. XCB can't peek, so the event is kept
+		// for the next pump.
+		xcb_flush( xcb.connection );
+
+		if ( xcb.peeked == NULL ) xcb.peeked = xcb_poll_for_queued_event( xcb.connection );
+
+		if ( xcb.peeked != NULL )
+		{
+			result |= WAKE_EVENTS;
+			timeout = 0;
+		}
+
+		poll_fds[count].fd = xcb_get_file_descriptor( xcb.connection );
+		poll_fds[count++].events = POLLIN;
+	}
+
+	if ( wakeup_fds[0] >= 0 )
+	{
+		poll_fds[count].fd = wakeup_fds[0];
+		poll_fds[count++].events = POLLIN;
+	}
+
+	for ( i = 0; i < timer_count; ++i )
+	{
+		poll_fds[count].fd = systimer_get_fd( timers[i].timer );
+		poll_fds[count++].events = POLLIN;
+	}
+
+	ret = poll( poll_fds, count, timeout == SYNC_INFINITE ? -1 : (int)timeout );
+
+	// Interrupted by a signal, report it as an early timeout
+	if ( ret <= 0 ) return result;
+
+	count = 0;
+
+	if ( xcb.connection != NULL && poll_fds[count++].revents )
+		result |= WAKE_EVENTS;
+
+	if ( wakeup_fds[0] >= 0 && poll_fds[count++].revents )
+	{
+		wakeup_drain();
+		result |= WAKE_POSTED;
+	}
+
+	for ( i = 0; i < timer_count; ++i )
+	{
+		if ( poll_fds[count++].revents == 0 ) continue;
+
+		// Consumes the tick without blocking and updates the timer's delta
+		systimer_wait_ns( timers[i].timer, true );
+
+		timers[i].ticked = true;
+		result |= WAKE_TIMER;
+	}
+
+	if ( result & WAKE_TIMER ) event_timers_dispatch();
+
+	return result;
+}
+
+void wake_event_loop( void )
+{
+	uint64 value = 1;
+
+	pthread_once( &wakeup_once, wakeup_create );
+
+	// A full pipe or eventfd means the loop is going to wake up anyway
+	if ( write( wakeup_fds[1], &value, sizeof(value) ) < 0 ) return;
+}
+
+bool add_event_timer( systimer_t* timer, event_timer_cb cb, void* data )
+{
+	event_timer_t* array;
+	uint32 i;
+
+	if ( timer == NULL || cb == NULL ) return false;
+	if ( systimer_get_fd( timer ) < 0 ) return false;
+
+	for ( i = 0; i < timer_count; ++i )
+	{
+		if ( timers[i].timer == timer ) return false;
+	}
+
+	if ( timer_count == timer_capacity )
+	{
+		timer_capacity = timer_capacity ? 2 * timer_capacity : 8;
+
+		array = (event_timer_t*)mem_alloc( timer_capacity * sizeof(event_timer_t) );
+		if ( timer_count ) memcpy( array, timers, timer_count * sizeof(event_timer_t) );
+
+		mem_free( timers );
+		timers = array;
+
+		// Room for the display connection and the wakeup descriptor as well
+		mem_free( poll_fds );
+		poll_fds = (struct pollfd*)mem_alloc_clean( ( timer_capacity + 2 ) * sizeof(struct pollfd) );
+	}
+
+	timers[timer_count].timer = timer;
+	timers[timer_count].cb = cb;
+	timers[timer_count].data = data;
+	timers[timer_count].ticked = false;
+
+	timer_count++;
+	return true;
+}
+
+void remove_event_timer( systimer_t* timer )
+{
+	uint32 i;
+
+	for ( i = 0; i < timer_count; ++i )
+	{
+		if ( timers[i].timer == timer )
+		{
+			// Keep the order, timers are dispatched in the order they were added
+			memmove( &timers[i], &timers[i + 1], ( timer_count - i - 1 ) * sizeof(event_timer_t) );
+			timer_count--;
+			return;
+		}
+	}
+}
+
+bool set_window_event_handler( syswindow_t* window, wnd_event_cb cb, void* data )
+{
+	sysdisplay_t* context;
+	uint32 mask;
+
+	if ( window == NULL ) return false;
+
+	context = window->context;
+
+	window->event_cb = cb;
+	window->event_data = data;
+
+	mask = cb ? WINDOW_EVENT_MASK|XCB_EVENT_MASK_FOCUS_CHANGE : WINDOW_EVENT_MASK;
+	xcb_change_window_attributes( window->connection, window->window, XCB_CW_EVENT_MASK, &mask );
+
+	// Closing the window is left to us rather than the window manager
+	if ( cb )
+	{
+		xcb_change_property( window->connection, XCB_PROP_MODE_REPLACE, window->window, context->atoms[ATOM_WM_PROTOCOLS],
+							 XCB_ATOM_ATOM, 32, 1, &context->atoms[ATOM_WM_DELETE_WINDOW] );
+	}
+
+	xcb_flush( window->connection );
+	return true;
+}
+
+void set_window_event_coalescing( syswindow_t* window, bool enable )
+{
+	if ( window == NULL ) return;
+	window->coalesce = enable;
+}
+
+uint32 get_window_motion_history( syswindow_t* window, const window_motion_t** history )
+{
+	if ( window == NULL )
+	{
+		*history = NULL;
+		return 0;
+	}
+
+	*history = window->motion;
+	return window->motion_count;
+}
+
+bool is_window_visible( syswindow_t* window )
+{
+	if ( window == NULL ) return false;
+	return window->mapped && !window->obscured;
+}
+
+uint32 get_window_round_trips( syswindow_t* window )
+{
+	if ( window == NULL ) return 0;
+	return window->context->round_trips;
+}
+
+void window_pos_to_screen( syswindow_t* window, int16* x, int16* y )
+{
+	if ( window == NULL )
+	{
+		*x = 0;
+		*y = 0;
+		return;
+	}
+
+	*x += window->x;
+	*y += window->y;
+}
+
+void get_window_pos( syswindow_t* window, int16* x, int16* y )
+{
+	if ( window == NULL )
+	{
+		*x = 0;
+		*y = 0;
+		return;
+	}
+
+	*x = window->x;
+	*y = window->y;
+}
+
+void set_window_pos( syswindow_t* window, int16 x, int16 y )
+{
+	uint32 values[2];
+
+	if ( window == NULL ) return;
+
+	values[0] = (uint32)(int32)x;
+	values[1] = (uint32)(int32)y;
+
+	xcb_configure_window( window->connection, window->window, XCB_CONFIG_WINDOW_X|XCB_CONFIG_WINDOW_Y, values );
+	xcb_flush( window->connection );
+}
+
+void get_window_size( syswindow_t* window, uint16* w, uint16* h )
+{
+	if ( window == NULL )
+	{
+		*w = 0;
+		*h = 0;
+		return;
+	}
+
+	*w = window->width;
+	*h = window->height;
+}
+
+void set_window_size( syswindow_t* window, uint16 w, uint16 h )
+{
+	uint32 values[2];
+
+	if ( window == NULL ) return;
+
+	values[0] = w;
+	values[1] = h;
+
+	xcb_configure_window( window->connection, window->window, XCB_CONFIG_WINDOW_WIDTH|XCB_CONFIG_WINDOW_HEIGHT, values );
+	xcb_flush( window->connection );
+}
+
+void get_window_drawable_size( syswindow_t* window, uint16* width, uint16* height )
+{
+	// The cached size excludes the border, same as the drawable
+	get_window_size( window, width, height );
+}
+
+void redraw_window( syswindow_t* window )
+{
+	invalidate_window_rect( window, NULL );
+}
+
+void invalidate_window_rect( syswindow_t* window, const window_rect_t* rect )
+{
+	xcb_expose_event_t event;
+	window_rect_t full;
+
+	if ( window == NULL ) return;
+
+	if ( rect == NULL )
+	{
+		full.x = 0;
+		full.y = 0;
+		full.w = window->width;
+		full.h = window->height;
+
+		rect = &full;
+	}
+
+	window_add_damage( window, rect );
+
+	// Wake up the event loop once, further invalidations before the repaint
+	// only grow the damage
+	if ( window->damage_count == 0 || window->redraw_posted ) return;
+
+	// Events are always sent as 32 bytes
+	memset( &event, 0, sizeof(event) );
+
+	event.response_type = XCB_EXPOSE;
+	event.window = window->window;
+
+	xcb_send_event( window->connection, 0, window->window, XCB_EVENT_MASK_EXPOSURE, (const char*)&event );
+	xcb_flush( window->connection );
+
+	window->redraw_posted = true;
+}
+
+uint32 get_window_damage( syswindow_t* window, const window_rect_t** rects )
+{
+	if ( window == NULL )
+	{
+		*rects = NULL;
+		return 0;
+	}
+
+	*rects = window->repaint;
+	return window->repaint_count;
+}
+
+uint32* get_window_framebuffer( syswindow_t* window, uint16* width, uint16* height, uint32* pitch )
+{
+	sysframebuffer_t* fb;
+
+	if ( window == NULL ) return NULL;
+
+	fb = window->framebuffer;
+
+	if ( fb && ( fb->width != window->width || fb->height != window->height ) )
+	{
+		framebuffer_destroy( window );
+		fb = NULL;
+	}
+
+	if ( fb == NULL )
+	{
+		// Pixels are written as 32-bit RGB
+		if ( window->context->screen->root_depth != 24 && window->context->screen->root_depth != 32 ) return NULL;
+		if ( window->width == 0 || window->height == 0 ) return NULL;
+
+		fb = (sysframebuffer_t*)mem_alloc_clean( sizeof(*fb) );
+		fb->width = window->width;
+		fb->height = window->height;
+		fb->pixels = (uint32*)mem_alloc_aligned( (size_t)fb->width * fb->height * 4, 64 );
+		fb->gc = xcb_generate_id( window->connection );
+
+		xcb_create_gc( window->connection, fb->gc, window->window, 0, NULL );
+		window->framebuffer = fb;
+	}
+
+	*width = fb->width;
+	*height = fb->height;
+	*pitch = fb->width;
+
+	return fb->pixels;
+}
+
+void present_window_framebuffer( syswindow_t* window, const window_rect_t* rects, uint32 count )
+{
+	sysframebuffer_t* fb;
+	window_rect_t full;
+	int32 x, y, w, h, row, rows, band, max_rows;
+	uint32 i, max_bytes;
+	uint32 *data, *src;
+
+	if ( window == NULL ) return;
+
+	fb = window->framebuffer;
+	if ( fb == NULL ) return;
+
+	if ( count == 0 )
+	{
+		full.x = 0;
+		full.y = 0;
+		full.w = fb->width;
+		full.h = fb->height;
+
+		rects = &full;
+		count = 1;
+	}
+
+	// The maximum request length is in 4 byte units, leave room for the header
+	max_bytes = xcb_get_maximum_request_length( window->connection ) * 4 - 64;
+	if ( max_bytes > PRESENT_MAX_BYTES ) max_bytes = PRESENT_MAX_BYTES;
+
+	for ( i = 0; i < count; ++i )
+	{
+		if ( !clip_rect( &rects[i], fb->width, fb->height, &x, &y, &w, &h ) ) continue;
+
+		max_rows = (int32)( max_bytes / ( (uint32)w * 4 ) );
+		if ( max_rows < 1 ) max_rows = 1;
+
+		for ( row = 0; row < h; row += band )
+		{
+			band = h - row < max_rows ? h - row : max_rows;
+			src = fb->pixels + (size_t)( y + row ) * fb->width + x;
+
+			if ( w == fb->width )
+			{
+				// Full rows are contiguous already
+				xcb_put_image( window->connection, XCB_IMAGE_FORMAT_Z_PIXMAP, window->window, fb->gc,
+							   (uint16)w, (uint16)band, (int16)x, (int16)( y + row ), 0,
+							   window->context->screen->root_depth, (uint32)( w * band * 4 ), (const uint8*)src );
+				continue;
+			}
+
+			// Pack the rows of the rectangle into a temporary image
+			data = (uint32*)mem_scratch_push( (size_t)w * band * 4 );
+
+			for ( rows = 0; rows < band; ++rows )
+				memcpy( data + rows * w, src + (size_t)rows * fb->width, (size_t)w * 4 );
+
+			xcb_put_image( window->connection, XCB_IMAGE_FORMAT_Z_PIXMAP, window->window, fb->gc,
+						   (uint16)w, (uint16)band, (int16)x, (int16)( y + row ), 0,
+						   window->context->screen->root_depth, (uint32)( w * band * 4 ), (const uint8*)data );
+
+			mem_scratch_pop( data );
+		}
+	}
+
+	xcb_flush( window->connection );
+}
+
+void clipboard_copy( syswindow_t* window, const char_t* text )
+{
+	if ( window == NULL ) return;
+	if ( text == NULL ) return;
+
+	// Transfers still in progress would read the new text
+	clip_cleared = false;
+	while ( clip_transfer_count ) clipboard_end_transfer( window->context, 0 );
+
+	mem_free( clip_text );
+
+	clip_length = mstrlen( text );
+	clip_text = (char*)mem_alloc( clip_length + 1 );
+
+	memcpy( clip_text, text, clip_length + 1 );
+
+	xcb_set_selection_owner( window->connection, window->window, window->context->atoms[ATOM_CLIPBOARD], XCB_CURRENT_TIME );
+	xcb_flush( window->connection );
+}
+
+static void paste_collect( const char* chunk, size_t length, bool last, void* data )
+{
+	paste_collect_t* collect = (paste_collect_t*)data;
+	char* text;
+
+	if ( chunk && collect->length + length + 1 > collect->capacity )
+	{
+		collect->capacity = collect->capacity ? 2 * collect->capacity : 1024;
+		while ( collect->capacity < collect->length + length + 1 ) collect->capacity *= 2;
+
+		text = (char*)mem_alloc( collect->capacity );
+		if ( collect->length ) memcpy( text, collect->text, collect->length );
+
+		mem_free( collect->text );
+		collect->text = text;
+	}
+
+	if ( chunk )
+	{
+		memcpy( collect->text + collect->length, chunk, length );
+		collect->length += length;
+		collect->text[collect->length] = 0;
+	}
+
+	if ( !last ) return;
+
+	if ( collect->cb ) collect->cb( chunk ? collect->text : NULL, collect->data );
+
+	mem_free( collect->text );
+	mem_free( collect );
+}
+
+void clipboard_paste( syswindow_t* window, clip_paste_cb cb, void* data )
+{
+	paste_collect_t* collect;
+
+	if ( window == NULL ) return;
+
+	collect = (paste_collect_t*)mem_alloc_clean( sizeof(*collect) );
+	collect->cb = cb;
+	collect->data = data;
+
+	clipboard_paste_stream( window, paste_collect, collect );
+}
+
+void clipboard_paste_stream( syswindow_t* window, clip_stream_cb cb, void* data )
+{
+	clipboard_request( window, cb, data, CLIPBOARD_TIMEOUT );
+}
+
+uint32 clipboard_request( syswindow_t* window, clip_stream_cb cb, void* data, uint32 timeout )
+{
+	clip_request_t* request;
+
+	if ( window == NULL ) return 0;
+	if ( cb == NULL ) return 0;
+
+	if ( clip_request_count == clip_request_capacity )
+	{
+		clip_request_capacity = clip_request_capacity ? 2 * clip_request_capacity : 8;
+
+		request = (clip_request_t*)mem_alloc( clip_request_capacity * sizeof(clip_request_t) );
+		if ( clip_request_count ) memcpy( request, clip_requests, clip_request_count * sizeof(clip_request_t) );
+
+		mem_free( clip_requests );
+		clip_requests = request;
+	}
+
+	if ( ++clip_next_id == 0 ) clip_next_id = 1;
+
+	request = &clip_requests[clip_request_count++];
+	memset( request, 0, sizeof(*request) );
+
+	request->id = clip_next_id;
+	request->window = window;
+	request->cb = cb;
+	request->data = data;
+	request->deadline = timeout == SYNC_INFINITE ? 0 : get_time_ns() + (uint64)timeout * 1000000;
+	request->state = CLIP_QUEUED;
+
+	clip_start_requests();
+
+	return clip_next_id;
+}
+
+bool clipboard_cancel( uint32 id )
+{
+	int32 index;
+
+	index = clip_find_request( id );
+	if ( index < 0 ) return false;
+
+	// A property read in flight is discarded, whatever the owner still sends
+	// ends up in a property which is cleared before it's used again
+	clip_remove_request( (uint32)index );
+	clip_start_requests();
+
+	return true;
+}
+
+void clipboard_handle_event( syswindow_t* window, void* packet )
+{
+	xcb_generic_event_t* event;
+	xcb_selection_notify_event_t* notify;
+	xcb_selection_request_event_t* request;
+	xcb_selection_notify_event_t response;
+	xcb_atom_t property;
+	clip_request_t* paste;
+	uint32 i;
+
+	if ( window == NULL ) return;
+	event = (xcb_generic_event_t*)packet;
+
+	switch ( EVENT_TYPE( event ) )
+	{
+	case XCB_SELECTION_NOTIFY:
+		notify = (xcb_selection_notify_event_t*)event;
+
+		// Find the conversion this answers, by the property or by the target
+		// when the owner refused
+		for ( i = 0; i < clip_request_count; ++i )
+		{
+			paste = &clip_requests[i];
+			if ( paste->window != window || paste->state != CLIP_CONVERTING || paste->pending ) continue;
+
+			if ( notify->property == XCB_ATOM_NONE ? notify->target == paste->target :
+				 notify->property == window->context->atoms[ATOM_MYLLY_SELECTION + paste->slot] ) break;
+		}
+
+		if ( i == clip_request_count ) break;
+
+		if ( notify->property != XCB_ATOM_NONE )
+		{
+			paste->offset = 0;
+			clip_read_property( paste );
+			break;
+		}
+
+		if ( paste->target == window->context->atoms[ATOM_UTF8_STRING] )
+		{
+			paste->target = XCB_ATOM_STRING;
+			clip_convert( paste );
+			break;
+		}
+
+		clip_finish( i, NULL, 0 );
+		break;
+
+	case XCB_SELECTION_REQUEST:
+		request = (xcb_selection_request_event_t*)event;
+
+		// Obsolete clients leave the property out
+		property = request->property != XCB_ATOM_NONE ? request->property : request->target;
+
+		memset( &response, 0, sizeof(response) );
+
+		response.response_type = XCB_SELECTION_NOTIFY;
+		response.time = request->time;
+		response.requestor = request->requestor;
+		response.selection = request->selection;
+		response.target = request->target;
+		response.property = clipboard_send( window, request->requestor, property, request->target ) ? property : XCB_ATOM_NONE;
+
+		xcb_send_event( window->connection, 0, request->requestor, XCB_EVENT_MASK_NO_EVENT, (const char*)&response );
+		xcb_flush( window->connection );
+		break;
+
+	case XCB_SELECTION_CLEAR:
+		// Someone else owns the clipboard now, keep the text only for the
+		// transfers still in progress
+		if ( clip_transfer_count == 0 )
+		{
+			mem_free( clip_text );
+
+			clip_text = NULL;
+			clip_length = 0;
+		}
+		else
+		{
+			clip_cleared = true;
+		}
+		break;
+	}
+}
+
+void set_mouse_cursor( syswindow_t* window, MOUSECURSOR cursor )
+{
+	static const uint16 glyphs[NUM_CURSORS] = { XC_left_ptr, XC_xterm, XC_crosshair, XC_fleur, XC_X_cursor };
+	xcb_cursor_t* cursors;
+	xcb_font_t font;
+
+	if ( window == NULL ) return;
+	if ( cursor >= NUM_CURSORS ) return;
+
+	cursors = window->context->cursors;
+
+	if ( !cursors[cursor] )
+	{
+		// The cursor needs to be created from the standard cursor font first
+		font = xcb_generate_id( window->connection );
+		xcb_open_font( window->connection, font, 6, "cursor" );
+
+		cursors[cursor] = xcb_generate_id( window->connection );
+		xcb_create_glyph_cursor( window->connection, cursors[cursor], font, font, glyphs[cursor], glyphs[cursor] + 1,
+								 0, 0, 0, 0xFFFF, 0xFFFF, 0xFFFF );
+
+		xcb_close_font( window->connection, font );
+	}
+
+	xcb_change_window_attributes( window->connection, window->window, XCB_CW_CURSOR, &cursors[cursor] );
+	xcb_flush( window->connection );
+}
+
+#endif /* MYLLY_USE_XCB */
@@ -1,9 +1,15 @@
 -- A library for all platform specific functionality
 
+newoption {
+	trigger = "with-xcb",
+	description = "Use XCB instead of Xlib for the X11 window backend"
+}
+
 project "Lib-Platform"
 	kind "StaticLib"
 	language "C"
 	files { "**.h", "**.c", "premake4.lua" }
+	excludes { "Benchmarks/**" } -- Standalone programs, see the header of each
 	vpaths { [""] = { "../Libraries/Platform" } }
 	includedirs { ".", ".." }
 	location ( "../../Projects/" .. os.get() .. "/" .. _ACTION )
@@ -13,6 +19,10 @@ project "Lib-Platform"
 		targetextension ".a"
 		configuration "Debug" targetname "libplatformd"
 		configuration "Release" targetname "libplatform"
+
+	-- Applications including Window.h must define MYLLY_USE_XCB as well and link with xcb
+	configuration { "linux", "with-xcb" }
+		defines { "MYLLY_USE_XCB" }
 	
 	-- Windows specific stuff
 	configuration "windows"